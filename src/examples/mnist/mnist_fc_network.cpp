@@ -26,11 +26,8 @@ int main(int argc, char* argv[]) {
     float decay_rate = 20.f;
 
     auto training_data = mnist_dataset.training_data();
-    activator_t<float> sigmoid_activator(sigmoid_v<float>, sigmoid_derivative_v<float>);
-    // derivative returns 1 because it is cancelled out when using cross-entropy
-    activator_t<float> softmax_activator(stable_softmax_v<float>,
-                                          [](array3d_t<float> const &x){
-        return array3d_t<float>(shape_row(x.size()), 1.0);});
+    activator_t<float> sigmoid_activator(activation_kind::sigmoid);
+    activator_t<float> softmax_activator(activation_kind::softmax);
 
     sdg_optimizer_t<float> sdg_optimizer(mini_batch_size,
                                          training_data.size(),
@@ -24,7 +24,7 @@ int fill_array(yannpp::array3d_t<float> &arr, int start=0) {
 int main() {
     using namespace yannpp;
 
-    activator_t<float> relu_activator(relu_v<float>, relu_v<float>);
+    activator_t<float> relu_activator(activation_kind::relu);
     fully_connected_layer_t<float> dense(3, 2, relu_activator);
 
     array3d_t<float> weight(shape3d_t(3, 2, 1), 0.f);
@@ -0,0 +1,9 @@
+#ifndef TESTS_ALLOCATIONS_H
+#define TESTS_ALLOCATIONS_H
+
+#include <cstddef>
+
+// number of calls of the global operator new in the test binary (see tests_main.cpp)
+size_t global_allocations_count();
+
+#endif // TESTS_ALLOCATIONS_H
@@ -1,16 +1,27 @@
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include <vector>
 
 #include <gtest/gtest.h>
 
+#include <yannpp/common/allocator.h>
+#include <yannpp/common/arena.h>
 #include <yannpp/common/array3d.h>
 #include <yannpp/common/array3d_math.h>
+#include <yannpp/common/array4d.h>
 #include <yannpp/common/log.h>
 #include <yannpp/layers/convolutionlayer.h>
+#include <yannpp/layers/convolutionpoolinglayer.h>
+#include <yannpp/layers/fftconvolutionlayer.h>
+#include <yannpp/layers/fullyconnectedlayer.h>
+#include <yannpp/layers/poolinglayer.h>
+#include <yannpp/layers/winogradconvolutionlayer.h>
 #include <yannpp/optimizer/optimizer.h>
 
-static yannpp::activator_t<float> relu_activator(yannpp::relu_v<float>, yannpp::relu_v<float>);
+#include "tests_allocations.h"
+
+static yannpp::activator_t<float> relu_activator(yannpp::activation_kind::relu);
 
 bool arrays_equal(yannpp::array3d_t<float> const &a, yannpp::array3d_t<float> const &b) {
     bool equal = false;
@@ -25,11 +36,14 @@ bool arrays_equal(yannpp::array3d_t<float> const &a, yannpp::array3d_t<float> co
             break;
         }
 
-        float eps = 0.0000001f;
+        // vectorized kernels reorder summation so compare
+        // with tolerance relative to the magnitude of values
+        float eps = 0.00001f;
         bool anyFailure = false;
         const size_t size = adata.size();
         for (size_t i = 0; i < size; i++) {
-            if (fabs(adata[i] - bdata[i]) > eps) {
+            float scale = std::max(1.f, std::max(std::fabs(adata[i]), std::fabs(bdata[i])));
+            if (fabs(adata[i] - bdata[i]) > eps * scale) {
                 yannpp::log("Difference at %d: %.6f != %.6f", i, adata[i], bdata[i]);
                 anyFailure = true;
                 break;
@@ -99,12 +113,20 @@ class fake_optimizer_t: public yannpp::optimizer_t<float> {
 private:
     using nabla_array = std::vector<yannpp::array3d_t<float>>;
 public:
-    virtual void update_bias(yannpp::array3d_t<float> &, yannpp::array3d_t<float> &nabla_b) const override {
+    virtual void update_bias(float *, float *, float *const *, size_t, size_t) const override {}
+    virtual void update_weights(float *, float *, float *const *, size_t, size_t) const override {}
+
+    // optimizers reset gradients after the update
+    virtual void update_bias(yannpp::array3d_t<float> &, yannpp::array3d_t<float> &nabla_b,
+                             yannpp::optimizer_state_t<float> &) const override {
         const_cast<nabla_array&>(this->nabla_b_).push_back(nabla_b);
+        nabla_b.reset(0);
     }
 
-    virtual void update_weights(yannpp::array3d_t<float> &, yannpp::array3d_t<float> &nabla_w) const override {
+    virtual void update_weights(yannpp::array3d_t<float> &, yannpp::array3d_t<float> &nabla_w,
+                                yannpp::optimizer_state_t<float> &) const override {
         const_cast<nabla_array&>(this->nabla_w_).push_back(nabla_w);
+        nabla_w.reset(0);
     }
 
 public:
@@ -417,6 +439,84 @@ TEST (ConvolutionTests, NablaBiasBackpropagateMoreThanOnceTest) {
     }
 }
 
+TEST (ConvolutionTests, ParametersExposeAccumulatedNablasTest) {
+    using namespace yannpp;
+
+    conv_loop_ptr loop;
+    conv_matrix_ptr matrix;
+    prepare_layers_for_comparison(loop, matrix, padding_type::same);
+
+    auto error = create_error(loop->get_output_shape());
+    matrix->backpropagate(error.clone());
+    loop->backpropagate(error.clone());
+
+    auto loop_parameters = loop->parameters();
+    auto matrix_parameters = matrix->parameters();
+    ASSERT_EQ(loop_parameters.size(), matrix_parameters.size());
+
+    for (size_t i = 0; i < loop_parameters.size(); i++) {
+        ASSERT_TRUE(arrays_equal(*loop_parameters[i].nabla, *matrix_parameters[i].nabla)) << "Arrays are not equal at " << i;
+    }
+}
+
+TEST (ConvolutionTests, ClonedLayerAccumulatesNablasInOneMatrixTest) {
+    using namespace yannpp;
+
+    conv_loop_ptr loop;
+    conv_matrix_ptr matrix;
+    prepare_layers_for_comparison(loop, matrix, padding_type::same);
+    // nablas of the clone are laid out as rows right away
+    auto clone = matrix->clone();
+    auto clone_parameters = clone->parameters();
+    const float *first_row = clone_parameters[0].nabla->data().data();
+
+    auto error = create_error(loop->get_output_shape());
+    clone->backpropagate(error.clone());
+    loop->backpropagate(error.clone());
+
+    auto loop_parameters = loop->parameters();
+    clone_parameters = clone->parameters();
+    ASSERT_EQ(loop_parameters.size(), clone_parameters.size());
+
+    // weights go first and their nablas are rows with the aligned stride
+    // which backpropagation does not move
+    const size_t stride = flat_arena_t::footprint(clone_parameters[0].nabla->size() * sizeof(float)) / sizeof(float);
+    for (size_t i = 0; i < clone_parameters.size(); i++) {
+        ASSERT_TRUE(arrays_equal(*loop_parameters[i].nabla, *clone_parameters[i].nabla)) << "Arrays are not equal at " << i;
+        if (clone_parameters[i].nabla->size() > 1) {
+            ASSERT_EQ(first_row + i * stride, clone_parameters[i].nabla->data().data());
+        }
+    }
+}
+
+TEST (ConvolutionTests, ScatteredNablasAccumulateInPlaceTest) {
+    using namespace yannpp;
+
+    conv_loop_ptr loop;
+    conv_matrix_ptr matrix;
+    prepare_layers_for_comparison(loop, matrix, padding_type::same);
+
+    // e.g. the caller moved every nabla to own storage
+    std::vector<const float *> placed;
+    for (auto &p: matrix->parameters()) {
+        move_to_arena(*p.nabla, std::make_shared<flat_arena_t>(flat_arena_t::footprint(p.nabla->size() * sizeof(float))));
+        placed.push_back(p.nabla->data().data());
+    }
+    const size_t version = matrix->parameters_version();
+
+    auto error = create_error(loop->get_output_shape());
+    matrix->backpropagate(error.clone());
+    loop->backpropagate(error.clone());
+
+    auto loop_parameters = loop->parameters();
+    auto matrix_parameters = matrix->parameters();
+    ASSERT_EQ(version, matrix->parameters_version());
+    for (size_t i = 0; i < matrix_parameters.size(); i++) {
+        ASSERT_TRUE(arrays_equal(*loop_parameters[i].nabla, *matrix_parameters[i].nabla)) << "Arrays are not equal at " << i;
+        ASSERT_EQ(placed[i], matrix_parameters[i].nabla->data().data());
+    }
+}
+
 TEST (ConvolutionTests, ErrorBackpropagateMoreThanOnceTest) {
     using namespace yannpp;
 
@@ -473,3 +573,416 @@ TEST (ConvolutionTests, ErrorBackpropagateWithValidPaddingTest) {
     ASSERT_TRUE(arrays_equal(loop->backpropagate(error.clone()),
                              matrix->backpropagate(error.clone())));
 }
+
+template<typename Layer>
+void check_batch_matches_single_samples(yannpp::padding_type padding) {
+    using namespace yannpp;
+
+    shape3d_t filter_shape(3, 3, 2);
+    shape3d_t input_shape(7, 7, 2);
+    const int filters_number = 3, batch = 4;
+
+    Layer batched(input_shape, filter_shape, filters_number, 2, padding, relu_activator);
+    batched.load(create_filters(filters_number, filter_shape), create_biases(filters_number));
+    batched.init();
+    Layer single(input_shape, filter_shape, filters_number, 2, padding, relu_activator);
+    single.load(create_filters(filters_number, filter_shape), create_biases(filters_number));
+    single.init();
+
+    const shape3d_t output_shape = batched.get_output_shape();
+    array4d_t<float> input(batch, input_shape, 0.f), error(batch, output_shape, 0.f);
+    std::vector<array3d_t<float>> inputs, errors;
+    for (int b = 0; b < batch; b++) {
+        inputs.emplace_back(input_shape, 0.f); fill_array(inputs.back(), b * 10);
+        errors.emplace_back(output_shape, 0.f); fill_array(errors.back(), b);
+        errors.back().mul(0.01f);
+        input.set_sample(b, inputs.back());
+        error.set_sample(b, errors.back());
+    }
+
+    auto output = batched.feedforward(std::move(input));
+    auto delta = batched.backpropagate(std::move(error));
+    fake_optimizer_t batched_optimizer;
+    batched.optimize(batched_optimizer);
+
+    for (int b = 0; b < batch; b++) {
+        ASSERT_TRUE(arrays_equal(output.sample(b), single.feedforward(inputs[b].clone()))) << "Output " << b;
+        ASSERT_TRUE(arrays_equal(delta.sample(b), single.backpropagate(errors[b].clone()))) << "Error " << b;
+    }
+
+    fake_optimizer_t single_optimizer;
+    single.optimize(single_optimizer);
+    for (int i = 0; i < filters_number; i++) {
+        ASSERT_TRUE(arrays_equal(batched_optimizer.get_nabla_w()[i], single_optimizer.get_nabla_w()[i]));
+        ASSERT_TRUE(arrays_equal(batched_optimizer.get_nabla_b()[i], single_optimizer.get_nabla_b()[i]));
+    }
+}
+
+TEST (ConvolutionTests, BatchMatchesSingleSamplesTest) {
+    using namespace yannpp;
+
+    check_batch_matches_single_samples<convolution_layer_loop_t<float>>(padding_type::valid);
+    check_batch_matches_single_samples<convolution_layer_loop_t<float>>(padding_type::same);
+    check_batch_matches_single_samples<convolution_layer_2d_t<float>>(padding_type::valid);
+    check_batch_matches_single_samples<convolution_layer_2d_t<float>>(padding_type::same);
+}
+
+// Winograd transforms cancel large terms so the error of every
+// element is relative to the largest magnitude in the array
+bool arrays_near(yannpp::array3d_t<float> const &a, yannpp::array3d_t<float> const &b, float eps) {
+    if (a.shape() != b.shape()) { return false; }
+
+    auto &adata = a.data();
+    auto &bdata = b.data();
+    float scale = 1.f;
+    for (auto v: adata) { scale = std::max(scale, std::fabs(v)); }
+
+    for (size_t i = 0; i < adata.size(); i++) {
+        if (std::fabs(adata[i] - bdata[i]) > eps * scale) {
+            yannpp::log("Difference at %d: %.6f != %.6f", i, adata[i], bdata[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template<typename Layer>
+void check_layer_matches_loop(yannpp::padding_type padding, int filter_size, int stride, float eps, bool check_nablas = true) {
+    using namespace yannpp;
+
+    shape3d_t filter_shape(filter_size, filter_size, 4);
+    shape3d_t input_shape(11 + filter_size, 9 + filter_size, 4);
+    const int filters_number = 6, batch = 2;
+
+    convolution_layer_loop_t<float> loop(input_shape, filter_shape, filters_number, stride, padding, relu_activator);
+    loop.load(create_filters(filters_number, filter_shape), create_biases(filters_number));
+    loop.init();
+    Layer layer(input_shape, filter_shape, filters_number, stride, padding, relu_activator);
+    layer.load(create_filters(filters_number, filter_shape), create_biases(filters_number));
+    layer.init();
+
+    ASSERT_TRUE(loop.get_output_shape() == layer.get_output_shape());
+
+    for (int b = 0; b < batch; b++) {
+        array3d_t<float> input(input_shape, 0.f);
+        fill_array(input, b * 3);
+        input.mul(0.01f);
+        array3d_t<float> error(loop.get_output_shape(), 0.f);
+        fill_array(error, b);
+        error.mul(0.001f);
+
+        ASSERT_TRUE(arrays_near(loop.feedforward(input.clone()), layer.feedforward(input.clone()), eps));
+        ASSERT_TRUE(arrays_near(loop.backpropagate(error.clone()), layer.backpropagate(error.clone()), eps));
+    }
+
+    if (!check_nablas) { return; }
+
+    fake_optimizer_t loop_optimizer, layer_optimizer;
+    loop.optimize(loop_optimizer);
+    layer.optimize(layer_optimizer);
+    for (int i = 0; i < filters_number; i++) {
+        ASSERT_TRUE(arrays_near(loop_optimizer.get_nabla_w()[i], layer_optimizer.get_nabla_w()[i], eps));
+        ASSERT_TRUE(arrays_near(loop_optimizer.get_nabla_b()[i], layer_optimizer.get_nabla_b()[i], eps));
+    }
+}
+
+TEST (ConvolutionTests, Im2colMatchesLoopTest) {
+    using namespace yannpp;
+
+    // loop layer applies stride to the filter offset in its weight gradients
+    // so only outputs and input gradients are comparable for strided convolutions
+    for (int filter_size: {1, 3, 4}) {
+        for (int stride: {1, 2, 3}) {
+            check_layer_matches_loop<convolution_layer_2d_t<float>>(padding_type::valid, filter_size, stride, 1e-5f, stride == 1);
+            check_layer_matches_loop<convolution_layer_2d_t<float>>(padding_type::same, filter_size, stride, 1e-5f, stride == 1);
+        }
+    }
+}
+
+TEST (ConvolutionTests, WinogradMatchesLoopTest) {
+    using namespace yannpp;
+
+    // F(4x4, 3x3) transforms have bigger coefficients so it is less accurate
+    check_layer_matches_loop<convolution_layer_winograd_t<float, 2>>(padding_type::valid, 3, 1, 1e-6f);
+    check_layer_matches_loop<convolution_layer_winograd_t<float, 2>>(padding_type::same, 3, 1, 1e-6f);
+    check_layer_matches_loop<convolution_layer_winograd_t<float, 4>>(padding_type::valid, 3, 1, 1e-5f);
+    check_layer_matches_loop<convolution_layer_winograd_t<float, 4>>(padding_type::same, 3, 1, 1e-5f);
+}
+
+TEST (ConvolutionTests, FftMatchesLoopTest) {
+    using namespace yannpp;
+
+    for (int filter_size: {3, 7}) {
+        for (int stride: {1, 2}) {
+            check_layer_matches_loop<convolution_layer_fft_t<float>>(padding_type::valid, filter_size, stride, 1e-5f);
+            check_layer_matches_loop<convolution_layer_fft_t<float>>(padding_type::same, filter_size, stride, 1e-5f);
+        }
+    }
+}
+
+TEST (ConvolutionTests, FftFilterSpectraUpdateTest) {
+    using namespace yannpp;
+
+    shape3d_t filter_shape(5, 5, 2);
+    shape3d_t input_shape(12, 12, 2);
+    convolution_layer_loop_t<float> loop(input_shape, filter_shape, 3, 1, padding_type::same, relu_activator);
+    convolution_layer_fft_t<float> fft(input_shape, filter_shape, 3, 1, padding_type::same, relu_activator);
+    loop.load(create_filters(3, filter_shape), create_biases(3));
+    fft.load(create_filters(3, filter_shape), create_biases(3));
+
+    auto input = create_input(input_shape);
+    ASSERT_TRUE(arrays_near(loop.feedforward(input.clone()), fft.feedforward(input.clone()), 1e-5f));
+
+    // cached spectra of the old filters must not be used
+    auto filters = create_filters(3, filter_shape);
+    for (auto &f: filters) { f.mul(-0.5f); }
+    fft.load(std::move(filters), create_biases(3));
+    filters = create_filters(3, filter_shape);
+    for (auto &f: filters) { f.mul(-0.5f); }
+    loop.load(std::move(filters), create_biases(3));
+
+    ASSERT_TRUE(arrays_near(loop.feedforward(input.clone()), fft.feedforward(input.clone()), 1e-5f));
+
+    // weights written in place are announced with parameters_changed()
+    auto loop_parameters = loop.parameters(), fft_parameters = fft.parameters();
+    for (size_t i = 0; i < fft_parameters.size(); i++) {
+        loop_parameters[i].value->mul(2.f);
+        fft_parameters[i].value->mul(2.f);
+    }
+    fft.parameters_changed();
+
+    ASSERT_TRUE(arrays_near(loop.feedforward(input.clone()), fft.feedforward(input.clone()), 1e-5f));
+}
+
+// deterministic values of both signs so some activations are cut by relu
+void fill_signed(yannpp::array3d_t<float> &arr, float phase) {
+    auto &data = arr.data();
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = std::sin(0.37f * i + phase);
+    }
+}
+
+void check_fused_matches_separate(yannpp::padding_type padding, int stride) {
+    using namespace yannpp;
+
+    shape3d_t filter_shape(3, 3, 3);
+    shape3d_t input_shape(14, 13, 3);
+    const int filters_number = 5, batch = 3;
+
+    std::vector<array3d_t<float>> filters, fused_filters;
+    for (int i = 0; i < filters_number; i++) {
+        filters.emplace_back(filter_shape, 0.f);
+        fill_signed(filters.back(), i);
+        fused_filters.push_back(filters.back().clone());
+    }
+
+    convolution_layer_2d_t<float> conv(input_shape, filter_shape, filters_number, stride, padding, relu_activator);
+    conv.load(std::move(filters), create_biases(filters_number));
+    conv.init();
+    pooling_layer_t<float> pooling(2, 2);
+    convolution_pooling_layer_t<float> fused(input_shape, filter_shape, filters_number, stride, padding, relu_activator, 2, 2);
+    fused.load(std::move(fused_filters), create_biases(filters_number));
+    fused.init();
+
+    array4d_t<float> input(batch, input_shape, 0.f);
+    for (int b = 0; b < batch; b++) {
+        array3d_t<float> sample(input_shape, 0.f);
+        fill_signed(sample, 10.f * b);
+        input.set_sample(b, sample);
+    }
+
+    auto pooled = pooling.feedforward(conv.feedforward(array4d_t<float>(input)));
+    auto fused_pooled = fused.feedforward(std::move(input));
+    ASSERT_TRUE(pooled.shape() == fused.get_pooled_shape());
+    for (int b = 0; b < batch; b++) {
+        ASSERT_TRUE(arrays_near(pooled.sample(b), fused_pooled.sample(b), 1e-5f));
+    }
+
+    array4d_t<float> error(batch, pooled.shape(), 0.f);
+    for (int b = 0; b < batch; b++) {
+        array3d_t<float> sample(pooled.shape(), 0.f);
+        fill_signed(sample, 3.f * b + 1.f);
+        error.set_sample(b, sample);
+    }
+
+    auto delta_next = conv.backpropagate(pooling.backpropagate(array4d_t<float>(error)));
+    auto fused_delta_next = fused.backpropagate(std::move(error));
+    for (int b = 0; b < batch; b++) {
+        ASSERT_TRUE(arrays_near(delta_next.sample(b), fused_delta_next.sample(b), 1e-5f));
+    }
+
+    fake_optimizer_t conv_optimizer, fused_optimizer;
+    conv.optimize(conv_optimizer);
+    fused.optimize(fused_optimizer);
+    for (int i = 0; i < filters_number; i++) {
+        ASSERT_TRUE(arrays_near(conv_optimizer.get_nabla_w()[i], fused_optimizer.get_nabla_w()[i], 1e-5f));
+        ASSERT_TRUE(arrays_near(conv_optimizer.get_nabla_b()[i], fused_optimizer.get_nabla_b()[i], 1e-5f));
+    }
+}
+
+TEST (ConvolutionTests, FusedPoolingMatchesSeparateLayersTest) {
+    using namespace yannpp;
+
+    for (int stride: {1, 2}) {
+        check_fused_matches_separate(padding_type::valid, stride);
+        check_fused_matches_separate(padding_type::same, stride);
+    }
+}
+
+// inference output is the same as in training and layer can be trained after it
+void check_inference_matches_training(yannpp::layer_base_t<float> &layer, yannpp::array4d_t<float> const &input) {
+    using namespace yannpp;
+
+    auto expected = layer.feedforward(array4d_t<float>(input));
+    layer.set_inference(true);
+    auto actual = layer.feedforward(array4d_t<float>(input));
+    // single sample takes smaller temporaries
+    auto single = layer.feedforward(array4d_t<float>(input.sample(1)));
+    layer.set_inference(false);
+
+    ASSERT_EQ(expected.batch(), actual.batch());
+    for (size_t b = 0; b < expected.batch(); b++) {
+        ASSERT_TRUE(arrays_equal(expected.sample(b), actual.sample(b)));
+    }
+    ASSERT_TRUE(arrays_equal(expected.sample(1), single.sample(0)));
+
+    auto output = layer.feedforward(array4d_t<float>(input));
+    auto delta_next = layer.backpropagate(array4d_t<float>(output));
+    ASSERT_EQ(input.batch(), delta_next.batch());
+    ASSERT_TRUE(input.shape() == delta_next.shape());
+}
+
+TEST (ConvolutionTests, InferenceMatchesTrainingTest) {
+    using namespace yannpp;
+
+    shape3d_t filter_shape(3, 3, 3);
+    shape3d_t input_shape(10, 9, 3);
+    const int filters_number = 4, batch = 3;
+
+    array4d_t<float> input(batch, input_shape, 0.f);
+    for (int b = 0; b < batch; b++) {
+        array3d_t<float> sample(input_shape, 0.f);
+        fill_signed(sample, 10.f * b);
+        input.set_sample(b, sample);
+    }
+
+    for (auto padding: {padding_type::valid, padding_type::same}) {
+        convolution_layer_loop_t<float> loop(input_shape, filter_shape, filters_number, 1, padding, relu_activator);
+        convolution_layer_2d_t<float> conv(input_shape, filter_shape, filters_number, 2, padding, relu_activator);
+        convolution_pooling_layer_t<float> fused(input_shape, filter_shape, filters_number, 1, padding, relu_activator, 2, 2);
+        loop.init();
+        conv.init();
+        fused.init();
+
+        check_inference_matches_training(loop, input);
+        check_inference_matches_training(conv, input);
+        check_inference_matches_training(fused, input);
+    }
+
+    pooling_layer_t<float> pooling(2, 2);
+    check_inference_matches_training(pooling, input);
+}
+
+// writing into dirty preallocated buffers gives the same as allocating versions
+void check_into_matches_allocating(yannpp::layer_base_t<float> &layer, yannpp::layer_base_t<float> &reference,
+                                   yannpp::array4d_t<float> const &input) {
+    using namespace yannpp;
+
+    auto expected = reference.feedforward(array4d_t<float>(input));
+    array4d_t<float> output(2 * expected.batch(), expected.shape(), 123.f);
+    layer.feedforward_into(input, output);
+    ASSERT_TRUE(output.shape() == layer.get_output_shape(input.shape()));
+    ASSERT_EQ(expected.batch(), output.batch());
+    for (size_t b = 0; b < expected.batch(); b++) {
+        ASSERT_TRUE(arrays_equal(expected.sample(b), output.sample(b)));
+    }
+
+    array4d_t<float> error(expected.batch(), expected.shape(), 0.f);
+    for (size_t b = 0; b < error.batch(); b++) {
+        array3d_t<float> sample(expected.shape(), 0.f);
+        fill_signed(sample, 2.f * b + 1.f);
+        error.set_sample(b, sample);
+    }
+
+    auto expected_delta = reference.backpropagate(array4d_t<float>(error));
+    array4d_t<float> delta_next(3 * input.batch(), input.shape(), -7.f);
+    layer.backpropagate_into(error, delta_next);
+    ASSERT_EQ(expected_delta.batch(), delta_next.batch());
+    for (size_t b = 0; b < expected_delta.batch(); b++) {
+        ASSERT_TRUE(arrays_equal(expected_delta.sample(b), delta_next.sample(b)));
+    }
+}
+
+TEST (ConvolutionTests, IntoBuffersMatchAllocatingTest) {
+    using namespace yannpp;
+
+    shape3d_t filter_shape(3, 3, 3);
+    shape3d_t input_shape(10, 9, 3);
+    const int filters_number = 4, batch = 3;
+
+    array4d_t<float> input(batch, input_shape, 0.f);
+    for (int b = 0; b < batch; b++) {
+        array3d_t<float> sample(input_shape, 0.f);
+        fill_signed(sample, 10.f * b);
+        input.set_sample(b, sample);
+    }
+
+    for (auto padding: {padding_type::valid, padding_type::same}) {
+        convolution_layer_2d_t<float> conv(input_shape, filter_shape, filters_number, 2, padding, relu_activator);
+        conv.init();
+        auto reference = conv.clone();
+        check_into_matches_allocating(conv, *reference, input);
+
+        convolution_pooling_layer_t<float> fused(input_shape, filter_shape, filters_number, 1, padding, relu_activator, 2, 2);
+        fused.init();
+        auto reference_fused = fused.clone();
+        check_into_matches_allocating(fused, *reference_fused, input);
+    }
+
+    pooling_layer_t<float> pooling(2, 2);
+    pooling_layer_t<float> reference_pooling(2, 2);
+    check_into_matches_allocating(pooling, reference_pooling, input);
+
+    fully_connected_layer_t<float> dense(input_shape.capacity(), 5, relu_activator);
+    dense.init();
+    auto reference_dense = dense.clone();
+    check_into_matches_allocating(dense, *reference_dense, input);
+}
+
+TEST (ConvolutionTests, SteadyStateDoesNotAllocateTest) {
+    using namespace yannpp;
+
+    shape3d_t filter_shape(3, 3, 3);
+    shape3d_t input_shape(12, 12, 3);
+    const int filters_number = 4, batch = 2;
+
+    array4d_t<float> input(batch, input_shape, 0.f);
+    for (int b = 0; b < batch; b++) {
+        array3d_t<float> sample(input_shape, 0.f);
+        fill_signed(sample, 10.f * b);
+        input.set_sample(b, sample);
+    }
+
+    convolution_layer_2d_t<float> conv(input_shape, filter_shape, filters_number, 1, padding_type::same, relu_activator);
+    conv.init();
+    auto output_shape = conv.get_output_shape(input_shape);
+    array4d_t<float> output, error, delta_next;
+
+    // first step grows arena, caches and buffers which are reused later
+    size_t allocations = 0, global_allocations = 0;
+    for (int step = 0; step < 3; step++) {
+        if (step == 2) {
+            allocations = heap_allocations_count();
+            global_allocations = global_allocations_count();
+        }
+        conv.feedforward_into(input, output);
+        error.resize(batch, output_shape);
+        error.reset(0.1f);
+        conv.backpropagate_into(error, delta_next);
+    }
+
+    ASSERT_EQ(global_allocations, global_allocations_count());
+    ASSERT_EQ(allocations, heap_allocations_count());
+    ASSERT_EQ(0, thread_arena().used());
+}
@@ -1,7 +1,30 @@
+#include <atomic>
 #include <cstdlib>
+#include <new>
 
 #include <gtest/gtest.h>
 
+#include "tests_allocations.h"
+
+namespace {
+    std::atomic<size_t> global_allocations(0);
+}
+
+// every allocation of the test binary is counted so tests can check
+// that the steady state of training does not touch the heap at all
+void *operator new(size_t size) {
+    global_allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) { throw std::bad_alloc(); }
+    return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+
+size_t global_allocations_count() { return global_allocations.load(std::memory_order_relaxed); }
+
 int main(int argc, char **argv) {
     //::testing::GTEST_FLAG(catch_exceptions) = false;
     //::testing::GTEST_FLAG(filter) = "ConvolutionTests.*";
@@ -0,0 +1,674 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <yannpp/common/allocator.h>
+#include <yannpp/common/arena.h>
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/array3d_math.h>
+#include <yannpp/common/array4d.h>
+#include <yannpp/common/shape.h>
+#include <yannpp/common/simd.h>
+#include <yannpp/network/activator.h>
+#include <yannpp/optimizer/adam_optimizer.h>
+#include <yannpp/optimizer/momentum_optimizer.h>
+#include <yannpp/optimizer/sdg_optimizer.h>
+
+yannpp::array3d_t<float> create_matrix(int height, int width, int seed) {
+    yannpp::array3d_t<float> m(yannpp::shape3d_t(height, width, 1), 0.f);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            m(i, j) = (float)((i * 7 + j * 13 + seed) % 17) / 8.f - 1.f;
+        }
+    }
+    return m;
+}
+
+yannpp::array3d_t<float> naive_gemm(yannpp::array3d_t<float> const &a,
+                                    yannpp::array3d_t<float> const &b,
+                                    yannpp::array3d_t<float> const &c,
+                                    float alpha, float beta,
+                                    bool trans_a, bool trans_b) {
+    const int m = c.shape().x(), n = c.shape().y();
+    const int k = trans_a ? a.shape().x() : a.shape().y();
+    yannpp::array3d_t<float> result(c.shape(), 0.f);
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            double sum = 0;
+            for (int p = 0; p < k; p++) {
+                float aip = trans_a ? a(p, i) : a(i, p);
+                float bpj = trans_b ? b(j, p) : b(p, j);
+                sum += aip * bpj;
+            }
+            result(i, j) = (float)(alpha * sum + beta * c(i, j));
+        }
+    }
+    return result;
+}
+
+void check_gemm(int m, int n, int k, float alpha, float beta, bool trans_a, bool trans_b) {
+    using namespace yannpp;
+
+    auto a = trans_a ? create_matrix(k, m, 1) : create_matrix(m, k, 1);
+    auto b = trans_b ? create_matrix(n, k, 2) : create_matrix(k, n, 2);
+    auto c = create_matrix(m, n, 3);
+    auto expected = naive_gemm(a, b, c, alpha, beta, trans_a, trans_b);
+
+    gemm(a, b, c, alpha, beta, trans_a, trans_b);
+
+    auto &actual_data = c.data();
+    auto &expected_data = expected.data();
+    for (size_t i = 0; i < actual_data.size(); i++) {
+        ASSERT_NEAR(expected_data[i], actual_data[i], 1e-3f * std::max(1.f, std::fabs(expected_data[i])))
+                << "at " << i << " for " << m << "x" << n << "x" << k
+                << " transA=" << trans_a << " transB=" << trans_b;
+    }
+}
+
+TEST (MathTests, GemmMatchesNaiveProductTest) {
+    const int sizes[][3] = {{1, 1, 1}, {4, 8, 3}, {5, 9, 7}, {33, 17, 300}, {130, 21, 25}, {576, 10, 25}};
+    for (auto &s: sizes) {
+        for (int ta = 0; ta < 2; ta++) {
+            for (int tb = 0; tb < 2; tb++) {
+                check_gemm(s[0], s[1], s[2], 1.f, 0.f, ta != 0, tb != 0);
+                check_gemm(s[0], s[1], s[2], 0.5f, 1.f, ta != 0, tb != 0);
+            }
+        }
+    }
+}
+
+TEST (MathTests, ArraysAreAlignedTest) {
+    using namespace yannpp;
+
+    for (int size: {1, 3, 17, 64, 1000}) {
+        array3d_t<float> a(shape_row(size), 0.f);
+        array4d_t<float> b(3, shape_row(size), 0.f);
+        ASSERT_EQ(0, (uintptr_t)a.data().data() % 64) << size;
+        ASSERT_EQ(0, (uintptr_t)b.data().data() % 64) << size;
+    }
+
+    // big buffers start at the huge page
+    allocation_policy_t policy = default_allocation_policy();
+    policy.huge_pages_threshold = 4096;
+    set_allocation_policy(policy);
+    array3d_t<float> big(shape3d_t(30, 1440, 1), 1.f);
+    array3d_t<float> small(shape_row(100), 1.f);
+    set_allocation_policy(default_allocation_policy());
+
+    ASSERT_EQ(0, (uintptr_t)big.data().data() % detail::huge_page_size);
+    ASSERT_EQ(0, (uintptr_t)small.data().data() % 64);
+    ASSERT_FLOAT_EQ(1.f, big(29, 1439, 0));
+    // memory allocated with the other policy is freed correctly
+    big = array3d_t<float>();
+}
+
+TEST (MathTests, ArrayExpressionsTest) {
+    using namespace yannpp;
+
+    shape3d_t shape(3, 4, 5);
+    array3d_t<float> a(shape, 0.f), b(shape, 0.f), c(shape, 0.f);
+    for (size_t i = 0; i < a.size(); i++) {
+        a.data()[i] = i * 0.5f;
+        b.data()[i] = 10.f - i;
+        c.data()[i] = i % 3 + 1.f;
+    }
+
+    array3d_t<float> result(a * 2.f - b * c + 3.f * (a / 4.f) + (-b));
+    ASSERT_TRUE(result.shape() == shape);
+    for (size_t i = 0; i < a.size(); i++) {
+        const float ai = a.data()[i], bi = b.data()[i], ci = c.data()[i];
+        ASSERT_FLOAT_EQ(ai * 2.f - bi * ci + 3.f * (ai / 4.f) - bi, result.data()[i]) << i;
+    }
+
+    // assigned array can be one of the operands
+    array3d_t<float> w(a);
+    w = w * 0.9f - b * 0.1f;
+    w += c;
+    w -= a * a;
+    for (size_t i = 0; i < a.size(); i++) {
+        const float ai = a.data()[i], bi = b.data()[i], ci = c.data()[i];
+        ASSERT_FLOAT_EQ(ai * 0.9f - bi * 0.1f + ci - ai * ai, w.data()[i]) << i;
+    }
+
+    array3d_t<float> empty;
+    empty = b + c;
+    ASSERT_TRUE(empty.shape() == shape);
+    ASSERT_FLOAT_EQ(11.f, empty(0, 0, 0));
+}
+
+TEST (MathTests, SgdOptimizerUpdatesInPlaceTest) {
+    using namespace yannpp;
+
+    // big enough to be split across threads
+    shape3d_t shape(300, 500, 1);
+    array3d_t<float> w(shape, 0.f), nabla_w(shape, 0.f), b(shape_row(10), 1.f), nabla_b(shape_row(10), 2.f);
+    for (size_t i = 0; i < w.size(); i++) {
+        w.data()[i] = (i % 17) * 0.1f;
+        nabla_w.data()[i] = (i % 13) * 0.2f - 1.f;
+    }
+    array3d_t<float> expected(w * (1.f - 0.5f * 2.f / 100.f) - nabla_w * 0.5f);
+
+    sdg_optimizer_t<float> optimizer(4, 100, 2.f, 0.5f);
+    optimizer_state_t<float> w_state, b_state;
+    optimizer.update_weights(w, nabla_w, w_state);
+    optimizer.update_bias(b, nabla_b, b_state);
+    ASSERT_TRUE(w_state.arrays.empty());
+
+    for (size_t i = 0; i < w.size(); i++) {
+        ASSERT_NEAR(expected.data()[i], w.data()[i], 1e-6) << i;
+        ASSERT_EQ(0.f, nabla_w.data()[i]);
+    }
+    ASSERT_FLOAT_EQ(1.f - 0.5f / 4.f * 2.f, b(0));
+    ASSERT_EQ(0.f, nabla_b(9));
+}
+
+TEST (MathTests, MomentumOptimizerKeepsVelocityTest) {
+    using namespace yannpp;
+
+    momentum_optimizer_t<float> optimizer(1, 1, 0.f, 0.5f, 0.9f);
+    array3d_t<float> w(shape_row(3), 1.f), nabla_w(shape_row(3), 2.f);
+    optimizer_state_t<float> state;
+
+    // v = -1, w = 0
+    optimizer.update_weights(w, nabla_w, state);
+    ASSERT_EQ(1, state.arrays.size());
+    ASSERT_EQ(1, state.step);
+    ASSERT_FLOAT_EQ(-1.f, state.arrays[0](0));
+    ASSERT_FLOAT_EQ(0.f, w(0));
+    ASSERT_EQ(0.f, nabla_w(0));
+
+    // v = 0.9 * -1 - 1 = -1.9, w = -1.9
+    nabla_w.reset(2.f);
+    optimizer.update_weights(w, nabla_w, state);
+    ASSERT_FLOAT_EQ(-1.9f, state.arrays[0](2));
+    ASSERT_FLOAT_EQ(-1.9f, w(2));
+}
+
+TEST (MathTests, AdamOptimizerBiasCorrectionTest) {
+    using namespace yannpp;
+
+    // bias corrected first steps move parameters by learning rate against the gradient
+    adam_optimizer_t<float> adam(2, 0.1f);
+    array3d_t<float> w(shape_row(40), 1.f), nabla_w(shape_row(40), 0.f);
+    optimizer_state_t<float> state;
+    for (int step = 0; step < 3; step++) {
+        for (size_t i = 0; i < w.size(); i++) { nabla_w(i) = i % 2 ? 3.f : -0.5f; }
+        adam.update_weights(w, nabla_w, state);
+    }
+
+    ASSERT_EQ(2, state.arrays.size());
+    ASSERT_EQ(3, state.step);
+    ASSERT_NEAR(1.3f, w(0), 1e-5);
+    ASSERT_NEAR(0.7f, w(1), 1e-5);
+    ASSERT_EQ(0.f, nabla_w(1));
+
+    // decoupled decay shrinks weights without gradients, coupled decay becomes a gradient
+    adam_optimizer_t<float> adamw(1, 0.1f, 0.5f, true), adam_l2(1, 0.1f, 0.5f, false);
+    array3d_t<float> w1(shape_row(3), 2.f), w2(shape_row(3), 2.f), nabla(shape_row(3), 0.f);
+    optimizer_state_t<float> state1, state2;
+    adamw.update_weights(w1, nabla, state1);
+    adam_l2.update_weights(w2, nabla, state2);
+    ASSERT_NEAR(2.f * (1.f - 0.1f * 0.5f), w1(0), 1e-6);
+    ASSERT_NEAR(2.f - 0.1f, w2(0), 1e-5);
+}
+
+TEST (MathTests, AdamOptimizerDoublePrecisionTest) {
+    using namespace yannpp;
+
+    // coefficients which are not representable as float
+    const double learning_rate = 0.01, weight_decay = 0.1, beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8;
+    adam_optimizer_t<double> adam(3, learning_rate, weight_decay, true, beta1, beta2, epsilon);
+    array3d_t<double> w(shape_row(5), 0.), nabla_w(shape_row(5), 0.);
+    for (size_t i = 0; i < w.size(); i++) {
+        w(i) = 1. + i / 3.;
+        nabla_w(i) = i / 7. - 0.25;
+    }
+    array3d_t<double> initial_w(w), initial_nabla_w(nabla_w);
+    optimizer_state_t<double> state;
+    adam.update_weights(w, nabla_w, state);
+
+    // reference first step computed in double
+    const double step_size = learning_rate * std::sqrt(1. - beta2) / (1. - beta1);
+    for (size_t i = 0; i < w.size(); i++) {
+        const double g = initial_nabla_w(i) / 3.;
+        const double m = (1. - beta1) * g, v = (1. - beta2) * g * g;
+        const double expected = initial_w(i) * (1. - learning_rate * weight_decay) -
+                step_size * m / (std::sqrt(v) + epsilon * std::sqrt(1. - beta2));
+        ASSERT_NEAR(expected, w(i), 1e-14) << i;
+        ASSERT_NEAR(m, state.arrays[0](i), 1e-16) << i;
+    }
+}
+
+TEST (MathTests, ArenaRewindTest) {
+    using namespace yannpp;
+
+    arena_t arena;
+    {
+        arena_scope_t outer(arena);
+        float *a = arena.allocate<float>(3);
+        ASSERT_EQ(0, (uintptr_t)a % 64);
+        const size_t used = arena.used();
+        float *released = nullptr;
+        {
+            // nested scope gives back only its own memory
+            arena_scope_t inner(arena);
+            auto v = arena.allocate_view<float>(shape3d_t(2, 3, 4), 1.f);
+            ASSERT_EQ(0, (uintptr_t)v.data() % 64);
+            ASSERT_FLOAT_EQ(1.f, v(1, 2, 3));
+            released = v.data();
+            // does not fit into the first block
+            arena.allocate<char>(1 << 20);
+            ASSERT_TRUE(arena.blocks_count() > 1);
+        }
+        ASSERT_EQ(used, arena.used());
+        ASSERT_EQ(released, arena.allocate<float>(24));
+    }
+
+    // after everything is released blocks are merged for the next steps
+    ASSERT_EQ(0, arena.used());
+    ASSERT_EQ(1, arena.blocks_count());
+    const size_t capacity = arena.capacity();
+    ASSERT_TRUE(capacity >= (1 << 20));
+    {
+        arena_scope_t scope(arena);
+        arena.allocate<char>(1 << 20);
+    }
+    ASSERT_EQ(capacity, arena.capacity());
+}
+
+TEST (MathTests, FlatArenaArraysDoNotGrowTest) {
+    using namespace yannpp;
+
+    auto arena = std::make_shared<flat_arena_t>(flat_arena_t::footprint(4 * sizeof(float)));
+    array3d_t<float> array(shape_row(4), 1.f);
+    move_to_arena(array, arena);
+    ASSERT_EQ((void*)arena->data(), (void*)array.data().data());
+    ASSERT_FLOAT_EQ(1.f, array(3));
+
+    // arena is sized exactly for its arrays and memory is not given back
+    ASSERT_THROW(array.data().resize(1024), std::bad_alloc);
+}
+
+TEST (MathTests, GemmMatchesDot21Test) {
+    using namespace yannpp;
+
+    auto m = create_matrix(30, 784, 5);
+    auto v = create_matrix(784, 1, 6);
+    v.flatten();
+
+    auto expected = dot21(m, v);
+    array3d_t<float> actual(shape3d_t(30, 1, 1), 0.f);
+    gemm(m, create_matrix(784, 1, 6), actual);
+
+    for (int i = 0; i < 30; i++) {
+        ASSERT_NEAR(expected(i), actual(i), 1e-3f);
+    }
+}
+
+class SimdTests: public ::testing::TestWithParam<yannpp::simd::isa_type>
+{
+protected:
+    virtual void SetUp() override {
+        if (GetParam() > yannpp::simd::detected_isa()) {
+            GTEST_SKIP() << yannpp::simd::isa_name(GetParam()) << " is not supported by this CPU";
+        }
+        yannpp::simd::set_isa(GetParam());
+    }
+
+    virtual void TearDown() override {
+        yannpp::simd::set_isa(yannpp::simd::detected_isa());
+    }
+};
+
+std::vector<float> create_vector(size_t size, int seed) {
+    std::vector<float> v(size);
+    for (size_t i = 0; i < size; i++) {
+        v[i] = (float)((i * 7 + seed) % 23) / 11.f - 1.f;
+    }
+    return v;
+}
+
+TEST_P (SimdTests, InnerProductTest) {
+    for (size_t size: {0, 1, 3, 7, 8, 15, 16, 17, 31, 33, 100, 785}) {
+        auto a = create_vector(size, 1), b = create_vector(size, 2);
+        double expected = 0;
+        for (size_t i = 0; i < size; i++) { expected += a[i] * b[i]; }
+        ASSERT_NEAR(expected, yannpp::simd::inner_product(a.data(), b.data(), size), 1e-4) << "size " << size;
+    }
+}
+
+TEST_P (SimdTests, Dot21AndTransposeTest) {
+    const size_t height = 13, width = 37;
+    auto m = create_vector(height * width, 3);
+    auto v = create_vector(width, 4), u = create_vector(height, 5);
+    std::vector<float> y(height), yt(width);
+
+    yannpp::simd::dot21(m.data(), v.data(), y.data(), height, width);
+    yannpp::simd::transpose_dot21(m.data(), u.data(), yt.data(), height, width);
+
+    for (size_t i = 0; i < height; i++) {
+        double expected = 0;
+        for (size_t j = 0; j < width; j++) { expected += m[i*width + j] * v[j]; }
+        ASSERT_NEAR(expected, y[i], 1e-4);
+    }
+
+    for (size_t j = 0; j < width; j++) {
+        double expected = 0;
+        for (size_t i = 0; i < height; i++) { expected += m[i*width + j] * u[i]; }
+        ASSERT_NEAR(expected, yt[j], 1e-4);
+    }
+}
+
+TEST_P (SimdTests, SgdUpdateTest) {
+    for (size_t size: {0, 1, 3, 7, 8, 15, 16, 17, 31, 33, 100, 785}) {
+        auto w = create_vector(size, 8), g = create_vector(size, 9);
+        auto expected = w;
+        for (size_t i = 0; i < size; i++) { expected[i] = w[i] * 0.99f - g[i] * 0.1f; }
+
+        yannpp::simd::sgd_update(w.data(), g.data(), 0.99f, 0.1f, size);
+        for (size_t i = 0; i < size; i++) {
+            ASSERT_NEAR(expected[i], w[i], 1e-6) << "size " << size;
+            ASSERT_EQ(0.f, g[i]);
+        }
+    }
+}
+
+TEST_P (SimdTests, MomentumUpdateTest) {
+    for (bool nesterov: {false, true}) {
+        for (size_t size: {0, 1, 3, 7, 8, 15, 16, 17, 31, 33, 100, 785}) {
+            auto w = create_vector(size, 10), g = create_vector(size, 11), v = create_vector(size, 12);
+            auto expected_w = w, expected_v = v;
+            for (size_t i = 0; i < size; i++) {
+                expected_v[i] = 0.9f * v[i] - g[i] * 0.1f;
+                expected_w[i] = w[i] * 0.99f + (nesterov ? 0.9f * expected_v[i] - g[i] * 0.1f : expected_v[i]);
+            }
+
+            yannpp::simd::momentum_update(w.data(), g.data(), v.data(), 0.99f, 0.1f, 0.9f, nesterov, size);
+            for (size_t i = 0; i < size; i++) {
+                ASSERT_NEAR(expected_v[i], v[i], 1e-6) << "size " << size;
+                ASSERT_NEAR(expected_w[i], w[i], 1e-6) << "size " << size;
+                ASSERT_EQ(0.f, g[i]);
+            }
+        }
+    }
+}
+
+TEST_P (SimdTests, AdamUpdateTest) {
+    yannpp::simd::adam_coefficients_t c;
+    c.beta1 = 0.9f; c.beta2 = 0.999f; c.step_size = 0.01f; c.epsilon = 1e-6f;
+    c.gradient_scale = 0.5f; c.l2 = 0.01f; c.decay = 0.999f;
+
+    for (size_t size: {0, 1, 3, 7, 8, 15, 16, 17, 31, 33, 100, 785}) {
+        auto w = create_vector(size, 13), g = create_vector(size, 14);
+        auto m = create_vector(size, 15), v = create_vector(size, 16);
+        for (auto &vi: v) { vi = std::abs(vi); }
+
+        std::vector<double> expected_w(size), expected_m(size), expected_v(size);
+        for (size_t i = 0; i < size; i++) {
+            const double gi = g[i] * 0.5 + 0.01 * w[i];
+            expected_m[i] = 0.9 * m[i] + 0.1 * gi;
+            expected_v[i] = 0.999 * v[i] + 0.001 * gi * gi;
+            expected_w[i] = w[i] * 0.999 - 0.01 * expected_m[i] / (std::sqrt(expected_v[i]) + 1e-6);
+        }
+
+        yannpp::simd::adam_update(w.data(), g.data(), m.data(), v.data(), c, size);
+        for (size_t i = 0; i < size; i++) {
+            ASSERT_NEAR(expected_m[i], m[i], 1e-6) << "size " << size;
+            ASSERT_NEAR(expected_v[i], v[i], 1e-6) << "size " << size;
+            ASSERT_NEAR(expected_w[i], w[i], 1e-5) << "size " << size;
+            ASSERT_EQ(0.f, g[i]);
+        }
+    }
+}
+
+TEST_P (SimdTests, OuterProductTest) {
+    const size_t height = 11, width = 19;
+    auto a = create_vector(height, 6), b = create_vector(width, 7);
+    std::vector<float> c(height * width);
+
+    yannpp::simd::outer_product(a.data(), b.data(), c.data(), height, width);
+
+    for (size_t i = 0; i < height; i++) {
+        for (size_t j = 0; j < width; j++) {
+            ASSERT_EQ(a[i] * b[j], c[i*width + j]);
+        }
+    }
+}
+
+TEST_P (SimdTests, GemmMicroKernelTest) {
+    using yannpp::simd::gemm_mr; using yannpp::simd::gemm_nr;
+    const size_t kc = 37, ldc = gemm_nr + 3;
+    auto a = create_vector(gemm_mr * kc, 17), b = create_vector(kc * gemm_nr, 18);
+
+    for (size_t mr: {gemm_mr, (size_t)1, gemm_mr - 1}) {
+        for (size_t nr: {gemm_nr, (size_t)1, (size_t)9}) {
+            for (float beta: {0.f, 0.5f}) {
+                auto c = create_vector(gemm_mr * ldc, 19);
+                auto expected = c;
+                // write-only C can contain garbage
+                if (beta == 0.f) { std::fill(c.begin(), c.end(), std::nanf("")); }
+
+                yannpp::simd::gemm_micro_kernel(kc, a.data(), b.data(), c.data(), ldc, mr, nr, 2.f, beta);
+                for (size_t i = 0; i < gemm_mr; i++) {
+                    for (size_t j = 0; j < ldc; j++) {
+                        const size_t at = i*ldc + j;
+                        if (i >= mr || j >= nr) {
+                            // outside of the block C is not touched
+                            if (beta != 0.f) { ASSERT_EQ(expected[at], c[at]); }
+                            continue;
+                        }
+                        double sum = 0;
+                        for (size_t p = 0; p < kc; p++) { sum += a[p*gemm_mr + i] * b[p*gemm_nr + j]; }
+                        ASSERT_NEAR(2. * sum + beta * expected[at], c[at], 1e-4)
+                                << mr << "x" << nr << " at " << i << ", " << j;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_P (SimdTests, GemmMatchesNaiveProductTest) {
+    const int sizes[][3] = {{4, 8, 3}, {6, 16, 5}, {33, 17, 300}, {130, 21, 25}, {121, 35, 260}};
+    for (auto &s: sizes) {
+        for (int ta = 0; ta < 2; ta++) {
+            for (int tb = 0; tb < 2; tb++) {
+                check_gemm(s[0], s[1], s[2], 1.f, 0.f, ta != 0, tb != 0);
+                check_gemm(s[0], s[1], s[2], 0.5f, 1.f, ta != 0, tb != 0);
+            }
+        }
+    }
+}
+
+TEST_P (SimdTests, StableSoftmaxTest) {
+    for (size_t size: {1, 5, 10, 16, 29}) {
+        auto x = create_vector(size, 8);
+        std::vector<float> y(size);
+        yannpp::simd::stable_softmax(x.data(), y.data(), size);
+
+        double x_max = *std::max_element(x.begin(), x.end()), sum = 0;
+        for (size_t i = 0; i < size; i++) { sum += exp(x[i] - x_max); }
+        for (size_t i = 0; i < size; i++) {
+            ASSERT_NEAR(exp(x[i] - x_max) / sum, y[i], 1e-6) << "size " << size;
+        }
+    }
+}
+
+// distance between two floats of the same sign in units in the last place
+int64_t ulp_distance(float a, float b) {
+    int32_t ia, ib;
+    std::memcpy(&ia, &a, sizeof(a));
+    std::memcpy(&ib, &b, sizeof(b));
+    const int64_t oa = ia < 0 ? -(int64_t)(ia & 0x7fffffff) : ia;
+    const int64_t ob = ib < 0 ? -(int64_t)(ib & 0x7fffffff) : ib;
+    return oa > ob ? oa - ob : ob - oa;
+}
+
+template<typename F, typename R>
+int64_t max_ulp_error(F const &fast, R const &reference, float lo, float hi) {
+    // odd size to exercise tails of the vector kernels
+    const size_t size = 100003;
+    std::vector<float> x(size), y(size);
+    for (size_t i = 0; i < size; i++) { x[i] = lo + (hi - lo) * (float)i / (float)(size - 1); }
+    fast(x.data(), y.data(), size);
+
+    int64_t result = 0;
+    for (size_t i = 0; i < size; i++) {
+        result = std::max(result, ulp_distance(y[i], (float)reference((double)x[i])));
+    }
+    return result;
+}
+
+TEST_P (SimdTests, FastFunctionsErrorBoundsTest) {
+    using namespace yannpp::simd;
+
+    ASSERT_LE(max_ulp_error(fast_exp, [](double x) { return std::exp(x); }, -87.3f, 88.f), 1);
+    ASSERT_LE(max_ulp_error(fast_sigmoid, [](double x) { return 1.0 / (1.0 + std::exp(-x)); }, -87.f, 87.f), 2);
+    ASSERT_LE(max_ulp_error(fast_tanh, [](double x) { return std::tanh(x); }, -10.f, 10.f), 1);
+    ASSERT_LE(max_ulp_error(fast_tanh, [](double x) { return std::tanh(x); }, -1e-3f, 1e-3f), 1);
+
+    // saturation outside of the range
+    float big[4] = {-200.f, 200.f, -1e30f, 1e30f}, result[4];
+    fast_sigmoid(big, result, 4);
+    ASSERT_NEAR(0.f, result[0], 1e-30f);
+    ASSERT_FLOAT_EQ(1.f, result[1]);
+    fast_tanh(big, result, 4);
+    ASSERT_FLOAT_EQ(-1.f, result[2]);
+    ASSERT_FLOAT_EQ(1.f, result[3]);
+}
+
+TEST_P (SimdTests, FastSoftmaxTest) {
+    for (size_t size: {1, 5, 10, 16, 29, 300}) {
+        auto x = create_vector(size, 8);
+        for (auto &v: x) { v *= 20.f; }
+        std::vector<float> y(size), expected(size);
+        yannpp::simd::fast_softmax(x.data(), y.data(), size);
+        // x - max(x) is rounded the same way in both versions
+        yannpp::simd::stable_softmax(x.data(), expected.data(), size);
+
+        for (size_t i = 0; i < size; i++) {
+            ASSERT_NEAR(expected[i], y[i], 1e-6f * expected[i]) << "size " << size;
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(AllIsa, SimdTests,
+                         ::testing::Values(yannpp::simd::isa_type::scalar,
+                                           yannpp::simd::isa_type::sse42,
+                                           yannpp::simd::isa_type::avx2,
+                                           yannpp::simd::isa_type::avx512));
+
+TEST (ActivatorTests, BuiltinActivationsMatchReferenceTest) {
+    using namespace yannpp;
+
+    const size_t batch = 3;
+    const shape3d_t shape = shape_row(7);
+    array4d_t<float> z(batch, shape, 0.f);
+    for (size_t i = 0; i < z.data().size(); i++) { z.data()[i] = (float)((i * 5) % 13) / 3.f - 2.f; }
+
+    activator_t<float> sigmoid_activator(activation_kind::sigmoid), relu_activator(activation_kind::relu);
+    activator_t<float> tanh_activator(activation_kind::tanh), softmax_activator(activation_kind::softmax);
+    activator_t<float> identity_activator(activation_kind::identity);
+
+    auto sigmoid_a = sigmoid_activator.activate(z), sigmoid_d = sigmoid_activator.derivative(z);
+    auto relu_a = relu_activator.activate(z), relu_d = relu_activator.derivative(z);
+    auto tanh_a = tanh_activator.activate(z), tanh_d = tanh_activator.derivative(z);
+    auto softmax_a = softmax_activator.activate(z), softmax_d = softmax_activator.derivative(z);
+    auto identity_a = identity_activator.activate(z), identity_d = identity_activator.derivative(z);
+
+    for (size_t b = 0; b < batch; b++) {
+        auto sample = z.sample(b);
+        auto softmax = stable_softmax_v(sample);
+        for (int i = 0; i < shape.capacity(); i++) {
+            const float x = sample(i);
+            ASSERT_FLOAT_EQ(sigmoid(x), sigmoid_a.view(b)(i));
+            ASSERT_FLOAT_EQ(sigmoid_derivative(x), sigmoid_d.view(b)(i));
+            ASSERT_FLOAT_EQ(relu(x), relu_a.view(b)(i));
+            ASSERT_FLOAT_EQ(x > 0.f ? 1.f : 0.f, relu_d.view(b)(i));
+            ASSERT_FLOAT_EQ(std::tanh(x), tanh_a.view(b)(i));
+            ASSERT_FLOAT_EQ(1.f - std::tanh(x) * std::tanh(x), tanh_d.view(b)(i));
+            // softmax is normalized in each sample separately
+            ASSERT_FLOAT_EQ(softmax(i), softmax_a.view(b)(i));
+            ASSERT_FLOAT_EQ(1.f, softmax_d.view(b)(i));
+            ASSERT_FLOAT_EQ(x, identity_a.view(b)(i));
+            ASSERT_FLOAT_EQ(1.f, identity_d.view(b)(i));
+        }
+    }
+}
+
+TEST (ActivatorTests, CustomActivationTest) {
+    using namespace yannpp;
+
+    activator_t<float> custom(relu_v<float>, sigmoid_v<float>);
+    ASSERT_TRUE(custom.kind() == activation_kind::custom);
+
+    array4d_t<float> z(2, shape_row(5), 0.f);
+    for (size_t i = 0; i < z.data().size(); i++) { z.data()[i] = (float)i - 4.5f; }
+
+    auto a = custom.activate(z);
+    custom.derivative_inplace(z);
+    for (size_t i = 0; i < z.data().size(); i++) {
+        const float x = (float)i - 4.5f;
+        ASSERT_FLOAT_EQ(relu(x), a.data()[i]);
+        ASSERT_FLOAT_EQ(sigmoid(x), z.data()[i]);
+    }
+}
+
+TEST (ActivatorTests, DerivativeMulMatchesDerivativeTest) {
+    using namespace yannpp;
+
+    array4d_t<float> z(2, shape_row(9), 0.f), error(2, shape_row(9), 0.f);
+    for (size_t i = 0; i < z.data().size(); i++) {
+        z.data()[i] = (float)((i * 7) % 11) / 2.f - 2.5f;
+        error.data()[i] = (float)((i * 3) % 5) - 2.f;
+    }
+
+    std::vector<activator_t<float>> activators = {
+        activator_t<float>(activation_kind::identity),
+        activator_t<float>(activation_kind::sigmoid),
+        activator_t<float>(activation_kind::relu),
+        activator_t<float>(activation_kind::tanh),
+        activator_t<float>(activation_kind::softmax),
+        activator_t<float>(relu_v<float>, sigmoid_v<float>)
+    };
+
+    for (auto &activator: activators) {
+        auto expected = activator.derivative(z); expected.element_mul(error);
+        array4d_t<float> delta(error);
+        activator.derivative_mul(z, delta);
+        for (size_t i = 0; i < delta.data().size(); i++) {
+            ASSERT_FLOAT_EQ(expected.data()[i], delta.data()[i]) << "kind " << (int)activator.kind();
+        }
+    }
+}
+
+TEST (ActivatorTests, FastPrecisionTest) {
+    using namespace yannpp;
+
+    array4d_t<float> z(4, shape_row(11), 0.f), error(4, shape_row(11), 0.f);
+    for (size_t i = 0; i < z.data().size(); i++) {
+        z.data()[i] = (float)((i * 7) % 19) - 9.f;
+        error.data()[i] = (float)((i * 3) % 5) - 2.f;
+    }
+
+    for (auto kind: {activation_kind::sigmoid, activation_kind::tanh, activation_kind::softmax}) {
+        activator_t<float> precise(kind), fast(kind, activation_precision::fast);
+        ASSERT_TRUE(fast.precision() == activation_precision::fast);
+
+        auto expected = precise.activate(z), actual = fast.activate(z);
+        auto expected_delta = array4d_t<float>(error), actual_delta = array4d_t<float>(error);
+        precise.derivative_mul(z, expected_delta);
+        fast.derivative_mul(z, actual_delta);
+        for (size_t i = 0; i < z.data().size(); i++) {
+            ASSERT_NEAR(expected.data()[i], actual.data()[i], 1e-6f * std::fabs(expected.data()[i])) << "kind " << (int)kind;
+            // f'(z) of saturated sigmoid and tanh loses relative precision in 1 - f(z)
+            ASSERT_NEAR(expected_delta.data()[i], actual_delta.data()[i], 1e-6f) << "kind " << (int)kind;
+        }
+    }
+}
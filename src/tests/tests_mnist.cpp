@@ -21,12 +21,9 @@
 #define STRINGIZE_(x) #x
 #define STRINGIZE(x) STRINGIZE_(x)
 
-static yannpp::activator_t<float> sigmoid_activator(yannpp::sigmoid_v<float>, yannpp::sigmoid_derivative_v<float>);
-// derivative returns 1 because it is cancelled out when using cross-entropy
-static yannpp::activator_t<float> softmax_activator(yannpp::stable_softmax_v<float>,
-                                     [](yannpp::array3d_t<float> const &x){
-    return yannpp::array3d_t<float>(yannpp::shape_row(x.size()), 1.0);});
-static yannpp::activator_t<float> relu_activator(yannpp::relu_v<float>, yannpp::relu_v<float>);
+static yannpp::activator_t<float> sigmoid_activator(yannpp::activation_kind::sigmoid);
+static yannpp::activator_t<float> softmax_activator(yannpp::activation_kind::softmax);
+static yannpp::activator_t<float> relu_activator(yannpp::activation_kind::relu);
 
 using training_data_t = std::vector<std::tuple<yannpp::array3d_t<float>, yannpp::array3d_t<float>>>;
 
@@ -0,0 +1,348 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <yannpp/common/allocator.h>
+#include <yannpp/common/arena.h>
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/array3d_math.h>
+#include <yannpp/common/thread_pool.h>
+#include <yannpp/layers/convolutionlayer.h>
+#include <yannpp/layers/convolutionpoolinglayer.h>
+#include <yannpp/layers/crossentropyoutputlayer.h>
+#include <yannpp/layers/fftconvolutionlayer.h>
+#include <yannpp/layers/fullyconnectedlayer.h>
+#include <yannpp/layers/poolinglayer.h>
+#include <yannpp/layers/winogradconvolutionlayer.h>
+#include <yannpp/network/activator.h>
+#include <yannpp/network/memory_plan.h>
+#include <yannpp/network/network2.h>
+#include <yannpp/optimizer/sdg_optimizer.h>
+
+#include "tests_allocations.h"
+
+static yannpp::activator_t<float> sigmoid_activator(yannpp::activation_kind::sigmoid);
+static yannpp::activator_t<float> softmax_activator(yannpp::activation_kind::softmax);
+static yannpp::activator_t<float> relu_activator(yannpp::activation_kind::relu);
+
+using training_data_t = std::vector<std::tuple<yannpp::array3d_t<float>, yannpp::array3d_t<float>>>;
+
+training_data_t create_training_data(size_t size) {
+    training_data_t data;
+    for (size_t i = 0; i < size; i++) {
+        yannpp::array3d_t<float> input(yannpp::shape_row(8), 0.f);
+        for (int j = 0; j < 8; j++) { input(j) = (float)((i * 5 + j * 3) % 11) / 10.f; }
+        yannpp::array3d_t<float> result(yannpp::shape_row(3), 0.f);
+        result(i % 3) = 1.f;
+        data.emplace_back(std::move(input), std::move(result));
+    }
+    return data;
+}
+
+// trains clones of the layers single-threaded and with 4 workers
+// and checks that both networks end up with the same outputs
+void check_parallel_training(std::vector<yannpp::network2_t<float>::layer_type> &&layers,
+                             training_data_t const &data) {
+    using namespace yannpp;
+
+    for (auto &l: layers) { l->init(); }
+    // clones have the same initial weights
+    std::vector<network2_t<float>::layer_type> parallel_layers;
+    for (auto &l: layers) { parallel_layers.emplace_back(l->clone()); }
+
+    const size_t minibatch_size = 10;
+    sdg_optimizer_t<float> optimizer(minibatch_size, data.size(), 1.f, 0.1f);
+
+    network2_t<float> network(std::move(layers));
+    network2_t<float> parallel_network(std::move(parallel_layers));
+
+    // same shuffling of minibatches
+    srand(1);
+    network.train(data, optimizer, 2, minibatch_size);
+    srand(1);
+    parallel_network.train(data, optimizer, 2, minibatch_size, 4);
+
+    for (size_t i = 0; i < data.size(); i += 7) {
+        auto expected = network.feedforward(std::get<0>(data[i]));
+        auto actual = parallel_network.feedforward(std::get<0>(data[i]));
+        for (size_t j = 0; j < expected.size(); j++) {
+            ASSERT_NEAR(expected(j), actual(j), 1e-5f) << "at input " << i;
+        }
+    }
+}
+
+training_data_t create_image_training_data(size_t size, yannpp::shape3d_t const &shape) {
+    training_data_t data;
+    for (size_t i = 0; i < size; i++) {
+        yannpp::array3d_t<float> input(shape, 0.f);
+        for (size_t j = 0; j < input.size(); j++) { input.data()[j] = (float)((i * 5 + j * 3) % 11) / 10.f; }
+        yannpp::array3d_t<float> result(yannpp::shape_row(3), 0.f);
+        result(i % 3) = 1.f;
+        data.emplace_back(std::move(input), std::move(result));
+    }
+    return data;
+}
+
+TEST (NetworkTests, ParallelTrainingMatchesSingleThreadedTest) {
+    using namespace yannpp;
+
+    check_parallel_training({
+        std::make_shared<fully_connected_layer_t<float>>(8, 5, sigmoid_activator),
+        std::make_shared<fully_connected_layer_t<float>>(5, 3, softmax_activator),
+        std::make_shared<crossentropy_output_layer_t<float>>()},
+        create_training_data(300));
+}
+
+TEST (NetworkTests, ParallelTrainingWithFftConvolutionTest) {
+    using namespace yannpp;
+
+    // replicas get updated weights by copying so their filter spectra must follow
+    shape3d_t input_shape(5, 5, 1);
+    check_parallel_training({
+        std::make_shared<convolution_layer_fft_t<float>>(input_shape, shape3d_t(3, 3, 1), 2, 1, padding_type::valid, relu_activator),
+        std::make_shared<fully_connected_layer_t<float>>(3 * 3 * 2, 3, softmax_activator),
+        std::make_shared<crossentropy_output_layer_t<float>>()},
+        create_image_training_data(120, input_shape));
+}
+
+TEST (NetworkTests, FeedforwardInInferenceModeTest) {
+    using namespace yannpp;
+
+    std::vector<network2_t<float>::layer_type> layers = {
+        std::make_shared<fully_connected_layer_t<float>>(8, 5, sigmoid_activator),
+        std::make_shared<fully_connected_layer_t<float>>(5, 3, softmax_activator),
+        std::make_shared<crossentropy_output_layer_t<float>>()};
+    for (auto &l: layers) { l->init(); }
+    std::vector<network2_t<float>::layer_type> reference;
+    for (auto &l: layers) { reference.emplace_back(l->clone()); }
+
+    network2_t<float> network(std::move(layers));
+    auto data = create_training_data(10);
+    for (auto &d: data) {
+        array3d_t<float> expected(std::get<0>(d));
+        for (auto &l: reference) { expected = l->feedforward(std::move(expected)); }
+
+        auto actual = network.feedforward(std::get<0>(d));
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t j = 0; j < expected.size(); j++) {
+            ASSERT_FLOAT_EQ(expected(j), actual(j));
+        }
+    }
+
+    // inference mode is turned off after feedforward so training still works
+    auto training_data = create_training_data(120);
+    sdg_optimizer_t<float> optimizer(5, training_data.size(), 1.f, 0.1f);
+    network.train(training_data, optimizer, 1, 5);
+}
+
+TEST (NetworkTests, MemoryPlanSharesBuffersTest) {
+    using namespace yannpp;
+
+    memory_plan_t plan;
+    size_t a = plan.add(10, 0, 1);
+    size_t b = plan.add(20, 1, 2);
+    size_t c = plan.add(5, 2, 3);
+    size_t d = plan.add(30, 3, 4);
+    // alive together with a and b
+    size_t e = plan.add(7, 0, 2);
+    plan.build();
+
+    ASSERT_EQ(3, plan.buffers_count());
+    ASSERT_NE(plan.buffer(a), plan.buffer(b));
+    ASSERT_NE(plan.buffer(b), plan.buffer(c));
+    ASSERT_NE(plan.buffer(c), plan.buffer(d));
+    ASSERT_NE(plan.buffer(e), plan.buffer(a));
+    ASSERT_NE(plan.buffer(e), plan.buffer(b));
+    ASSERT_NE(plan.buffer(e), plan.buffer(c));
+    ASSERT_EQ(plan.buffer(a), plan.buffer(c));
+    ASSERT_EQ(30, plan.buffer_size(plan.buffer(d)));
+}
+
+TEST (NetworkTests, PlannedBuffersTest) {
+    using namespace yannpp;
+
+    network2_t<float> network({
+        std::make_shared<fully_connected_layer_t<float>>(8, 5, sigmoid_activator),
+        std::make_shared<fully_connected_layer_t<float>>(5, 3, sigmoid_activator),
+        std::make_shared<fully_connected_layer_t<float>>(3, 3, softmax_activator),
+        std::make_shared<crossentropy_output_layer_t<float>>()});
+    network.init_layers(shape_row(8), 10);
+    // activations live until backpropagation of their layer reads them
+    // so 5 activations are alive together and gradients reuse their buffers plus one
+    ASSERT_EQ(6, network.planned_buffers());
+}
+
+TEST (NetworkTests, FlatParametersCheckpointTest) {
+    using namespace yannpp;
+
+    auto first = std::make_shared<fully_connected_layer_t<float>>(8, 5, sigmoid_activator);
+    auto second = std::make_shared<fully_connected_layer_t<float>>(5, 3, softmax_activator);
+    network2_t<float> network({first, second, std::make_shared<crossentropy_output_layer_t<float>>()});
+    network.init_layers();
+
+    // layers use arrays placed one after another in the flat buffer
+    float *parameters = network.parameters_data();
+    auto first_parameters = first->parameters(), second_parameters = second->parameters();
+    ASSERT_EQ(parameters, first_parameters[0].value->data().data());
+    ASSERT_TRUE(first_parameters[1].value->data().data() > first_parameters[0].value->data().data());
+    ASSERT_TRUE(second_parameters[0].value->data().data() > first_parameters[1].value->data().data());
+    ASSERT_TRUE(second_parameters[1].value->data().data() < parameters + network.parameters_size());
+    ASSERT_EQ(0, (uintptr_t)second_parameters[0].value->data().data() % 64);
+    ASSERT_EQ(network.gradients_data(), first_parameters[0].nabla->data().data());
+
+    auto data = create_training_data(120);
+    auto input = std::get<0>(data[0]);
+    auto expected = network.feedforward(input);
+    std::vector<float> checkpoint(parameters, parameters + network.parameters_size());
+
+    sdg_optimizer_t<float> optimizer(10, data.size(), 1.f, 0.5f);
+    network.train(data, optimizer, 1, 10, 2);
+    auto trained = network.feedforward(input);
+    float difference = 0.f;
+    for (size_t j = 0; j < expected.size(); j++) { difference += std::abs(expected(j) - trained(j)); }
+    ASSERT_GT(difference, 0.f);
+
+    // restoring the buffer restores the whole model
+    std::copy(checkpoint.begin(), checkpoint.end(), network.parameters_data());
+    auto restored = network.feedforward(input);
+    for (size_t j = 0; j < expected.size(); j++) {
+        ASSERT_FLOAT_EQ(expected(j), restored(j));
+    }
+}
+
+TEST (NetworkTests, FlatParametersRestoreFftConvolutionTest) {
+    using namespace yannpp;
+
+    shape3d_t input_shape(5, 5, 1);
+    auto make_network = [&]() {
+        return std::make_shared<network2_t<float>>(std::vector<network2_t<float>::layer_type>{
+            std::make_shared<convolution_layer_fft_t<float>>(input_shape, shape3d_t(3, 3, 1), 2, 1, padding_type::valid, relu_activator),
+            std::make_shared<fully_connected_layer_t<float>>(3 * 3 * 2, 3, softmax_activator),
+            std::make_shared<crossentropy_output_layer_t<float>>()});
+    };
+    auto network = make_network(), other = make_network();
+    network->init_layers();
+    other->init_layers();
+
+    // initial weights are the same so the other network is trained a bit
+    auto data = create_image_training_data(30, input_shape);
+    sdg_optimizer_t<float> optimizer(5, data.size(), 1.f, 0.5f);
+    other->train(data, optimizer, 1, 5);
+
+    auto input = std::get<0>(data[0]);
+    // filter spectra are computed with the current weights
+    float *parameters = network->parameters_data();
+    network->feedforward(input);
+
+    // weights of the other network are restored through the kept pointer
+    float *other_parameters = other->parameters_data();
+    std::copy(other_parameters, other_parameters + other->parameters_size(), parameters);
+    network->parameters_changed();
+
+    auto expected = other->feedforward(input);
+    auto restored = network->feedforward(input);
+    for (size_t j = 0; j < expected.size(); j++) {
+        ASSERT_FLOAT_EQ(expected(j), restored(j));
+    }
+}
+
+TEST (NetworkTests, FlatParametersRebindAfterLoadTest) {
+    using namespace yannpp;
+
+    auto first = std::make_shared<fully_connected_layer_t<float>>(4, 3, sigmoid_activator);
+    network2_t<float> network({first, std::make_shared<crossentropy_output_layer_t<float>>()});
+    network.init_layers();
+    network.parameters_data();
+
+    // layer replaces its arrays and the flat buffer follows them
+    std::vector<array3d_t<float>> weights, biases;
+    weights.emplace_back(shape3d_t(3, 4, 1), 2.f);
+    biases.emplace_back(shape_row(3), 3.f);
+    first->load(std::move(weights), std::move(biases));
+
+    float *parameters = network.parameters_data();
+    auto first_parameters = first->parameters();
+    ASSERT_EQ(parameters, first_parameters[0].value->data().data());
+    ASSERT_FLOAT_EQ(2.f, parameters[0]);
+    ASSERT_FLOAT_EQ(3.f, first_parameters[1].value->data()[0]);
+    ASSERT_EQ(network.gradients_data(), first_parameters[0].nabla->data().data());
+}
+
+TEST (NetworkTests, TrainWorkersAreLimitedByPoolTest) {
+    using namespace yannpp;
+    set_threads_number(2);
+
+    shape3d_t input_shape(4, 4, 1);
+    network2_t<float> network({
+        std::make_shared<fully_connected_layer_t<float>>(16, 3, softmax_activator),
+        std::make_shared<crossentropy_output_layer_t<float>>()});
+    network.init_layers();
+
+    auto data = create_image_training_data(6, input_shape);
+    sdg_optimizer_t<float> optimizer(4, data.size(), 0.1f, 0.1f);
+    // replicas above the threads of the pool would only take memory
+    network.train(data, optimizer, 0, 4, 8);
+    const size_t workers = network.workers_number();
+    set_threads_number(std::thread::hardware_concurrency());
+
+    ASSERT_EQ(2, workers);
+}
+
+TEST (NetworkTests, SteadyStateMiniBatchDoesNotAllocateTest) {
+    using namespace yannpp;
+    // replicas need threads of the pool but first steps grow arenas of both
+    set_threads_number(2);
+
+    shape3d_t input_shape(8, 8, 2);
+    std::vector<network2_t<float>::layer_type> layers = {
+        std::make_shared<convolution_layer_loop_t<float>>(input_shape, shape3d_t(3, 3, 2), 3, 1, padding_type::same, relu_activator),
+        std::make_shared<convolution_layer_winograd_t<float>>(shape3d_t(8, 8, 3), shape3d_t(3, 3, 3), 3, 1, padding_type::same, relu_activator),
+        std::make_shared<convolution_layer_fft_t<float>>(shape3d_t(8, 8, 3), shape3d_t(3, 3, 3), 3, 1, padding_type::same, relu_activator),
+        std::make_shared<convolution_pooling_layer_t<float>>(shape3d_t(8, 8, 3), shape3d_t(3, 3, 3), 4, 1, padding_type::same, relu_activator, 2, 2),
+        std::make_shared<convolution_layer_2d_t<float>>(shape3d_t(4, 4, 4), shape3d_t(3, 3, 4), 4, 1, padding_type::same, relu_activator),
+        std::make_shared<pooling_layer_t<float>>(2, 2),
+        std::make_shared<fully_connected_layer_t<float>>(16, 3, softmax_activator),
+        std::make_shared<crossentropy_output_layer_t<float>>()};
+    network2_t<float> network(std::move(layers));
+    network.init_layers();
+
+    auto data = create_image_training_data(6, input_shape);
+
+    const size_t minibatch_size = 4;
+    sdg_optimizer_t<float> optimizer(minibatch_size, data.size(), 0.1f, 0.1f);
+    // creates replicas and plans memory without training
+    network.train(data, optimizer, 0, minibatch_size, 2);
+    ASSERT_EQ(2, network.workers_number());
+    std::vector<size_t> indices = {0, 1, 2, 3};
+
+    // first steps grow arenas, caches and buffers which are reused later
+    network.train_mini_batch(data, indices, optimizer);
+    network.train_mini_batch(data, indices, optimizer);
+
+    // evaluation between the steps runs in inference mode which keeps the training caches
+    std::vector<size_t> eval_indices = {4, 5};
+    network.evaluate(data, eval_indices);
+    network.train_mini_batch(data, indices, optimizer);
+
+    const size_t allocations = global_allocations_count();
+    const size_t heap_allocations = heap_allocations_count();
+    for (int step = 0; step < 3; step++) {
+        network.train_mini_batch(data, indices, optimizer);
+        network.evaluate(data, eval_indices);
+    }
+    const size_t steady_allocations = global_allocations_count();
+    const size_t steady_heap_allocations = heap_allocations_count();
+    set_threads_number(std::thread::hardware_concurrency());
+
+    ASSERT_EQ(allocations, steady_allocations);
+    ASSERT_EQ(heap_allocations, steady_heap_allocations);
+    ASSERT_EQ(0, thread_arena().used());
+}
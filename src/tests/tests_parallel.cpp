@@ -0,0 +1,105 @@
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <yannpp/common/shape.h>
+#include <yannpp/common/thread_pool.h>
+
+#include "tests_allocations.h"
+
+class ParallelTests: public ::testing::TestWithParam<size_t>
+{
+protected:
+    virtual void SetUp() override {
+        yannpp::set_threads_number(GetParam());
+    }
+
+    virtual void TearDown() override {
+        yannpp::set_threads_number(std::thread::hardware_concurrency());
+    }
+};
+
+TEST_P (ParallelTests, EachIndexIsVisitedOnceTest) {
+    for (size_t size: {0, 1, 7, 100, 10000}) {
+        for (size_t grain: {1, 3, 64, 20000}) {
+            std::vector<std::atomic<int>> visits(size + 10);
+            for (auto &v: visits) { v = 0; }
+
+            yannpp::parallel_for(5, size + 5, grain, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) { visits[i]++; }
+            });
+
+            for (size_t i = 0; i < visits.size(); i++) {
+                const int expected = (5 <= i && i < size + 5) ? 1 : 0;
+                ASSERT_EQ(expected, visits[i]) << "at " << i << " size " << size << " grain " << grain;
+            }
+        }
+    }
+}
+
+TEST_P (ParallelTests, NestedParallelForTest) {
+    std::atomic<size_t> sum(0);
+    yannpp::parallel_for(0, 64, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            yannpp::parallel_for(0, 100, 1, [&](size_t b, size_t e) {
+                for (size_t j = b; j < e; j++) { sum += j; }
+            });
+        }
+    });
+
+    ASSERT_EQ(64 * 4950, sum.load());
+}
+
+TEST_P (ParallelTests, IndexSpaceParallelForTest) {
+    yannpp::shape3d_t shape(7, 5, 3);
+    std::vector<std::atomic<int>> visits(shape.capacity());
+    for (auto &v: visits) { v = 0; }
+
+    yannpp::parallel_for(shape, 4, [&](int x, int y, int z) {
+        visits[x * shape.y() * shape.z() + y * shape.z() + z]++;
+    });
+
+    for (auto &v: visits) { ASSERT_EQ(1, v); }
+}
+
+TEST_P (ParallelTests, ExceptionIsRethrownAfterAllTasksTest) {
+    for (int attempt = 0; attempt < 20; attempt++) {
+        bool thrown = false;
+        try {
+            yannpp::parallel_for(0, 64, 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    if (i % 16 == 3) { throw std::runtime_error("task failed"); }
+                }
+            });
+        } catch (std::runtime_error const &) {
+            thrown = true;
+        }
+
+        ASSERT_TRUE(thrown);
+        // pool is still usable after the failed section
+        std::atomic<size_t> sum(0);
+        yannpp::parallel_for(0, 1000, 10, [&](size_t begin, size_t end) { sum += end - begin; });
+        ASSERT_EQ(1000, sum.load());
+    }
+}
+
+TEST_P (ParallelTests, SubmitDoesNotAllocateTest) {
+    std::atomic<size_t> sum(0);
+    auto body = [&](size_t begin, size_t end) { sum += end - begin; };
+    // first sections warm up queues of the pool
+    yannpp::parallel_for(0, 1000, 1, body);
+    yannpp::parallel_for(0, 1000, 1, body);
+
+    const size_t allocations = global_allocations_count();
+    for (int i = 0; i < 10; i++) {
+        yannpp::parallel_for(0, 1000, 1, body);
+    }
+
+    ASSERT_EQ(allocations, global_allocations_count());
+    ASSERT_EQ(12000, sum);
+}
+
+INSTANTIATE_TEST_SUITE_P(ThreadsNumber, ParallelTests, ::testing::Values(1, 2, 4, 16));
@@ -0,0 +1,96 @@
+#include "allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace yannpp {
+    namespace {
+        std::atomic<size_t> heap_allocations(0);
+
+        allocation_policy_t &active_policy() {
+            static allocation_policy_t policy = default_allocation_policy();
+            return policy;
+        }
+    }
+
+    allocation_policy_t default_allocation_policy() {
+        return allocation_policy_t{64, detail::huge_page_size};
+    }
+
+    allocation_policy_t current_allocation_policy() { return active_policy(); }
+
+    void set_allocation_policy(allocation_policy_t const &policy) {
+        // alignment has to be a power of two and a multiple of pointer size
+        size_t alignment = sizeof(void*);
+        while (alignment < policy.alignment) { alignment <<= 1; }
+        active_policy() = allocation_policy_t{alignment, policy.huge_pages_threshold};
+    }
+
+    flat_arena_t::flat_arena_t(size_t bytes):
+        data_(nullptr),
+        size_(bytes),
+        used_(0),
+        alignment_(active_policy().alignment)
+    {
+        data_ = static_cast<char*>(detail::aligned_allocate(size_));
+        if (data_ == nullptr) { throw std::bad_alloc(); }
+        std::memset(data_, 0, size_);
+    }
+
+    flat_arena_t::~flat_arena_t() {
+        detail::aligned_free(data_);
+    }
+
+    size_t flat_arena_t::footprint(size_t bytes) {
+        const size_t alignment = active_policy().alignment;
+        return (bytes + alignment - 1) / alignment * alignment;
+    }
+
+    void *flat_arena_t::allocate(size_t bytes) {
+        const size_t size = (bytes + alignment_ - 1) / alignment_ * alignment_;
+        if (size > size_ - used_) { return nullptr; }
+        void *p = data_ + used_;
+        used_ += size;
+        return p;
+    }
+
+    size_t heap_allocations_count() { return heap_allocations.load(std::memory_order_relaxed); }
+
+    namespace detail {
+        void *aligned_allocate(size_t bytes) {
+            heap_allocations.fetch_add(1, std::memory_order_relaxed);
+            const allocation_policy_t &policy = active_policy();
+            const bool huge = (policy.huge_pages_threshold > 0) && (bytes >= policy.huge_pages_threshold);
+            const size_t alignment = huge ? std::max(policy.alignment, huge_page_size) : policy.alignment;
+            // padding to the whole number of aligned blocks
+            const size_t size = (std::max(bytes, size_t(1)) + alignment - 1) / alignment * alignment;
+
+            void *p = nullptr;
+#if defined(_WIN32)
+            p = _aligned_malloc(size, alignment);
+#else
+            if (posix_memalign(&p, alignment, size) != 0) { p = nullptr; }
+#endif
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+            // only a hint, memory works the same if huge pages are not available
+            if (huge && (p != nullptr)) { madvise(p, size, MADV_HUGEPAGE); }
+#endif
+            return p;
+        }
+
+        void aligned_free(void *p) {
+#if defined(_WIN32)
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+    }
+}
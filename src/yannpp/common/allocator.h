@@ -0,0 +1,121 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace yannpp {
+    // how memory of arrays is allocated
+    struct allocation_policy_t {
+        // alignment of the beginning of each buffer (power of two), size of the buffer
+        // is also padded to it so full-width vector loads of the last elements stay inside
+        size_t alignment;
+        // buffers of at least this size in bytes are aligned to the huge page and
+        // advised to be backed by transparent huge pages (0 turns it off)
+        size_t huge_pages_threshold;
+    };
+
+    // cache line alignment (also the width of AVX-512 vector) and huge pages from 2MB
+    allocation_policy_t default_allocation_policy();
+    allocation_policy_t current_allocation_policy();
+    // not thread-safe, meant to be called before any computations
+    // (memory allocated earlier is still freed correctly)
+    void set_allocation_policy(allocation_policy_t const &policy);
+
+    // number of heap allocations made for arrays and arenas since the start
+    // debug counter to check that the steady state of training does not allocate
+    size_t heap_allocations_count();
+
+    namespace detail {
+        const size_t huge_page_size = 2 * 1024 * 1024;
+
+        // returns nullptr if memory can not be allocated
+        void *aligned_allocate(size_t bytes);
+        void aligned_free(void *p);
+    }
+
+    // one contiguous block shared by many arrays (e.g. all parameters of the network)
+    // arrays are placed one after another, each aligned as by the current policy
+    // memory is zeroed and freed only with the whole block
+    class flat_arena_t {
+    public:
+        explicit flat_arena_t(size_t bytes);
+        ~flat_arena_t();
+
+        flat_arena_t(flat_arena_t const &) = delete;
+        flat_arena_t &operator=(flat_arena_t const &) = delete;
+
+    public:
+        // returns nullptr if the block has no space left
+        void *allocate(size_t bytes);
+        // size of the array in the block including the alignment padding
+        static size_t footprint(size_t bytes);
+
+        char *data() const { return data_; }
+        size_t size() const { return size_; }
+        size_t used() const { return used_; }
+        bool contains(const void *p) const { return (data_ <= (const char*)p) && ((const char*)p < data_ + size_); }
+
+    private:
+        char *data_;
+        size_t size_;
+        size_t used_;
+        size_t alignment_;
+    };
+
+    // standard allocator which uses current allocation policy
+    // or places arrays into the flat arena which is kept alive by them
+    // arrays in the arena can not grow: memory is not given back to the arena
+    // and it is sized exactly for its arrays, so reallocation throws std::bad_alloc
+    template<typename T>
+    class aligned_allocator_t {
+    public:
+        using value_type = T;
+        // arrays stay in the arena when moved, copies are allocated on the heap
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        aligned_allocator_t() {}
+        explicit aligned_allocator_t(std::shared_ptr<flat_arena_t> const &arena): arena_(arena) {}
+        template<typename Q>
+        aligned_allocator_t(aligned_allocator_t<Q> const &other): arena_(other.arena()) {}
+
+        template<typename Q>
+        struct rebind { using other = aligned_allocator_t<Q>; };
+
+    public:
+        T *allocate(size_t n) {
+            if (n > std::numeric_limits<size_t>::max() / sizeof(T)) { throw std::bad_alloc(); }
+            void *p = arena_ ? arena_->allocate(n * sizeof(T)) : detail::aligned_allocate(n * sizeof(T));
+            if (p == nullptr) { throw std::bad_alloc(); }
+            return static_cast<T*>(p);
+        }
+
+        // memory of the arena is freed only with the whole arena
+        void deallocate(T *p, size_t) { if (!arena_) { detail::aligned_free(p); } }
+
+        aligned_allocator_t select_on_container_copy_construction() const { return aligned_allocator_t(); }
+
+        std::shared_ptr<flat_arena_t> const &arena() const { return arena_; }
+
+    private:
+        std::shared_ptr<flat_arena_t> arena_;
+    };
+
+    // allocators are equal when they use the same arena or both use the heap,
+    // then memory of one can be freed by another and vectors are moved without copying
+    template<typename T, typename Q>
+    bool operator==(aligned_allocator_t<T> const &a, aligned_allocator_t<Q> const &b) { return a.arena() == b.arena(); }
+    template<typename T, typename Q>
+    bool operator!=(aligned_allocator_t<T> const &a, aligned_allocator_t<Q> const &b) { return a.arena() != b.arena(); }
+
+    // storage of arrays
+    template<typename T>
+    using aligned_vector_t = std::vector<T, aligned_allocator_t<T>>;
+}
+
+#endif // ALLOCATOR_H
@@ -0,0 +1,90 @@
+#include "arena.h"
+
+#include <yannpp/common/allocator.h>
+
+#include <new>
+
+namespace yannpp {
+    namespace {
+        // size of the first block, next blocks are at least twice bigger than the previous
+        const size_t arena_block_size = 64 * 1024;
+
+        size_t aligned_size(size_t bytes) {
+            const size_t alignment = current_allocation_policy().alignment;
+            return (bytes + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    arena_t::~arena_t() {
+        assert(used() == 0);
+        for (auto &block: blocks_) { detail::aligned_free(block.data); }
+    }
+
+    void *arena_t::allocate(size_t bytes) {
+        bytes = aligned_size(std::max(bytes, size_t(1)));
+
+        while (current_ < blocks_.size()) {
+            block_t &block = blocks_[current_];
+            if (block.used + bytes <= block.size) {
+                void *p = block.data + block.used;
+                block.used += bytes;
+                return p;
+            }
+            // blocks after the current one are empty
+            if (current_ + 1 == blocks_.size()) { break; }
+            current_++;
+        }
+
+        const size_t last_size = blocks_.empty() ? 0 : blocks_.back().size;
+        const size_t size = std::max(bytes, std::max(arena_block_size, 2 * last_size));
+        char *data = static_cast<char*>(detail::aligned_allocate(size));
+        if (data == nullptr) { throw std::bad_alloc(); }
+        blocks_.push_back({data, size, bytes});
+        current_ = blocks_.size() - 1;
+        return data;
+    }
+
+    arena_t::mark_t arena_t::mark() const {
+        if (blocks_.empty()) { return mark_t{0, 0}; }
+        return mark_t{current_, blocks_[current_].used};
+    }
+
+    void arena_t::rewind(mark_t const &mark) {
+        if (blocks_.empty()) { return; }
+        assert(mark.block <= current_);
+
+        for (size_t b = mark.block + 1; b < blocks_.size(); b++) { blocks_[b].used = 0; }
+        blocks_[mark.block].used = mark.offset;
+        current_ = mark.block;
+
+        if ((current_ == 0) && (mark.offset == 0) && (blocks_.size() > 1)) { merge_blocks(); }
+    }
+
+    size_t arena_t::used() const {
+        size_t result = 0;
+        for (auto &block: blocks_) { result += block.used; }
+        return result;
+    }
+
+    size_t arena_t::capacity() const {
+        size_t result = 0;
+        for (auto &block: blocks_) { result += block.size; }
+        return result;
+    }
+
+    void arena_t::merge_blocks() {
+        const size_t size = capacity();
+        for (auto &block: blocks_) { detail::aligned_free(block.data); }
+        blocks_.clear();
+
+        char *data = static_cast<char*>(detail::aligned_allocate(size));
+        if (data == nullptr) { throw std::bad_alloc(); }
+        blocks_.push_back({data, size, 0});
+        current_ = 0;
+    }
+
+    arena_t &thread_arena() {
+        static thread_local arena_t arena;
+        return arena;
+    }
+}
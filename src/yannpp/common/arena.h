@@ -0,0 +1,100 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include <yannpp/common/array3d_view.h>
+#include <yannpp/common/shape.h>
+
+namespace yannpp {
+    // bump-pointer arena for short-lived temporaries of layers
+    // memory is given back in the stack order with arena_scope_t, so nested
+    // parallel sections running in the waiting thread release theirs first
+    // after the whole arena is released its blocks are merged into one,
+    // so in the steady state temporaries do not touch the heap at all
+    class arena_t {
+    public:
+        struct mark_t {
+            size_t block;
+            size_t offset;
+        };
+
+    public:
+        arena_t(): current_(0) {}
+        ~arena_t();
+
+        arena_t(arena_t const &) = delete;
+        arena_t &operator=(arena_t const &) = delete;
+
+    public:
+        // memory is aligned as by aligned_allocator_t
+        void *allocate(size_t bytes);
+
+        // uninitialized memory for n elements
+        template<typename T>
+        T *allocate(size_t n) {
+            static_assert(std::is_trivially_destructible<T>::value, "arena does not call destructors");
+            return static_cast<T*>(allocate(n * sizeof(T)));
+        }
+
+        // dense array which lives until the end of the current scope
+        template<typename T>
+        array3d_view_t<T> allocate_view(shape3d_t const &shape, T a) {
+            T *data = allocate<T>(shape.capacity());
+            std::fill(data, data + shape.capacity(), a);
+            return array3d_view_t<T>(data, shape);
+        }
+
+        mark_t mark() const;
+        void rewind(mark_t const &mark);
+
+        // bytes in use and allocated in all blocks
+        size_t used() const;
+        size_t capacity() const;
+        size_t blocks_count() const { return blocks_.size(); }
+
+    private:
+        void merge_blocks();
+
+    private:
+        struct block_t {
+            char *data;
+            size_t size;
+            size_t used;
+        };
+
+        std::vector<block_t> blocks_;
+        // index of the block which is used now
+        size_t current_;
+    };
+
+    // arena of the calling thread
+    arena_t &thread_arena();
+
+    // releases everything allocated from the arena during its lifetime
+    class arena_scope_t {
+    public:
+        explicit arena_scope_t(arena_t &arena = thread_arena()):
+            arena_(arena),
+            mark_(arena.mark())
+        { }
+
+        ~arena_scope_t() { arena_.rewind(mark_); }
+
+        arena_scope_t(arena_scope_t const &) = delete;
+        arena_scope_t &operator=(arena_scope_t const &) = delete;
+
+    public:
+        arena_t &arena() { return arena_; }
+
+    private:
+        arena_t &arena_;
+        arena_t::mark_t mark_;
+    };
+}
+
+#endif // ARENA_H
@@ -10,13 +10,19 @@
 #include <random>
 #include <vector>
 #include <limits>
+#include <memory>
 
+#include <yannpp/common/allocator.h>
+#include <yannpp/common/array3d_expr.h>
+#include <yannpp/common/array3d_view.h>
 #include <yannpp/common/shape.h>
 
 namespace yannpp {
     template<typename T>
-    class array3d_t {
+    class array3d_t: public array3d_expr_t<array3d_t<T>> {
     public:
+        typedef T value_type;
+
         class slice3d {
         public:
             slice3d(std::reference_wrapper<array3d_t<T>> const &array,
@@ -130,20 +136,29 @@ namespace yannpp {
             v_(std::move(other.v_))
         {}
 
-        array3d_t(shape3d_t const &shape, std::vector<T> const &v):
+        array3d_t(shape3d_t const &shape, aligned_vector_t<T> const &v):
             shape_(shape),
             v_(v)
         {
             assert(v_.size() == shape_.capacity());
         }
 
-        array3d_t(shape3d_t const &shape, std::vector<T> &&v):
+        array3d_t(shape3d_t const &shape, aligned_vector_t<T> &&v):
             shape_(shape),
             v_(std::move(v))
         {
             assert(v_.size() == shape_.capacity());
         }
 
+        // evaluates expression in one pass (see array3d_expr.h)
+        template<typename E>
+        array3d_t(array3d_expr_t<E> const &e):
+            shape_(e.shape()),
+            v_(e.size())
+        {
+            detail::evaluate(e, v_.data());
+        }
+
         template<typename Q>
         array3d_t(const std::vector<Q> &other):
             shape_(shape_row(other.size()))
@@ -205,7 +220,11 @@ namespace yannpp {
         }
 
     public:
-        inline std::vector<T> const &data() const { return v_; }
+        inline aligned_vector_t<T> const &data() const { return v_; }
+        inline aligned_vector_t<T> &data() { return v_; }
+        // unchecked access for the hot loops (checked only in debug builds)
+        inline array3d_view_t<T> view() { return array3d_view_t<T>(v_.data(), shape_); }
+        inline array3d_view_t<const T> view() const { return array3d_view_t<const T>(v_.data(), shape_); }
         inline shape3d_t const &shape() const { return shape_; }
         inline size_t size() const { return v_.size(); }
         inline T &at(int x, int y, int z) { return v_.at(shape_.index(x, y, z)); }
@@ -228,6 +247,35 @@ namespace yannpp {
 
         array3d_t<T> &operator=(array3d_t<T> const &other) = delete;
 
+        // expression can reference this array, e.g. w = w * decay - nabla_w * scale
+        template<typename E>
+        array3d_t<T> &operator=(array3d_expr_t<E> const &e) {
+            if (v_.size() != e.size()) {
+                // this array can not be an operand of expression with different shape
+                aligned_vector_t<T> v(e.size());
+                detail::evaluate(e, v.data());
+                v_ = std::move(v);
+            } else {
+                detail::evaluate(e, v_.data());
+            }
+            shape_ = e.shape();
+            return *this;
+        }
+
+        template<typename E>
+        array3d_t<T> &operator+=(array3d_expr_t<E> const &e) {
+            assert(e.shape() == shape_);
+            detail::evaluate(*this + e, v_.data());
+            return *this;
+        }
+
+        template<typename E>
+        array3d_t<T> &operator-=(array3d_expr_t<E> const &e) {
+            assert(e.shape() == shape_);
+            detail::evaluate(*this - e, v_.data());
+            return *this;
+        }
+
         array3d_t<T> &mul(const T &a) {
             for (auto &v: v_) { v *= a; }
             return *this;
@@ -309,8 +357,16 @@ namespace yannpp {
 
     private:
         shape3d_t shape_;
-        std::vector<T> v_;
+        // aligned to the cache line (see allocator.h)
+        aligned_vector_t<T> v_;
     };
+
+    // copies values of the array into the flat arena and keeps using them from there
+    template<typename T>
+    void move_to_arena(array3d_t<T> &array, std::shared_ptr<flat_arena_t> const &arena) {
+        aligned_vector_t<T> v(array.data().begin(), array.data().end(), aligned_allocator_t<T>(arena));
+        array = array3d_t<T>(array.shape(), std::move(v));
+    }
 }
 
 #endif // NDARRAY_H
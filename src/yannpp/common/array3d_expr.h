@@ -0,0 +1,164 @@
+#ifndef ARRAY3D_EXPR_H
+#define ARRAY3D_EXPR_H
+
+#include <cassert>
+#include <cstddef>
+
+#include <yannpp/common/shape.h>
+
+namespace yannpp {
+    template<typename T>
+    class array3d_t;
+
+    // lazy elementwise expressions of arrays (e.g. w * decay - nabla_w * scale)
+    // nothing is computed until the expression is assigned to array3d_t
+    // and then the whole chain is evaluated in one loop over memory
+    // expressions keep references to arrays so they must not outlive them
+    template<typename E>
+    class array3d_expr_t {
+    public:
+        inline E const &derived() const { return static_cast<E const &>(*this); }
+        inline shape3d_t const &shape() const { return derived().shape(); }
+        inline size_t size() const { return derived().shape().capacity(); }
+    };
+
+    namespace detail {
+        // arrays are read through the raw pointer which makes the loop easy to vectorize
+        template<typename T>
+        class array3d_operand_t: public array3d_expr_t<array3d_operand_t<T>> {
+        public:
+            typedef T value_type;
+
+            array3d_operand_t(array3d_t<T> const &array):
+                data_(array.data().data()),
+                shape_(array.shape())
+            { }
+
+        public:
+            inline shape3d_t const &shape() const { return shape_; }
+            inline T operator[](size_t i) const { return data_[i]; }
+
+        private:
+            const T *data_;
+            shape3d_t shape_;
+        };
+
+        // arrays are stored as operands and other expressions by value
+        template<typename E>
+        struct expr_operand { typedef E type; };
+
+        template<typename T>
+        struct expr_operand<array3d_t<T>> { typedef array3d_operand_t<T> type; };
+
+        struct plus_op {
+            template<typename T> static inline T apply(T a, T b) { return a + b; }
+        };
+
+        struct minus_op {
+            template<typename T> static inline T apply(T a, T b) { return a - b; }
+        };
+
+        struct multiplies_op {
+            template<typename T> static inline T apply(T a, T b) { return a * b; }
+        };
+
+        struct divides_op {
+            template<typename T> static inline T apply(T a, T b) { return a / b; }
+        };
+
+        template<typename L, typename R, typename Op>
+        class binary_expr_t: public array3d_expr_t<binary_expr_t<L, R, Op>> {
+        public:
+            typedef typename L::value_type value_type;
+
+            binary_expr_t(L const &l, R const &r):
+                l_(l),
+                r_(r)
+            {
+                assert(l_.shape() == r_.shape());
+            }
+
+        public:
+            inline shape3d_t const &shape() const { return l_.shape(); }
+            inline value_type operator[](size_t i) const { return Op::apply(l_[i], r_[i]); }
+
+        private:
+            typename expr_operand<L>::type l_;
+            typename expr_operand<R>::type r_;
+        };
+
+        // elementwise operation with the same scalar
+        template<typename E, typename Op>
+        class scalar_expr_t: public array3d_expr_t<scalar_expr_t<E, Op>> {
+        public:
+            typedef typename E::value_type value_type;
+
+            scalar_expr_t(E const &e, value_type a):
+                e_(e),
+                a_(a)
+            { }
+
+        public:
+            inline shape3d_t const &shape() const { return e_.shape(); }
+            inline value_type operator[](size_t i) const { return Op::apply(e_[i], a_); }
+
+        private:
+            typename expr_operand<E>::type e_;
+            value_type a_;
+        };
+
+        // out[i] = e[i], output can be one of the operands since each
+        // element of the result depends only on the same elements of operands
+        template<typename T, typename E>
+        void evaluate(array3d_expr_t<E> const &expr, T *out) {
+            typename expr_operand<E>::type e(expr.derived());
+            const size_t size = expr.size();
+            for (size_t i = 0; i < size; i++) { out[i] = e[i]; }
+        }
+    }
+
+    template<typename L, typename R>
+    inline detail::binary_expr_t<L, R, detail::plus_op>
+    operator+(array3d_expr_t<L> const &l, array3d_expr_t<R> const &r) {
+        return detail::binary_expr_t<L, R, detail::plus_op>(l.derived(), r.derived());
+    }
+
+    template<typename L, typename R>
+    inline detail::binary_expr_t<L, R, detail::minus_op>
+    operator-(array3d_expr_t<L> const &l, array3d_expr_t<R> const &r) {
+        return detail::binary_expr_t<L, R, detail::minus_op>(l.derived(), r.derived());
+    }
+
+    // elementwise (Hadamard) product
+    template<typename L, typename R>
+    inline detail::binary_expr_t<L, R, detail::multiplies_op>
+    operator*(array3d_expr_t<L> const &l, array3d_expr_t<R> const &r) {
+        return detail::binary_expr_t<L, R, detail::multiplies_op>(l.derived(), r.derived());
+    }
+
+    template<typename E>
+    inline detail::scalar_expr_t<E, detail::multiplies_op>
+    operator*(array3d_expr_t<E> const &e, typename E::value_type a) {
+        return detail::scalar_expr_t<E, detail::multiplies_op>(e.derived(), a);
+    }
+
+    template<typename E>
+    inline detail::scalar_expr_t<E, detail::multiplies_op>
+    operator*(typename E::value_type a, array3d_expr_t<E> const &e) {
+        return detail::scalar_expr_t<E, detail::multiplies_op>(e.derived(), a);
+    }
+
+    template<typename E>
+    inline detail::scalar_expr_t<E, detail::divides_op>
+    operator/(array3d_expr_t<E> const &e, typename E::value_type a) {
+        return detail::scalar_expr_t<E, detail::divides_op>(e.derived(), a);
+    }
+
+    template<typename E>
+    inline detail::scalar_expr_t<E, detail::multiplies_op>
+    operator-(array3d_expr_t<E> const &e) {
+        return detail::scalar_expr_t<E, detail::multiplies_op>(e.derived(), typename E::value_type(-1));
+    }
+}
+
+#endif // ARRAY3D_EXPR_H
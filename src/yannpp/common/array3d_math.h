@@ -1,13 +1,97 @@
 #ifndef ARRAY3D_MATH_H
 #define ARRAY3D_MATH_H
 
+#include <algorithm>
 #include <exception>
 #include <cmath>
+#include <vector>
 
+#include <yannpp/common/arena.h>
 #include <yannpp/common/array3d.h>
+#include <yannpp/common/array3d_view.h>
 #include <yannpp/common/shape.h>
+#include <yannpp/common/simd.h>
+#include <yannpp/common/thread_pool.h>
 
 namespace yannpp {
+    namespace detail {
+        // raw kernels of the array3d_t math below, generic versions are scalar
+        // while float overloads are dispatched to the best SIMD version at runtime
+        template<typename T>
+        T inner_product(const T *a, const T *b, size_t size) {
+            T sum = 0;
+            for (size_t i = 0; i < size; i++) {
+                sum += a[i] * b[i];
+            }
+            return sum;
+        }
+
+        inline float inner_product(const float *a, const float *b, size_t size) {
+            return simd::inner_product(a, b, size);
+        }
+
+        template<typename T>
+        void dot21(const T *m, const T *v, T *y, size_t height, size_t width) {
+            for (size_t i = 0; i < height; i++) {
+                y[i] = inner_product(m + i*width, v, width);
+            }
+        }
+
+        inline void dot21(const float *m, const float *v, float *y, size_t height, size_t width) {
+            simd::dot21(m, v, y, height, width);
+        }
+
+        template<typename T>
+        void transpose_dot21(const T *m, const T *v, T *y, size_t height, size_t width) {
+            std::fill(y, y + width, T(0));
+            for (size_t i = 0; i < height; i++) {
+                const T *row = m + i*width;
+                for (size_t j = 0; j < width; j++) {
+                    y[j] += row[j] * v[i];
+                }
+            }
+        }
+
+        inline void transpose_dot21(const float *m, const float *v, float *y, size_t height, size_t width) {
+            simd::transpose_dot21(m, v, y, height, width);
+        }
+
+        template<typename T>
+        void outer_product(const T *a, const T *b, T *c, size_t height, size_t width) {
+            for (size_t i = 0; i < height; i++) {
+                T *row = c + i*width;
+                for (size_t j = 0; j < width; j++) {
+                    row[j] = a[i] * b[j];
+                }
+            }
+        }
+
+        inline void outer_product(const float *a, const float *b, float *c, size_t height, size_t width) {
+            simd::outer_product(a, b, c, height, width);
+        }
+
+        template<typename T>
+        void stable_softmax(const T *x, T *y, size_t size) {
+            if (size == 0) { return; }
+            const T x_max = *std::max_element(x, x + size);
+
+            T sum = 0.0;
+            for (size_t i = 0; i < size; i++) {
+                T fi = exp(x[i] - x_max);
+                y[i] = fi;
+                sum += fi;
+            }
+
+            for (size_t i = 0; i < size; i++) {
+                y[i] /= sum;
+            }
+        }
+
+        inline void stable_softmax(const float *x, float *y, size_t size) {
+            simd::stable_softmax(x, y, size);
+        }
+    }
+
     template<typename T>
     T sigmoid(T x) {
         return T(1.0)/(T(1.0) + exp(-x));
@@ -41,20 +125,7 @@ namespace yannpp {
     template<typename T>
     array3d_t<T> stable_softmax_v(array3d_t<T> const &x) {
         array3d_t<T> result(x);
-        const int size = (int)result.size();
-        T x_max = x.max();
-
-        T sum = 0.0;
-        for (int i = 0; i < size; i++) {
-            T fi = exp(x(i) - x_max);;
-            result(i) = fi;
-            sum += fi;
-        }
-
-        for (int i = 0; i < size; i++) {
-            result(i) /= sum;
-        }
-
+        detail::stable_softmax(x.data().data(), result.data().data(), result.size());
         return result;
     }
 
@@ -88,15 +159,7 @@ namespace yannpp {
         assert(a.shape().dim() == b.shape().dim());
         assert(a.size() == b.size());
 
-        T sum = 0;
-        auto &a_raw = a.data();
-        auto &b_raw = b.data();
-        const size_t size = a_raw.size();
-        for (size_t i = 0; i < size; i++) {
-            sum += a_raw[i] * b_raw[i];
-        }
-
-        return sum;
+        return detail::inner_product(a.data().data(), b.data().data(), a.size());
     }
 
     // dot product of two slices (used in convolutions)
@@ -114,6 +177,35 @@ namespace yannpp {
         return sum;
     }
 
+    // dot product of the window of array a starting at start and array b of the window size
+    // parts of the window outside of a are treated as zeros (same as dot() of slices)
+    // but bounds are clipped once per window instead of checking each element
+    template<typename T>
+    T window_dot(array3d_view_t<const T> const &a, index3d_t const &start,
+                 array3d_view_t<const T> const &b) {
+        auto &a_shape = a.shape();
+        auto &b_shape = b.shape();
+        const int x0 = std::max(0, -start.x()), x1 = std::min(b_shape.x(), a_shape.x() - start.x());
+        const int y0 = std::max(0, -start.y()), y1 = std::min(b_shape.y(), a_shape.y() - start.y());
+        const int z0 = std::max(0, -start.z()), z1 = std::min(b_shape.z(), a_shape.z() - start.z());
+
+        T sum = 0;
+        if ((x0 >= x1) || (y0 >= y1) || (z0 >= z1)) { return sum; }
+
+        const int a_stride_z = a.strides().z(), b_stride_z = b.strides().z();
+        for (int x = x0; x < x1; x++) {
+            for (int y = y0; y < y1; y++) {
+                const T *pa = a.ptr(start.x() + x, start.y() + y, start.z() + z0);
+                const T *pb = b.ptr(x, y, z0);
+                for (int z = z0; z < z1; z++, pa += a_stride_z, pb += b_stride_z) {
+                    sum += (*pa) * (*pb);
+                }
+            }
+        }
+
+        return sum;
+    }
+
     // dot product of matrix (H, W, 1) and vector (W, 1, 1)
     // result is vector of size (H, 1, 1)
     template<typename T>
@@ -125,13 +217,12 @@ namespace yannpp {
         const size_t height = m.shape().x();
         const size_t width = m.shape().y();
         array3d_t<T> result(shape_row(height), 0);
-        for (size_t i = 0; i < height; i++) {
-            T sum = 0;
-            for (size_t j = 0; j < width; j++) {
-                sum += v(j) * m(i, j);
-            }
-            result(i) = sum;
-        }
+        const T *mdata = m.data().data(), *vdata = v.data().data();
+        T *ydata = result.data().data();
+        // rows are independent so split them between threads
+        parallel_for(0, height, grain_size(width), [&](size_t begin, size_t end) {
+            detail::dot21(mdata + begin*width, vdata, ydata + begin, end - begin, width);
+        });
         return result;
     }
 
@@ -146,14 +237,241 @@ namespace yannpp {
         const size_t width = b.shape().x();
 
         array3d_t<T> c(shape3d_t(height, width, 1), 0);
+        detail::outer_product(a.data().data(), b.data().data(), c.data().data(), height, width);
+        return c;
+    }
 
-        for (size_t i = 0; i < height; i++) {
-            for (size_t j = 0; j < width; j++) {
-                c(i, j) = a(i) * b(j);
+    namespace detail {
+        // blocking of gemm() in the spirit of BLIS/GotoBLAS:
+        // MR x NR block of C is kept in registers by the micro-kernel,
+        // KC x NR sliver of packed B stays in L1, MC x KC block of packed A in L2
+        // and KC x NC panel of packed B in L3, MC is a multiple of MR
+        template<typename T>
+        struct gemm_blocking_t {
+            static const size_t mr = 4;
+            static const size_t nr = 8;
+            static const size_t kc = 256;
+            static const size_t mc = 128;
+            static const size_t nc = 2048;
+        };
+
+        // float blocks match the dispatched micro-kernel (see simd::gemm_micro_kernel())
+        template<>
+        struct gemm_blocking_t<float> {
+            static const size_t mr = simd::gemm_mr;
+            static const size_t nr = simd::gemm_nr;
+            static const size_t kc = 256;
+            static const size_t mc = 20 * simd::gemm_mr;
+            static const size_t nc = 2048;
+        };
+
+        // element (i, j) of op(X) where X is row-major with leading dimension ld
+        template<typename T>
+        inline T gemm_at(const T *x, size_t ld, bool trans, size_t i, size_t j) {
+            return trans ? x[j*ld + i] : x[i*ld + j];
+        }
+
+        // packs mc x kc block of op(A) into slivers of MR rows stored column by column
+        // (partial slivers are padded with zeros so micro-kernel never checks bounds)
+        template<typename T>
+        void gemm_pack_a(const T *a, size_t lda, bool trans,
+                         size_t i0, size_t p0, size_t mc, size_t kc,
+                         T *packed) {
+            const size_t gemm_mr = gemm_blocking_t<T>::mr;
+            for (size_t i = 0; i < mc; i += gemm_mr) {
+                const size_t mr = std::min(gemm_mr, mc - i);
+                for (size_t p = 0; p < kc; p++) {
+                    for (size_t ii = 0; ii < gemm_mr; ii++) {
+                        *packed++ = (ii < mr) ? gemm_at(a, lda, trans, i0 + i + ii, p0 + p) : T(0);
+                    }
+                }
             }
         }
 
-        return c;
+        // packs kc x nc panel of op(B) into slivers of NR columns stored row by row
+        template<typename T>
+        void gemm_pack_b(const T *b, size_t ldb, bool trans,
+                         size_t p0, size_t j0, size_t kc, size_t nc,
+                         T *packed) {
+            const size_t gemm_nr = gemm_blocking_t<T>::nr;
+            for (size_t j = 0; j < nc; j += gemm_nr) {
+                const size_t nr = std::min(gemm_nr, nc - j);
+                for (size_t p = 0; p < kc; p++) {
+                    for (size_t jj = 0; jj < gemm_nr; jj++) {
+                        *packed++ = (jj < nr) ? gemm_at(b, ldb, trans, p0 + p, j0 + j + jj) : T(0);
+                    }
+                }
+            }
+        }
+
+        // C[mr x nr] = alpha * A_sliver * B_sliver + beta * C
+        // accumulators have fixed MR x NR size so compiler keeps them in (vector) registers
+        template<typename T>
+        void gemm_micro_kernel(size_t kc, const T *a, const T *b,
+                               T *c, size_t ldc, size_t mr, size_t nr,
+                               T alpha, T beta) {
+            const size_t gemm_mr = gemm_blocking_t<T>::mr, gemm_nr = gemm_blocking_t<T>::nr;
+            T ab[gemm_blocking_t<T>::mr * gemm_blocking_t<T>::nr] = {};
+
+            for (size_t p = 0; p < kc; p++) {
+                for (size_t i = 0; i < gemm_mr; i++) {
+                    const T ai = a[i];
+                    for (size_t j = 0; j < gemm_nr; j++) {
+                        ab[i*gemm_nr + j] += ai * b[j];
+                    }
+                }
+                a += gemm_mr;
+                b += gemm_nr;
+            }
+
+            for (size_t i = 0; i < mr; i++) {
+                T *c_row = c + i*ldc;
+                for (size_t j = 0; j < nr; j++) {
+                    // beta == 0 means C is write-only (it can contain garbage)
+                    c_row[j] = (beta == T(0)) ?
+                                (alpha * ab[i*gemm_nr + j]) :
+                                (beta * c_row[j] + alpha * ab[i*gemm_nr + j]);
+                }
+            }
+        }
+
+        // explicitly vectorized kernels for the instruction set selected at startup
+        inline void gemm_micro_kernel(size_t kc, const float *a, const float *b,
+                                      float *c, size_t ldc, size_t mr, size_t nr,
+                                      float alpha, float beta) {
+            simd::gemm_micro_kernel(kc, a, b, c, ldc, mr, nr, alpha, beta);
+        }
+    }
+
+    namespace detail {
+        // gemm() where op(A) is a single row or op(B) is a single column
+        // is a matrix-vector product, packing would only add a copy of the matrix
+        // returns false if the vector or the matrix rows are not contiguous in memory
+        template<typename T>
+        bool gemm_as_gemv(bool trans_a, bool trans_b,
+                          size_t m, size_t n, size_t k,
+                          T alpha, const T *a, size_t lda,
+                          const T *b, size_t ldb,
+                          T beta, T *c, size_t ldc) {
+            // scratch memory is taken from the arena of the thread
+            arena_scope_t scope;
+            T *y = nullptr;
+            size_t size = 0, c_stride = 0;
+
+            if ((m == 1) && (!trans_a || lda == 1) && (ldb == (trans_b ? k : n))) {
+                // row of C = a * op(B)
+                size = n;
+                y = scope.arena().allocate<T>(size);
+                c_stride = 1;
+                if (trans_b) { dot21(b, a, y, n, k); }
+                else { transpose_dot21(b, a, y, k, n); }
+            } else if ((n == 1) && (trans_b || ldb == 1) && (lda == (trans_a ? m : k))) {
+                // column of C = op(A) * b
+                size = m;
+                y = scope.arena().allocate<T>(size);
+                c_stride = ldc;
+                if (trans_a) { transpose_dot21(a, b, y, k, m); }
+                else { dot21(a, b, y, m, k); }
+            } else {
+                return false;
+            }
+
+            for (size_t i = 0; i < size; i++) {
+                T &ci = c[i*c_stride];
+                ci = (beta == T(0)) ? (alpha * y[i]) : (beta * ci + alpha * y[i]);
+            }
+
+            return true;
+        }
+    }
+
+    // C(m, n) = alpha * op(A)(m, k) * op(B)(k, n) + beta * C(m, n)
+    // all matrices are row-major with leading dimensions lda, ldb and ldc
+    template<typename T>
+    void gemm(bool trans_a, bool trans_b,
+              size_t m, size_t n, size_t k,
+              T alpha, const T *a, size_t lda,
+              const T *b, size_t ldb,
+              T beta, T *c, size_t ldc) {
+        typedef detail::gemm_blocking_t<T> blocking;
+        const size_t gemm_mr = blocking::mr, gemm_nr = blocking::nr;
+        const size_t gemm_kc = blocking::kc, gemm_mc = blocking::mc, gemm_nc = blocking::nc;
+
+        if (m == 0 || n == 0) { return; }
+
+        if (k == 0 || alpha == T(0)) {
+            for (size_t i = 0; i < m; i++) {
+                for (size_t j = 0; j < n; j++) {
+                    T &cij = c[i*ldc + j];
+                    cij = (beta == T(0)) ? T(0) : beta * cij;
+                }
+            }
+            return;
+        }
+
+        if (((m == 1) || (n == 1)) &&
+                detail::gemm_as_gemv(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc)) {
+            return;
+        }
+
+        const size_t nc_max = std::min(gemm_nc, (n + gemm_nr - 1) / gemm_nr * gemm_nr);
+        const size_t mc_max = std::min(gemm_mc, (m + gemm_mr - 1) / gemm_mr * gemm_mr);
+        const size_t kc_max = std::min(gemm_kc, k);
+        // packing buffers are taken from the arena of the thread
+        arena_scope_t scope;
+        T *packed_a = scope.arena().allocate<T>(mc_max * kc_max);
+        T *packed_b = scope.arena().allocate<T>(nc_max * kc_max);
+
+        for (size_t jc = 0; jc < n; jc += gemm_nc) {
+            const size_t nc = std::min(gemm_nc, n - jc);
+
+            for (size_t pc = 0; pc < k; pc += gemm_kc) {
+                const size_t kc = std::min(gemm_kc, k - pc);
+                // only first slice of K dimension scales C with beta
+                const T beta_pc = (pc == 0) ? beta : T(1);
+                detail::gemm_pack_b(b, ldb, trans_b, pc, jc, kc, nc, packed_b);
+
+                for (size_t ic = 0; ic < m; ic += gemm_mc) {
+                    const size_t mc = std::min(gemm_mc, m - ic);
+                    detail::gemm_pack_a(a, lda, trans_a, ic, pc, mc, kc, packed_a);
+
+                    for (size_t jr = 0; jr < nc; jr += gemm_nr) {
+                        const size_t nr = std::min(gemm_nr, nc - jr);
+
+                        for (size_t ir = 0; ir < mc; ir += gemm_mr) {
+                            const size_t mr = std::min(gemm_mr, mc - ir);
+                            detail::gemm_micro_kernel(kc,
+                                                      &packed_a[ir * kc],
+                                                      &packed_b[jr * kc],
+                                                      c + (ic + ir)*ldc + jc + jr, ldc,
+                                                      mr, nr,
+                                                      alpha, beta_pc);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // general matrix multiplication of 2d arrays (H, W, 1)
+    // C = alpha * op(A) * op(B) + beta * C where op(X) is X or transposed X
+    // C has to be preallocated with the shape of the result
+    template<typename T>
+    void gemm(array3d_t<T> const &a, array3d_t<T> const &b, array3d_t<T> &c,
+              T alpha = T(1), T beta = T(0),
+              bool trans_a = false, bool trans_b = false) {
+        assert(a.shape().z() == 1 && b.shape().z() == 1 && c.shape().z() == 1);
+
+        const size_t m = trans_a ? a.shape().y() : a.shape().x();
+        const size_t k = trans_a ? a.shape().x() : a.shape().y();
+        const size_t n = trans_b ? b.shape().x() : b.shape().y();
+        assert(k == (size_t)(trans_b ? b.shape().y() : b.shape().x()));
+        assert(m == (size_t)c.shape().x() && n == (size_t)c.shape().y());
+
+        gemm(trans_a, trans_b, m, n, k,
+             alpha, a.data().data(), (size_t)a.shape().y(),
+             b.data().data(), (size_t)b.shape().y(),
+             beta, c.data().data(), (size_t)c.shape().y());
     }
 
     // dot product of matrix (H, W, 1) and vector (H, 1, 1) columnwise
@@ -167,15 +485,7 @@ namespace yannpp {
         const size_t width = m.shape().y();
         const size_t height = m.shape().x();
         array3d_t<T> output(shape_row(width), 0);
-
-        for (size_t j = 0; j < width; j++) {
-            T sum = 0;
-            for (size_t i = 0; i < height; i++) {
-                sum += m(i, j) * v(i);
-            }
-            output(j) = sum;
-        }
-
+        detail::transpose_dot21(m.data().data(), v.data().data(), output.data().data(), height, width);
         return output;
     }
 }
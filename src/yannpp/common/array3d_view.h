@@ -0,0 +1,83 @@
+#ifndef ARRAY3D_VIEW_H
+#define ARRAY3D_VIEW_H
+
+#include <cassert>
+#include <cstddef>
+
+#include <yannpp/common/shape.h>
+
+namespace yannpp {
+    // non-owning strided view of 3d data (pointer + strides + extents)
+    // meant for the hot loops of the layers: element access is unchecked
+    // and bounds are only verified with assert() in debug builds
+    // use array3d_view_t<const T> for the read-only access
+    template<typename T>
+    class array3d_view_t {
+    public:
+        array3d_view_t():
+            data_(nullptr),
+            shape_(0, 0, 0),
+            strides_(0, 0, 0)
+        { }
+
+        // dense view with the same memory layout as array3d_t
+        array3d_view_t(T *data, shape3d_t const &shape):
+            data_(data),
+            shape_(shape),
+            strides_(shape.y() * shape.z(), shape.z(), 1)
+        { }
+
+        array3d_view_t(T *data, shape3d_t const &shape, index3d_t const &strides):
+            data_(data),
+            shape_(shape),
+            strides_(strides)
+        { }
+
+        // read-only view can be created from the mutable one
+        template<typename Q>
+        array3d_view_t(array3d_view_t<Q> const &other):
+            data_(other.data()),
+            shape_(other.shape()),
+            strides_(other.strides())
+        { }
+
+    public:
+        inline T *data() const { return data_; }
+        inline shape3d_t const &shape() const { return shape_; }
+        inline index3d_t const &strides() const { return strides_; }
+
+        inline T &operator()(int x, int y, int z) const {
+            assert(in_bounds(x, y, z));
+            return data_[x*strides_.x() + y*strides_.y() + z*strides_.z()];
+        }
+        inline T &operator()(int x, int y) const { return this->operator()(x, y, 0); }
+        inline T &operator()(int x) const { return this->operator()(x, 0, 0); }
+        // pointer to the element, useful to walk a dimension with stride
+        inline T *ptr(int x, int y, int z) const {
+            assert(in_bounds(x, y, z));
+            return data_ + x*strides_.x() + y*strides_.y() + z*strides_.z();
+        }
+
+        inline bool in_bounds(int x, int y, int z) const {
+            return ((0 <= x) && (x < shape_.x())) &&
+                    ((0 <= y) && (y < shape_.y())) &&
+                    ((0 <= z) && (z < shape_.z()));
+        }
+
+        // view of the [start, start + shape) region that has to be inside of this view
+        array3d_view_t subview(index3d_t const &start, shape3d_t const &shape) const {
+            assert(in_bounds(start.x(), start.y(), start.z()));
+            assert(in_bounds(start.x() + shape.x() - 1,
+                             start.y() + shape.y() - 1,
+                             start.z() + shape.z() - 1));
+            return array3d_view_t(ptr(start.x(), start.y(), start.z()), shape, strides_);
+        }
+
+    private:
+        T *data_;
+        shape3d_t shape_;
+        index3d_t strides_;
+    };
+}
+
+#endif // ARRAY3D_VIEW_H
@@ -0,0 +1,178 @@
+#ifndef ARRAY4D_H
+#define ARRAY4D_H
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include <yannpp/common/allocator.h>
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/array3d_view.h>
+#include <yannpp/common/shape.h>
+
+namespace yannpp {
+    // minibatch of 3d arrays of the same shape (batch, X, Y, Z)
+    // samples are stored one after another in one contiguous buffer
+    // so the whole batch is also a row-major matrix (batch, X*Y*Z)
+    template<typename T>
+    class array4d_t {
+    public:
+        array4d_t():
+            batch_(0),
+            shape_(0, 0, 0)
+        {}
+
+        array4d_t(size_t batch, shape3d_t const &shape, T a):
+            batch_(batch),
+            shape_(shape),
+            v_(batch * shape.capacity(), a)
+        {}
+
+        array4d_t(size_t batch, shape3d_t const &shape, aligned_vector_t<T> &&v):
+            batch_(batch),
+            shape_(shape),
+            v_(std::move(v))
+        {
+            assert(v_.size() == batch_ * shape_.capacity());
+        }
+
+        // batch of one sample which takes ownership of the sample data
+        explicit array4d_t(array3d_t<T> &&sample):
+            batch_(1),
+            shape_(sample.shape()),
+            v_(std::move(sample.data()))
+        {
+            assert(v_.size() == (size_t)shape_.capacity());
+        }
+
+        array4d_t(array4d_t<T> const &other):
+            batch_(other.batch_),
+            shape_(other.shape_),
+            v_(other.v_)
+        {}
+
+        array4d_t(array4d_t<T> &&other):
+            batch_(other.batch_),
+            shape_(other.shape_),
+            v_(std::move(other.v_))
+        {}
+
+    public:
+        array4d_t<T> &operator=(array4d_t<T> &&other) {
+            batch_ = other.batch_;
+            shape_ = other.shape_;
+            v_ = std::move(other.v_);
+            return *this;
+        }
+
+        array4d_t<T> &operator=(array4d_t<T> const &other) = delete;
+
+    public:
+        inline size_t batch() const { return batch_; }
+        // shape of one sample
+        inline shape3d_t const &shape() const { return shape_; }
+        inline size_t sample_size() const { return shape_.capacity(); }
+        inline size_t size() const { return v_.size(); }
+        inline aligned_vector_t<T> const &data() const { return v_; }
+        inline aligned_vector_t<T> &data() { return v_; }
+
+        inline T *sample_data(size_t b) { assert(b < batch_); return v_.data() + b*sample_size(); }
+        inline const T *sample_data(size_t b) const { assert(b < batch_); return v_.data() + b*sample_size(); }
+        inline array3d_view_t<T> view(size_t b) { return array3d_view_t<T>(sample_data(b), shape_); }
+        inline array3d_view_t<const T> view(size_t b) const { return array3d_view_t<const T>(sample_data(b), shape_); }
+
+        // copy of one sample
+        array3d_t<T> sample(size_t b) const {
+            const T *data = sample_data(b);
+            return array3d_t<T>(shape_, aligned_vector_t<T>(data, data + sample_size()));
+        }
+
+        void set_sample(size_t b, array3d_t<T> const &sample) {
+            assert(sample.shape() == shape_);
+            std::copy(sample.data().begin(), sample.data().end(), sample_data(b));
+        }
+
+        // converts batch of one sample back to 3d array
+        array3d_t<T> release() {
+            assert(batch_ == 1);
+            batch_ = 0;
+            return array3d_t<T>(shape_, std::move(v_));
+        }
+
+    public:
+        // changes shape of each sample
+        array4d_t<T> &reshape(shape3d_t const &shape) {
+            assert(shape_.capacity() == shape.capacity());
+            shape_ = shape;
+            return *this;
+        }
+
+        void flatten() {
+            reshape(shape_row(shape_.capacity()));
+        }
+
+        // changes batch and shape keeping the allocated memory when it is big enough
+        // so preallocated buffers can be reused, values are not initialized
+        void resize(size_t batch, shape3d_t const &shape) {
+            batch_ = batch;
+            shape_ = shape;
+            v_.resize(batch * shape.capacity());
+        }
+
+        // copies other into this array reusing the allocated memory
+        void assign(array4d_t<T> const &other) {
+            batch_ = other.batch_;
+            shape_ = other.shape_;
+            v_.assign(other.v_.begin(), other.v_.end());
+        }
+
+        array4d_t<T> &mul(const T &a) {
+            for (auto &v: v_) { v *= a; }
+            return *this;
+        }
+
+        array4d_t<T> &element_mul(array4d_t<T> const &other) {
+            assert(other.shape_ == shape_ && other.batch_ == batch_);
+
+            const size_t size = v_.size();
+            for (size_t i = 0; i < size; i++) {
+                v_[i] *= other.v_[i];
+            }
+
+            return *this;
+        }
+
+        array4d_t<T> &add(array4d_t<T> const &other) {
+            assert(other.shape_ == shape_ && other.batch_ == batch_);
+
+            const size_t size = v_.size();
+            for (size_t i = 0; i < size; i++) {
+                v_[i] += other.v_[i];
+            }
+
+            return *this;
+        }
+
+        array4d_t<T> &subtract(array4d_t<T> const &other) {
+            assert(other.shape_ == shape_ && other.batch_ == batch_);
+
+            const size_t size = v_.size();
+            for (size_t i = 0; i < size; i++) {
+                v_[i] -= other.v_[i];
+            }
+
+            return *this;
+        }
+
+        void reset(const T &a) {
+            std::fill(v_.begin(), v_.end(), a);
+        }
+
+    private:
+        size_t batch_;
+        shape3d_t shape_;
+        aligned_vector_t<T> v_;
+    };
+}
+
+#endif // ARRAY4D_H
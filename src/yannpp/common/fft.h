@@ -0,0 +1,126 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+namespace yannpp {
+    inline size_t next_power_of_two(size_t n) {
+        size_t result = 1;
+        while (result < n) { result <<= 1; }
+        return result;
+    }
+
+    // precomputed twiddle factors and bit-reversal permutation
+    // for the iterative radix-2 Cooley-Tukey FFT of size power of two
+    template<typename T>
+    class fft_plan_t {
+    public:
+        fft_plan_t(): size_(0) {}
+
+        explicit fft_plan_t(size_t size):
+            size_(size),
+            twiddles_(size / 2),
+            reversed_(size)
+        {
+            assert(size > 0 && (size & (size - 1)) == 0);
+
+            const double pi = std::acos(-1.0);
+            for (size_t k = 0; k < size / 2; k++) {
+                // computed directly (not by repeated multiplication) to keep them accurate
+                const double angle = -2.0 * pi * (double)k / (double)size;
+                twiddles_[k] = std::complex<T>((T)std::cos(angle), (T)std::sin(angle));
+            }
+
+            size_t bits = 0;
+            while (((size_t)1 << bits) < size) { bits++; }
+            for (size_t i = 0; i < size; i++) {
+                size_t r = 0;
+                for (size_t b = 0; b < bits; b++) {
+                    if (i & ((size_t)1 << b)) { r |= (size_t)1 << (bits - 1 - b); }
+                }
+                reversed_[i] = r;
+            }
+        }
+
+    public:
+        size_t size() const { return size_; }
+
+        // in-place transform of size() elements with given stride
+        // inverse transform is not normalized
+        void transform(std::complex<T> *data, size_t stride, bool inverse) const {
+            for (size_t i = 0; i < size_; i++) {
+                const size_t r = reversed_[i];
+                if (i < r) { std::swap(data[i * stride], data[r * stride]); }
+            }
+
+            for (size_t len = 2; len <= size_; len <<= 1) {
+                const size_t half = len / 2, step = size_ / len;
+                for (size_t i = 0; i < size_; i += len) {
+                    for (size_t j = 0; j < half; j++) {
+                        std::complex<T> w = twiddles_[j * step];
+                        if (inverse) { w = std::conj(w); }
+                        std::complex<T> &even = data[(i + j) * stride];
+                        std::complex<T> &odd = data[(i + j + half) * stride];
+                        const std::complex<T> t = w * odd;
+                        odd = even - t;
+                        even += t;
+                    }
+                }
+            }
+        }
+
+    private:
+        size_t size_;
+        std::vector<std::complex<T>> twiddles_;
+        std::vector<size_t> reversed_;
+    };
+
+    // 2D FFT of the row-major (rows, cols) plane as 1D FFTs of rows and then columns
+    template<typename T>
+    class fft2d_plan_t {
+    public:
+        fft2d_plan_t() {}
+
+        fft2d_plan_t(size_t rows, size_t cols):
+            rows_plan_(rows),
+            cols_plan_(cols)
+        { }
+
+    public:
+        size_t rows() const { return rows_plan_.size(); }
+        size_t cols() const { return cols_plan_.size(); }
+        size_t size() const { return rows() * cols(); }
+
+        void forward(std::complex<T> *data) const { transform(data, false); }
+
+        // normalized inverse transform
+        void inverse(std::complex<T> *data) const {
+            transform(data, true);
+            const T scale = T(1) / (T)size();
+            const size_t count = size();
+            for (size_t i = 0; i < count; i++) { data[i] *= scale; }
+        }
+
+    private:
+        void transform(std::complex<T> *data, bool inverse) const {
+            const size_t rows = this->rows(), cols = this->cols();
+            // each row is a sequence of cols elements
+            for (size_t r = 0; r < rows; r++) {
+                cols_plan_.transform(data + r * cols, 1, inverse);
+            }
+            // each column is a strided sequence of rows elements
+            for (size_t c = 0; c < cols; c++) {
+                rows_plan_.transform(data + c, cols, inverse);
+            }
+        }
+
+    private:
+        fft_plan_t<T> rows_plan_;
+        fft_plan_t<T> cols_plan_;
+    };
+}
+
+#endif // FFT_H
@@ -0,0 +1,1121 @@
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define YANNPP_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace yannpp {
+    namespace simd {
+        namespace {
+            // scalar kernels are the reference implementation
+            // and the only implementation on non-x86 targets
+            float inner_product_scalar(const float *a, const float *b, size_t size) {
+                float sum = 0.f;
+                for (size_t i = 0; i < size; i++) {
+                    sum += a[i] * b[i];
+                }
+                return sum;
+            }
+
+            void dot21_scalar(const float *m, const float *v, float *y, size_t height, size_t width) {
+                for (size_t i = 0; i < height; i++) {
+                    y[i] = inner_product_scalar(m + i*width, v, width);
+                }
+            }
+
+            void transpose_dot21_scalar(const float *m, const float *v, float *y, size_t height, size_t width) {
+                std::fill(y, y + width, 0.f);
+                for (size_t i = 0; i < height; i++) {
+                    const float vi = v[i];
+                    const float *row = m + i*width;
+                    for (size_t j = 0; j < width; j++) {
+                        y[j] += row[j] * vi;
+                    }
+                }
+            }
+
+            void outer_product_scalar(const float *a, const float *b, float *c, size_t height, size_t width) {
+                for (size_t i = 0; i < height; i++) {
+                    const float ai = a[i];
+                    float *row = c + i*width;
+                    for (size_t j = 0; j < width; j++) {
+                        row[j] = ai * b[j];
+                    }
+                }
+            }
+
+            void sgd_update_scalar(float *w, float *g, float decay, float scale, size_t size) {
+                for (size_t i = 0; i < size; i++) {
+                    w[i] = w[i] * decay - g[i] * scale;
+                    g[i] = 0.f;
+                }
+            }
+
+            void momentum_update_scalar(float *w, float *g, float *v, float decay, float scale,
+                                        float momentum, bool nesterov, size_t size) {
+                for (size_t i = 0; i < size; i++) {
+                    const float step = -g[i] * scale;
+                    v[i] = momentum * v[i] + step;
+                    w[i] = w[i] * decay + (nesterov ? momentum * v[i] + step : v[i]);
+                    g[i] = 0.f;
+                }
+            }
+
+            void adam_update_scalar(float *w, float *g, float *m, float *v, adam_coefficients_t const &c, size_t size) {
+                for (size_t i = 0; i < size; i++) {
+                    const float gi = g[i] * c.gradient_scale + c.l2 * w[i];
+                    m[i] = c.beta1 * m[i] + (1.f - c.beta1) * gi;
+                    v[i] = c.beta2 * v[i] + (1.f - c.beta2) * gi * gi;
+                    w[i] = w[i] * c.decay - c.step_size * m[i] / (std::sqrt(v[i]) + c.epsilon);
+                    g[i] = 0.f;
+                }
+            }
+
+            // C = alpha * AB + beta * C for the mr x nr corner of the gemm_mr x gemm_nr block
+            void gemm_store_scalar(const float *ab, float *c, size_t ldc, size_t mr, size_t nr,
+                                   float alpha, float beta) {
+                for (size_t i = 0; i < mr; i++) {
+                    float *c_row = c + i*ldc;
+                    for (size_t j = 0; j < nr; j++) {
+                        c_row[j] = (beta == 0.f) ?
+                                    (alpha * ab[i*gemm_nr + j]) :
+                                    (beta * c_row[j] + alpha * ab[i*gemm_nr + j]);
+                    }
+                }
+            }
+
+            void gemm_micro_kernel_scalar(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                                          size_t mr, size_t nr, float alpha, float beta) {
+                float ab[gemm_mr * gemm_nr] = {};
+                for (size_t p = 0; p < kc; p++) {
+                    for (size_t i = 0; i < gemm_mr; i++) {
+                        const float ai = a[i];
+                        for (size_t j = 0; j < gemm_nr; j++) {
+                            ab[i*gemm_nr + j] += ai * b[j];
+                        }
+                    }
+                    a += gemm_mr;
+                    b += gemm_nr;
+                }
+                gemm_store_scalar(ab, c, ldc, mr, nr, alpha, beta);
+            }
+
+            float max_scalar(const float *x, size_t size) {
+                return *std::max_element(x, x + size);
+            }
+
+            void divide_scalar(float *y, size_t size, float d) {
+                for (size_t i = 0; i < size; i++) {
+                    y[i] /= d;
+                }
+            }
+
+            // exp() itself stays scalar so all kernels share the same precision
+            template<float (*max_kernel)(const float *, size_t),
+                     void (*divide_kernel)(float *, size_t, float)>
+            void stable_softmax_impl(const float *x, float *y, size_t size) {
+                if (size == 0) { return; }
+                const float x_max = max_kernel(x, size);
+
+                float sum = 0.f;
+                for (size_t i = 0; i < size; i++) {
+                    const float fi = std::exp(x[i] - x_max);
+                    y[i] = fi;
+                    sum += fi;
+                }
+
+                divide_kernel(y, size, sum);
+            }
+
+            // fast exp(): x = n*ln(2) + r with |r| <= ln(2)/2 and exp(r) as a polynomial (Cephes expf)
+            // input is clamped so the result is always a normal float
+            const float fast_exp_hi = 88.0f;
+            const float fast_exp_lo = -87.3f;
+            const float fast_log2e = 1.44269504088896341f;
+            // ln(2) split into exactly representable high part and the remainder
+            const float fast_ln2_hi = 0.693359375f;
+            const float fast_ln2_lo = -2.12194440e-4f;
+            const float fast_exp_p0 = 1.9875691500e-4f;
+            const float fast_exp_p1 = 1.3981999507e-3f;
+            const float fast_exp_p2 = 8.3334519073e-3f;
+            const float fast_exp_p3 = 4.1665795894e-2f;
+            const float fast_exp_p4 = 1.6666665459e-1f;
+            const float fast_exp_p5 = 5.0000001201e-1f;
+            // tanh(x) = x + x^3 * P(x^2) for |x| < 0.625 (Cephes tanhf)
+            const float fast_tanh_small = 0.625f;
+            const float fast_tanh_p0 = -5.70498872745e-3f;
+            const float fast_tanh_p1 = 2.06390887954e-2f;
+            const float fast_tanh_p2 = -5.37397155531e-2f;
+            const float fast_tanh_p3 = 1.33314422036e-1f;
+            const float fast_tanh_p4 = -3.33332819422e-1f;
+
+            inline float fast_exp1(float x) {
+                x = std::min(std::max(x, fast_exp_lo), fast_exp_hi);
+                const float n = std::floor(x * fast_log2e + 0.5f);
+                float r = x - n * fast_ln2_hi;
+                r = r - n * fast_ln2_lo;
+
+                float y = fast_exp_p0;
+                y = y * r + fast_exp_p1;
+                y = y * r + fast_exp_p2;
+                y = y * r + fast_exp_p3;
+                y = y * r + fast_exp_p4;
+                y = y * r + fast_exp_p5;
+                y = y * (r * r) + r + 1.f;
+
+                // 2^n built directly in the exponent bits
+                const int32_t bits = ((int32_t)n + 127) << 23;
+                float scale;
+                std::memcpy(&scale, &bits, sizeof(scale));
+                return y * scale;
+            }
+
+            inline float fast_sigmoid1(float x) {
+                return 1.f / (1.f + fast_exp1(-x));
+            }
+
+            inline float fast_tanh1(float x) {
+                const float ax = std::fabs(x);
+                if (ax < fast_tanh_small) {
+                    const float z = x * x;
+                    float y = fast_tanh_p0;
+                    y = y * z + fast_tanh_p1;
+                    y = y * z + fast_tanh_p2;
+                    y = y * z + fast_tanh_p3;
+                    y = y * z + fast_tanh_p4;
+                    return y * z * x + x;
+                }
+
+                const float t = 1.f - 2.f / (fast_exp1(2.f * ax) + 1.f);
+                return std::copysign(t, x);
+            }
+
+            template<float (*f)(float)>
+            void map_scalar(const float *x, float *y, size_t size) {
+                for (size_t i = 0; i < size; i++) { y[i] = f(x[i]); }
+            }
+
+            template<float (*max_kernel)(const float *, size_t),
+                     void (*exp_kernel)(const float *, float *, size_t),
+                     void (*divide_kernel)(float *, size_t, float)>
+            void fast_softmax_impl(const float *x, float *y, size_t size) {
+                if (size == 0) { return; }
+                const float x_max = max_kernel(x, size);
+
+                // exp(x - max) computed in chunks to stay vectorized
+                const size_t chunk = 256;
+                float shifted[chunk];
+                float sum = 0.f;
+                for (size_t i = 0; i < size; i += chunk) {
+                    const size_t n = std::min(chunk, size - i);
+                    for (size_t j = 0; j < n; j++) { shifted[j] = x[i + j] - x_max; }
+                    exp_kernel(shifted, y + i, n);
+                    for (size_t j = 0; j < n; j++) { sum += y[i + j]; }
+                }
+
+                divide_kernel(y, size, sum);
+            }
+
+#ifdef YANNPP_X86_SIMD
+            // ---------------------------------- SSE4.2 ----------------------------------
+
+            __attribute__((target("sse4.2")))
+            inline float hsum_sse42(__m128 v) {
+                __m128 shuf = _mm_movehdup_ps(v);
+                __m128 sums = _mm_add_ps(v, shuf);
+                shuf = _mm_movehl_ps(shuf, sums);
+                sums = _mm_add_ss(sums, shuf);
+                return _mm_cvtss_f32(sums);
+            }
+
+            __attribute__((target("sse4.2")))
+            float inner_product_sse42(const float *a, const float *b, size_t size) {
+                __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+                    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+                }
+                for (; i + 4 <= size; i += 4) {
+                    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+                }
+                float sum = hsum_sse42(_mm_add_ps(acc0, acc1));
+                for (; i < size; i++) { sum += a[i] * b[i]; }
+                return sum;
+            }
+
+            __attribute__((target("sse4.2")))
+            void dot21_sse42(const float *m, const float *v, float *y, size_t height, size_t width) {
+                for (size_t i = 0; i < height; i++) {
+                    y[i] = inner_product_sse42(m + i*width, v, width);
+                }
+            }
+
+            __attribute__((target("sse4.2")))
+            void transpose_dot21_sse42(const float *m, const float *v, float *y, size_t height, size_t width) {
+                std::fill(y, y + width, 0.f);
+                for (size_t i = 0; i < height; i++) {
+                    const float *row = m + i*width;
+                    const __m128 vi = _mm_set1_ps(v[i]);
+                    size_t j = 0;
+                    for (; j + 4 <= width; j += 4) {
+                        _mm_storeu_ps(y + j, _mm_add_ps(_mm_loadu_ps(y + j), _mm_mul_ps(_mm_loadu_ps(row + j), vi)));
+                    }
+                    for (; j < width; j++) { y[j] += row[j] * v[i]; }
+                }
+            }
+
+            __attribute__((target("sse4.2")))
+            void outer_product_sse42(const float *a, const float *b, float *c, size_t height, size_t width) {
+                for (size_t i = 0; i < height; i++) {
+                    float *row = c + i*width;
+                    const __m128 ai = _mm_set1_ps(a[i]);
+                    size_t j = 0;
+                    for (; j + 4 <= width; j += 4) {
+                        _mm_storeu_ps(row + j, _mm_mul_ps(ai, _mm_loadu_ps(b + j)));
+                    }
+                    for (; j < width; j++) { row[j] = a[i] * b[j]; }
+                }
+            }
+
+            // 6x8 half of the block so 12 accumulators fit into 16 xmm registers
+            __attribute__((target("sse4.2")))
+            void gemm_half_sse42(size_t kc, const float *a, const float *b, float *ab) {
+                __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps(), c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+                __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps(), c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+                __m128 c40 = _mm_setzero_ps(), c41 = _mm_setzero_ps(), c50 = _mm_setzero_ps(), c51 = _mm_setzero_ps();
+                for (size_t p = 0; p < kc; p++) {
+                    const __m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b + 4);
+                    __m128 ai = _mm_set1_ps(a[0]);
+                    c00 = _mm_add_ps(c00, _mm_mul_ps(ai, b0)); c01 = _mm_add_ps(c01, _mm_mul_ps(ai, b1));
+                    ai = _mm_set1_ps(a[1]);
+                    c10 = _mm_add_ps(c10, _mm_mul_ps(ai, b0)); c11 = _mm_add_ps(c11, _mm_mul_ps(ai, b1));
+                    ai = _mm_set1_ps(a[2]);
+                    c20 = _mm_add_ps(c20, _mm_mul_ps(ai, b0)); c21 = _mm_add_ps(c21, _mm_mul_ps(ai, b1));
+                    ai = _mm_set1_ps(a[3]);
+                    c30 = _mm_add_ps(c30, _mm_mul_ps(ai, b0)); c31 = _mm_add_ps(c31, _mm_mul_ps(ai, b1));
+                    ai = _mm_set1_ps(a[4]);
+                    c40 = _mm_add_ps(c40, _mm_mul_ps(ai, b0)); c41 = _mm_add_ps(c41, _mm_mul_ps(ai, b1));
+                    ai = _mm_set1_ps(a[5]);
+                    c50 = _mm_add_ps(c50, _mm_mul_ps(ai, b0)); c51 = _mm_add_ps(c51, _mm_mul_ps(ai, b1));
+                    a += gemm_mr;
+                    b += gemm_nr;
+                }
+                _mm_storeu_ps(ab + 0*gemm_nr, c00); _mm_storeu_ps(ab + 0*gemm_nr + 4, c01);
+                _mm_storeu_ps(ab + 1*gemm_nr, c10); _mm_storeu_ps(ab + 1*gemm_nr + 4, c11);
+                _mm_storeu_ps(ab + 2*gemm_nr, c20); _mm_storeu_ps(ab + 2*gemm_nr + 4, c21);
+                _mm_storeu_ps(ab + 3*gemm_nr, c30); _mm_storeu_ps(ab + 3*gemm_nr + 4, c31);
+                _mm_storeu_ps(ab + 4*gemm_nr, c40); _mm_storeu_ps(ab + 4*gemm_nr + 4, c41);
+                _mm_storeu_ps(ab + 5*gemm_nr, c50); _mm_storeu_ps(ab + 5*gemm_nr + 4, c51);
+            }
+
+            __attribute__((target("sse4.2")))
+            void gemm_micro_kernel_sse42(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                                         size_t mr, size_t nr, float alpha, float beta) {
+                float ab[gemm_mr * gemm_nr];
+                gemm_half_sse42(kc, a, b, ab);
+                gemm_half_sse42(kc, a, b + 8, ab + 8);
+                gemm_store_scalar(ab, c, ldc, mr, nr, alpha, beta);
+            }
+
+            __attribute__((target("sse4.2")))
+            void sgd_update_sse42(float *w, float *g, float decay, float scale, size_t size) {
+                const __m128 vdecay = _mm_set1_ps(decay), vscale = _mm_set1_ps(scale), zero = _mm_setzero_ps();
+                size_t i = 0;
+                for (; i + 4 <= size; i += 4) {
+                    const __m128 wi = _mm_mul_ps(_mm_loadu_ps(w + i), vdecay);
+                    _mm_storeu_ps(w + i, _mm_sub_ps(wi, _mm_mul_ps(_mm_loadu_ps(g + i), vscale)));
+                    _mm_storeu_ps(g + i, zero);
+                }
+                for (; i < size; i++) { w[i] = w[i] * decay - g[i] * scale; g[i] = 0.f; }
+            }
+
+            __attribute__((target("sse4.2")))
+            void momentum_update_sse42(float *w, float *g, float *v, float decay, float scale,
+                                       float momentum, bool nesterov, size_t size) {
+                const __m128 vdecay = _mm_set1_ps(decay), vscale = _mm_set1_ps(scale);
+                const __m128 vmomentum = _mm_set1_ps(momentum), zero = _mm_setzero_ps();
+                size_t i = 0;
+                for (; i + 4 <= size; i += 4) {
+                    const __m128 step = _mm_sub_ps(zero, _mm_mul_ps(_mm_loadu_ps(g + i), vscale));
+                    const __m128 vi = _mm_add_ps(_mm_mul_ps(vmomentum, _mm_loadu_ps(v + i)), step);
+                    const __m128 update = nesterov ? _mm_add_ps(_mm_mul_ps(vmomentum, vi), step) : vi;
+                    _mm_storeu_ps(v + i, vi);
+                    _mm_storeu_ps(w + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(w + i), vdecay), update));
+                    _mm_storeu_ps(g + i, zero);
+                }
+                momentum_update_scalar(w + i, g + i, v + i, decay, scale, momentum, nesterov, size - i);
+            }
+
+            __attribute__((target("sse4.2")))
+            void adam_update_sse42(float *w, float *g, float *m, float *v, adam_coefficients_t const &c, size_t size) {
+                const __m128 beta1 = _mm_set1_ps(c.beta1), beta1c = _mm_set1_ps(1.f - c.beta1);
+                const __m128 beta2 = _mm_set1_ps(c.beta2), beta2c = _mm_set1_ps(1.f - c.beta2);
+                const __m128 step_size = _mm_set1_ps(c.step_size), epsilon = _mm_set1_ps(c.epsilon);
+                const __m128 gradient_scale = _mm_set1_ps(c.gradient_scale), l2 = _mm_set1_ps(c.l2);
+                const __m128 decay = _mm_set1_ps(c.decay), zero = _mm_setzero_ps();
+                size_t i = 0;
+                for (; i + 4 <= size; i += 4) {
+                    const __m128 wi = _mm_loadu_ps(w + i);
+                    const __m128 gi = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(g + i), gradient_scale), _mm_mul_ps(l2, wi));
+                    const __m128 mi = _mm_add_ps(_mm_mul_ps(beta1, _mm_loadu_ps(m + i)), _mm_mul_ps(beta1c, gi));
+                    const __m128 vi = _mm_add_ps(_mm_mul_ps(beta2, _mm_loadu_ps(v + i)), _mm_mul_ps(beta2c, _mm_mul_ps(gi, gi)));
+                    const __m128 update = _mm_div_ps(_mm_mul_ps(step_size, mi), _mm_add_ps(_mm_sqrt_ps(vi), epsilon));
+                    _mm_storeu_ps(m + i, mi);
+                    _mm_storeu_ps(v + i, vi);
+                    _mm_storeu_ps(w + i, _mm_sub_ps(_mm_mul_ps(wi, decay), update));
+                    _mm_storeu_ps(g + i, zero);
+                }
+                adam_update_scalar(w + i, g + i, m + i, v + i, c, size - i);
+            }
+
+            __attribute__((target("sse4.2")))
+            float max_sse42(const float *x, size_t size) {
+                float result = x[0];
+                size_t i = 0;
+                if (size >= 4) {
+                    __m128 vmax = _mm_loadu_ps(x);
+                    for (i = 4; i + 4 <= size; i += 4) {
+                        vmax = _mm_max_ps(vmax, _mm_loadu_ps(x + i));
+                    }
+                    vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+                    vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+                    result = _mm_cvtss_f32(vmax);
+                }
+                for (; i < size; i++) { result = std::max(result, x[i]); }
+                return result;
+            }
+
+            __attribute__((target("sse4.2")))
+            void divide_sse42(float *y, size_t size, float d) {
+                const __m128 vd = _mm_set1_ps(d);
+                size_t i = 0;
+                for (; i + 4 <= size; i += 4) {
+                    _mm_storeu_ps(y + i, _mm_div_ps(_mm_loadu_ps(y + i), vd));
+                }
+                for (; i < size; i++) { y[i] /= d; }
+            }
+
+            __attribute__((target("sse4.2")))
+            inline __m128 fast_exp_sse42(__m128 x) {
+                x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(fast_exp_lo)), _mm_set1_ps(fast_exp_hi));
+                const __m128 n = _mm_floor_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(fast_log2e)), _mm_set1_ps(0.5f)));
+                __m128 r = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(fast_ln2_hi)));
+                r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(fast_ln2_lo)));
+
+                __m128 y = _mm_set1_ps(fast_exp_p0);
+                y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(fast_exp_p1));
+                y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(fast_exp_p2));
+                y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(fast_exp_p3));
+                y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(fast_exp_p4));
+                y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(fast_exp_p5));
+                y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(r, r)), r), _mm_set1_ps(1.f));
+
+                const __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+                return _mm_mul_ps(y, _mm_castsi128_ps(bits));
+            }
+
+            __attribute__((target("sse4.2")))
+            inline __m128 fast_sigmoid_sse42(__m128 x) {
+                const __m128 one = _mm_set1_ps(1.f);
+                return _mm_div_ps(one, _mm_add_ps(one, fast_exp_sse42(_mm_sub_ps(_mm_setzero_ps(), x))));
+            }
+
+            __attribute__((target("sse4.2")))
+            inline __m128 fast_tanh_sse42(__m128 x) {
+                const __m128 sign = _mm_set1_ps(-0.f);
+                const __m128 ax = _mm_andnot_ps(sign, x);
+                const __m128 one = _mm_set1_ps(1.f);
+
+                const __m128 z = _mm_mul_ps(x, x);
+                __m128 small = _mm_set1_ps(fast_tanh_p0);
+                small = _mm_add_ps(_mm_mul_ps(small, z), _mm_set1_ps(fast_tanh_p1));
+                small = _mm_add_ps(_mm_mul_ps(small, z), _mm_set1_ps(fast_tanh_p2));
+                small = _mm_add_ps(_mm_mul_ps(small, z), _mm_set1_ps(fast_tanh_p3));
+                small = _mm_add_ps(_mm_mul_ps(small, z), _mm_set1_ps(fast_tanh_p4));
+                small = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(small, z), x), x);
+
+                const __m128 e = fast_exp_sse42(_mm_add_ps(ax, ax));
+                __m128 large = _mm_sub_ps(one, _mm_div_ps(_mm_set1_ps(2.f), _mm_add_ps(e, one)));
+                large = _mm_or_ps(large, _mm_and_ps(sign, x));
+
+                return _mm_blendv_ps(large, small, _mm_cmplt_ps(ax, _mm_set1_ps(fast_tanh_small)));
+            }
+
+            template<__m128 (*f)(__m128)>
+            __attribute__((target("sse4.2")))
+            void map_sse42(const float *x, float *y, size_t size) {
+                size_t i = 0;
+                for (; i + 4 <= size; i += 4) {
+                    _mm_storeu_ps(y + i, f(_mm_loadu_ps(x + i)));
+                }
+                if (i < size) {
+                    // tail goes through the same vector code as the rest
+                    float tail[4] = {0.f, 0.f, 0.f, 0.f};
+                    std::copy(x + i, x + size, tail);
+                    _mm_storeu_ps(tail, f(_mm_loadu_ps(tail)));
+                    std::copy(tail, tail + (size - i), y + i);
+                }
+            }
+
+            // ----------------------------------- AVX2 -----------------------------------
+
+            __attribute__((target("avx2,fma")))
+            inline float hsum_avx2(__m256 v) {
+                __m128 lo = _mm256_castps256_ps128(v);
+                __m128 hi = _mm256_extractf128_ps(v, 1);
+                lo = _mm_add_ps(lo, hi);
+                __m128 shuf = _mm_movehdup_ps(lo);
+                __m128 sums = _mm_add_ps(lo, shuf);
+                shuf = _mm_movehl_ps(shuf, sums);
+                sums = _mm_add_ss(sums, shuf);
+                return _mm_cvtss_f32(sums);
+            }
+
+            __attribute__((target("avx2,fma")))
+            float inner_product_avx2(const float *a, const float *b, size_t size) {
+                __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+                size_t i = 0;
+                for (; i + 16 <= size; i += 16) {
+                    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+                    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+                }
+                for (; i + 8 <= size; i += 8) {
+                    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+                }
+                float sum = hsum_avx2(_mm256_add_ps(acc0, acc1));
+                for (; i < size; i++) { sum += a[i] * b[i]; }
+                return sum;
+            }
+
+            __attribute__((target("avx2,fma")))
+            void dot21_avx2(const float *m, const float *v, float *y, size_t height, size_t width) {
+                for (size_t i = 0; i < height; i++) {
+                    y[i] = inner_product_avx2(m + i*width, v, width);
+                }
+            }
+
+            __attribute__((target("avx2,fma")))
+            void transpose_dot21_avx2(const float *m, const float *v, float *y, size_t height, size_t width) {
+                std::fill(y, y + width, 0.f);
+                for (size_t i = 0; i < height; i++) {
+                    const float *row = m + i*width;
+                    const __m256 vi = _mm256_set1_ps(v[i]);
+                    size_t j = 0;
+                    for (; j + 8 <= width; j += 8) {
+                        _mm256_storeu_ps(y + j, _mm256_fmadd_ps(_mm256_loadu_ps(row + j), vi, _mm256_loadu_ps(y + j)));
+                    }
+                    for (; j < width; j++) { y[j] += row[j] * v[i]; }
+                }
+            }
+
+            __attribute__((target("avx2,fma")))
+            void outer_product_avx2(const float *a, const float *b, float *c, size_t height, size_t width) {
+                for (size_t i = 0; i < height; i++) {
+                    float *row = c + i*width;
+                    const __m256 ai = _mm256_set1_ps(a[i]);
+                    size_t j = 0;
+                    for (; j + 8 <= width; j += 8) {
+                        _mm256_storeu_ps(row + j, _mm256_mul_ps(ai, _mm256_loadu_ps(b + j)));
+                    }
+                    for (; j < width; j++) { row[j] = a[i] * b[j]; }
+                }
+            }
+
+            // 6x16 block in 12 ymm accumulators, one broadcast of A per row
+            __attribute__((target("avx2,fma")))
+            void gemm_micro_kernel_avx2(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                                        size_t mr, size_t nr, float alpha, float beta) {
+                __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps(), c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+                __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps(), c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+                __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps(), c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+                for (size_t p = 0; p < kc; p++) {
+                    const __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8);
+                    __m256 ai = _mm256_broadcast_ss(a + 0);
+                    c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+                    ai = _mm256_broadcast_ss(a + 1);
+                    c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+                    ai = _mm256_broadcast_ss(a + 2);
+                    c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+                    ai = _mm256_broadcast_ss(a + 3);
+                    c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+                    ai = _mm256_broadcast_ss(a + 4);
+                    c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+                    ai = _mm256_broadcast_ss(a + 5);
+                    c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+                    a += gemm_mr;
+                    b += gemm_nr;
+                }
+
+                float ab[gemm_mr * gemm_nr];
+                _mm256_storeu_ps(ab + 0*gemm_nr, c00); _mm256_storeu_ps(ab + 0*gemm_nr + 8, c01);
+                _mm256_storeu_ps(ab + 1*gemm_nr, c10); _mm256_storeu_ps(ab + 1*gemm_nr + 8, c11);
+                _mm256_storeu_ps(ab + 2*gemm_nr, c20); _mm256_storeu_ps(ab + 2*gemm_nr + 8, c21);
+                _mm256_storeu_ps(ab + 3*gemm_nr, c30); _mm256_storeu_ps(ab + 3*gemm_nr + 8, c31);
+                _mm256_storeu_ps(ab + 4*gemm_nr, c40); _mm256_storeu_ps(ab + 4*gemm_nr + 8, c41);
+                _mm256_storeu_ps(ab + 5*gemm_nr, c50); _mm256_storeu_ps(ab + 5*gemm_nr + 8, c51);
+                if (mr < gemm_mr || nr < gemm_nr) {
+                    gemm_store_scalar(ab, c, ldc, mr, nr, alpha, beta);
+                    return;
+                }
+
+                const __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta);
+                for (size_t i = 0; i < gemm_mr; i++) {
+                    for (size_t j = 0; j < gemm_nr; j += 8) {
+                        __m256 r = _mm256_mul_ps(va, _mm256_loadu_ps(ab + i*gemm_nr + j));
+                        if (beta != 0.f) { r = _mm256_fmadd_ps(vb, _mm256_loadu_ps(c + i*ldc + j), r); }
+                        _mm256_storeu_ps(c + i*ldc + j, r);
+                    }
+                }
+            }
+
+            __attribute__((target("avx2,fma")))
+            void sgd_update_avx2(float *w, float *g, float decay, float scale, size_t size) {
+                const __m256 vdecay = _mm256_set1_ps(decay), vscale = _mm256_set1_ps(scale), zero = _mm256_setzero_ps();
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    const __m256 wi = _mm256_mul_ps(_mm256_loadu_ps(w + i), vdecay);
+                    _mm256_storeu_ps(w + i, _mm256_fnmadd_ps(_mm256_loadu_ps(g + i), vscale, wi));
+                    _mm256_storeu_ps(g + i, zero);
+                }
+                for (; i < size; i++) { w[i] = w[i] * decay - g[i] * scale; g[i] = 0.f; }
+            }
+
+            __attribute__((target("avx2,fma")))
+            void momentum_update_avx2(float *w, float *g, float *v, float decay, float scale,
+                                      float momentum, bool nesterov, size_t size) {
+                const __m256 vdecay = _mm256_set1_ps(decay), vscale = _mm256_set1_ps(scale);
+                const __m256 vmomentum = _mm256_set1_ps(momentum), zero = _mm256_setzero_ps();
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    const __m256 step = _mm256_sub_ps(zero, _mm256_mul_ps(_mm256_loadu_ps(g + i), vscale));
+                    const __m256 vi = _mm256_fmadd_ps(vmomentum, _mm256_loadu_ps(v + i), step);
+                    const __m256 update = nesterov ? _mm256_fmadd_ps(vmomentum, vi, step) : vi;
+                    _mm256_storeu_ps(v + i, vi);
+                    _mm256_storeu_ps(w + i, _mm256_fmadd_ps(_mm256_loadu_ps(w + i), vdecay, update));
+                    _mm256_storeu_ps(g + i, zero);
+                }
+                momentum_update_scalar(w + i, g + i, v + i, decay, scale, momentum, nesterov, size - i);
+            }
+
+            __attribute__((target("avx2,fma")))
+            void adam_update_avx2(float *w, float *g, float *m, float *v, adam_coefficients_t const &c, size_t size) {
+                const __m256 beta1 = _mm256_set1_ps(c.beta1), beta1c = _mm256_set1_ps(1.f - c.beta1);
+                const __m256 beta2 = _mm256_set1_ps(c.beta2), beta2c = _mm256_set1_ps(1.f - c.beta2);
+                const __m256 step_size = _mm256_set1_ps(c.step_size), epsilon = _mm256_set1_ps(c.epsilon);
+                const __m256 gradient_scale = _mm256_set1_ps(c.gradient_scale), l2 = _mm256_set1_ps(c.l2);
+                const __m256 decay = _mm256_set1_ps(c.decay), zero = _mm256_setzero_ps();
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    const __m256 wi = _mm256_loadu_ps(w + i);
+                    const __m256 gi = _mm256_fmadd_ps(_mm256_loadu_ps(g + i), gradient_scale, _mm256_mul_ps(l2, wi));
+                    const __m256 mi = _mm256_fmadd_ps(beta1, _mm256_loadu_ps(m + i), _mm256_mul_ps(beta1c, gi));
+                    const __m256 vi = _mm256_fmadd_ps(beta2, _mm256_loadu_ps(v + i), _mm256_mul_ps(beta2c, _mm256_mul_ps(gi, gi)));
+                    const __m256 update = _mm256_div_ps(_mm256_mul_ps(step_size, mi), _mm256_add_ps(_mm256_sqrt_ps(vi), epsilon));
+                    _mm256_storeu_ps(m + i, mi);
+                    _mm256_storeu_ps(v + i, vi);
+                    _mm256_storeu_ps(w + i, _mm256_fmsub_ps(wi, decay, update));
+                    _mm256_storeu_ps(g + i, zero);
+                }
+                adam_update_scalar(w + i, g + i, m + i, v + i, c, size - i);
+            }
+
+            __attribute__((target("avx2,fma")))
+            float max_avx2(const float *x, size_t size) {
+                float result = x[0];
+                size_t i = 0;
+                if (size >= 8) {
+                    __m256 vmax = _mm256_loadu_ps(x);
+                    for (i = 8; i + 8 <= size; i += 8) {
+                        vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(x + i));
+                    }
+                    __m128 m = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+                    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+                    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+                    result = _mm_cvtss_f32(m);
+                }
+                for (; i < size; i++) { result = std::max(result, x[i]); }
+                return result;
+            }
+
+            __attribute__((target("avx2,fma")))
+            void divide_avx2(float *y, size_t size, float d) {
+                const __m256 vd = _mm256_set1_ps(d);
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    _mm256_storeu_ps(y + i, _mm256_div_ps(_mm256_loadu_ps(y + i), vd));
+                }
+                for (; i < size; i++) { y[i] /= d; }
+            }
+
+            __attribute__((target("avx2,fma")))
+            inline __m256 fast_exp_avx2(__m256 x) {
+                x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(fast_exp_lo)), _mm256_set1_ps(fast_exp_hi));
+                const __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(fast_log2e), _mm256_set1_ps(0.5f)));
+                __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(fast_ln2_hi), x);
+                r = _mm256_fnmadd_ps(n, _mm256_set1_ps(fast_ln2_lo), r);
+
+                __m256 y = _mm256_set1_ps(fast_exp_p0);
+                y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(fast_exp_p1));
+                y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(fast_exp_p2));
+                y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(fast_exp_p3));
+                y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(fast_exp_p4));
+                y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(fast_exp_p5));
+                y = _mm256_add_ps(_mm256_fmadd_ps(y, _mm256_mul_ps(r, r), r), _mm256_set1_ps(1.f));
+
+                const __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+                return _mm256_mul_ps(y, _mm256_castsi256_ps(bits));
+            }
+
+            __attribute__((target("avx2,fma")))
+            inline __m256 fast_sigmoid_avx2(__m256 x) {
+                const __m256 one = _mm256_set1_ps(1.f);
+                return _mm256_div_ps(one, _mm256_add_ps(one, fast_exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+            }
+
+            __attribute__((target("avx2,fma")))
+            inline __m256 fast_tanh_avx2(__m256 x) {
+                const __m256 sign = _mm256_set1_ps(-0.f);
+                const __m256 ax = _mm256_andnot_ps(sign, x);
+                const __m256 one = _mm256_set1_ps(1.f);
+
+                const __m256 z = _mm256_mul_ps(x, x);
+                __m256 small = _mm256_set1_ps(fast_tanh_p0);
+                small = _mm256_fmadd_ps(small, z, _mm256_set1_ps(fast_tanh_p1));
+                small = _mm256_fmadd_ps(small, z, _mm256_set1_ps(fast_tanh_p2));
+                small = _mm256_fmadd_ps(small, z, _mm256_set1_ps(fast_tanh_p3));
+                small = _mm256_fmadd_ps(small, z, _mm256_set1_ps(fast_tanh_p4));
+                small = _mm256_fmadd_ps(_mm256_mul_ps(small, z), x, x);
+
+                const __m256 e = fast_exp_avx2(_mm256_add_ps(ax, ax));
+                __m256 large = _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2.f), _mm256_add_ps(e, one)));
+                large = _mm256_or_ps(large, _mm256_and_ps(sign, x));
+
+                return _mm256_blendv_ps(large, small, _mm256_cmp_ps(ax, _mm256_set1_ps(fast_tanh_small), _CMP_LT_OQ));
+            }
+
+            template<__m256 (*f)(__m256)>
+            __attribute__((target("avx2,fma")))
+            void map_avx2(const float *x, float *y, size_t size) {
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    _mm256_storeu_ps(y + i, f(_mm256_loadu_ps(x + i)));
+                }
+                if (i < size) {
+                    float tail[8] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+                    std::copy(x + i, x + size, tail);
+                    _mm256_storeu_ps(tail, f(_mm256_loadu_ps(tail)));
+                    std::copy(tail, tail + (size - i), y + i);
+                }
+            }
+
+            // ---------------------------------- AVX-512 ---------------------------------
+
+            __attribute__((target("avx512f")))
+            float inner_product_avx512(const float *a, const float *b, size_t size) {
+                __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+                size_t i = 0;
+                for (; i + 32 <= size; i += 32) {
+                    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+                    acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+                }
+                for (; i + 16 <= size; i += 16) {
+                    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+                }
+                if (i < size) {
+                    // masked loads handle the tail without a scalar loop
+                    const __mmask16 mask = (__mmask16)((1u << (size - i)) - 1);
+                    acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                                           _mm512_maskz_loadu_ps(mask, b + i),
+                                           acc1);
+                }
+                return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+            }
+
+            __attribute__((target("avx512f")))
+            void dot21_avx512(const float *m, const float *v, float *y, size_t height, size_t width) {
+                for (size_t i = 0; i < height; i++) {
+                    y[i] = inner_product_avx512(m + i*width, v, width);
+                }
+            }
+
+            __attribute__((target("avx512f")))
+            void transpose_dot21_avx512(const float *m, const float *v, float *y, size_t height, size_t width) {
+                std::fill(y, y + width, 0.f);
+                const size_t tail = width % 16;
+                const __mmask16 mask = (__mmask16)((1u << tail) - 1);
+                for (size_t i = 0; i < height; i++) {
+                    const float *row = m + i*width;
+                    const __m512 vi = _mm512_set1_ps(v[i]);
+                    size_t j = 0;
+                    for (; j + 16 <= width; j += 16) {
+                        _mm512_storeu_ps(y + j, _mm512_fmadd_ps(_mm512_loadu_ps(row + j), vi, _mm512_loadu_ps(y + j)));
+                    }
+                    if (tail) {
+                        _mm512_mask_storeu_ps(y + j, mask,
+                                              _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, row + j), vi,
+                                                              _mm512_maskz_loadu_ps(mask, y + j)));
+                    }
+                }
+            }
+
+            __attribute__((target("avx512f")))
+            void outer_product_avx512(const float *a, const float *b, float *c, size_t height, size_t width) {
+                const size_t tail = width % 16;
+                const __mmask16 mask = (__mmask16)((1u << tail) - 1);
+                for (size_t i = 0; i < height; i++) {
+                    float *row = c + i*width;
+                    const __m512 ai = _mm512_set1_ps(a[i]);
+                    size_t j = 0;
+                    for (; j + 16 <= width; j += 16) {
+                        _mm512_storeu_ps(row + j, _mm512_mul_ps(ai, _mm512_loadu_ps(b + j)));
+                    }
+                    if (tail) {
+                        _mm512_mask_storeu_ps(row + j, mask, _mm512_mul_ps(ai, _mm512_maskz_loadu_ps(mask, b + j)));
+                    }
+                }
+            }
+
+            // 6x16 block in zmm accumulators, even and odd steps of K go to separate ones
+            // so 12 independent FMA chains hide the latency, partial blocks are stored with masks
+            __attribute__((target("avx512f")))
+            void gemm_micro_kernel_avx512(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                                          size_t mr, size_t nr, float alpha, float beta) {
+                __m512 c0 = _mm512_setzero_ps(), c1 = _mm512_setzero_ps(), c2 = _mm512_setzero_ps();
+                __m512 c3 = _mm512_setzero_ps(), c4 = _mm512_setzero_ps(), c5 = _mm512_setzero_ps();
+                __m512 d0 = _mm512_setzero_ps(), d1 = _mm512_setzero_ps(), d2 = _mm512_setzero_ps();
+                __m512 d3 = _mm512_setzero_ps(), d4 = _mm512_setzero_ps(), d5 = _mm512_setzero_ps();
+                size_t p = 0;
+                for (; p + 2 <= kc; p += 2) {
+                    const __m512 b0 = _mm512_loadu_ps(b), b1 = _mm512_loadu_ps(b + gemm_nr);
+                    c0 = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), b0, c0);
+                    c1 = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), b0, c1);
+                    c2 = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), b0, c2);
+                    c3 = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), b0, c3);
+                    c4 = _mm512_fmadd_ps(_mm512_set1_ps(a[4]), b0, c4);
+                    c5 = _mm512_fmadd_ps(_mm512_set1_ps(a[5]), b0, c5);
+                    d0 = _mm512_fmadd_ps(_mm512_set1_ps(a[gemm_mr + 0]), b1, d0);
+                    d1 = _mm512_fmadd_ps(_mm512_set1_ps(a[gemm_mr + 1]), b1, d1);
+                    d2 = _mm512_fmadd_ps(_mm512_set1_ps(a[gemm_mr + 2]), b1, d2);
+                    d3 = _mm512_fmadd_ps(_mm512_set1_ps(a[gemm_mr + 3]), b1, d3);
+                    d4 = _mm512_fmadd_ps(_mm512_set1_ps(a[gemm_mr + 4]), b1, d4);
+                    d5 = _mm512_fmadd_ps(_mm512_set1_ps(a[gemm_mr + 5]), b1, d5);
+                    a += 2 * gemm_mr;
+                    b += 2 * gemm_nr;
+                }
+                if (p < kc) {
+                    const __m512 b0 = _mm512_loadu_ps(b);
+                    c0 = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), b0, c0);
+                    c1 = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), b0, c1);
+                    c2 = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), b0, c2);
+                    c3 = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), b0, c3);
+                    c4 = _mm512_fmadd_ps(_mm512_set1_ps(a[4]), b0, c4);
+                    c5 = _mm512_fmadd_ps(_mm512_set1_ps(a[5]), b0, c5);
+                }
+
+                const __m512 rows[gemm_mr] = {_mm512_add_ps(c0, d0), _mm512_add_ps(c1, d1), _mm512_add_ps(c2, d2),
+                                              _mm512_add_ps(c3, d3), _mm512_add_ps(c4, d4), _mm512_add_ps(c5, d5)};
+                const __m512 va = _mm512_set1_ps(alpha), vb = _mm512_set1_ps(beta);
+                const __mmask16 mask = (__mmask16)((1u << nr) - 1);
+                for (size_t i = 0; i < mr; i++) {
+                    __m512 r = _mm512_mul_ps(va, rows[i]);
+                    if (beta != 0.f) { r = _mm512_fmadd_ps(vb, _mm512_maskz_loadu_ps(mask, c + i*ldc), r); }
+                    _mm512_mask_storeu_ps(c + i*ldc, mask, r);
+                }
+            }
+
+            __attribute__((target("avx512f")))
+            void sgd_update_avx512(float *w, float *g, float decay, float scale, size_t size) {
+                const __m512 vdecay = _mm512_set1_ps(decay), vscale = _mm512_set1_ps(scale), zero = _mm512_setzero_ps();
+                size_t i = 0;
+                for (; i + 16 <= size; i += 16) {
+                    const __m512 wi = _mm512_mul_ps(_mm512_loadu_ps(w + i), vdecay);
+                    _mm512_storeu_ps(w + i, _mm512_fnmadd_ps(_mm512_loadu_ps(g + i), vscale, wi));
+                    _mm512_storeu_ps(g + i, zero);
+                }
+                if (i < size) {
+                    const __mmask16 mask = (__mmask16)((1u << (size - i)) - 1);
+                    const __m512 wi = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, w + i), vdecay);
+                    _mm512_mask_storeu_ps(w + i, mask, _mm512_fnmadd_ps(_mm512_maskz_loadu_ps(mask, g + i), vscale, wi));
+                    _mm512_mask_storeu_ps(g + i, mask, zero);
+                }
+            }
+
+            __attribute__((target("avx512f")))
+            void momentum_update_avx512(float *w, float *g, float *v, float decay, float scale,
+                                        float momentum, bool nesterov, size_t size) {
+                const __m512 vdecay = _mm512_set1_ps(decay), vscale = _mm512_set1_ps(scale);
+                const __m512 vmomentum = _mm512_set1_ps(momentum), zero = _mm512_setzero_ps();
+                size_t i = 0;
+                for (; i < size; i += 16) {
+                    // the last iteration is masked
+                    const __mmask16 mask = size - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+                    const __m512 step = _mm512_sub_ps(zero, _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, g + i), vscale));
+                    const __m512 vi = _mm512_fmadd_ps(vmomentum, _mm512_maskz_loadu_ps(mask, v + i), step);
+                    const __m512 update = nesterov ? _mm512_fmadd_ps(vmomentum, vi, step) : vi;
+                    _mm512_mask_storeu_ps(v + i, mask, vi);
+                    _mm512_mask_storeu_ps(w + i, mask, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w + i), vdecay, update));
+                    _mm512_mask_storeu_ps(g + i, mask, zero);
+                }
+            }
+
+            __attribute__((target("avx512f")))
+            void adam_update_avx512(float *w, float *g, float *m, float *v, adam_coefficients_t const &c, size_t size) {
+                const __m512 beta1 = _mm512_set1_ps(c.beta1), beta1c = _mm512_set1_ps(1.f - c.beta1);
+                const __m512 beta2 = _mm512_set1_ps(c.beta2), beta2c = _mm512_set1_ps(1.f - c.beta2);
+                const __m512 step_size = _mm512_set1_ps(c.step_size), epsilon = _mm512_set1_ps(c.epsilon);
+                const __m512 gradient_scale = _mm512_set1_ps(c.gradient_scale), l2 = _mm512_set1_ps(c.l2);
+                const __m512 decay = _mm512_set1_ps(c.decay), zero = _mm512_setzero_ps();
+                for (size_t i = 0; i < size; i += 16) {
+                    // the last iteration is masked
+                    const __mmask16 mask = size - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+                    const __m512 wi = _mm512_maskz_loadu_ps(mask, w + i);
+                    const __m512 gi = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, g + i), gradient_scale, _mm512_mul_ps(l2, wi));
+                    const __m512 mi = _mm512_fmadd_ps(beta1, _mm512_maskz_loadu_ps(mask, m + i), _mm512_mul_ps(beta1c, gi));
+                    const __m512 vi = _mm512_fmadd_ps(beta2, _mm512_maskz_loadu_ps(mask, v + i), _mm512_mul_ps(beta2c, _mm512_mul_ps(gi, gi)));
+                    const __m512 update = _mm512_div_ps(_mm512_mul_ps(step_size, mi), _mm512_add_ps(_mm512_sqrt_ps(vi), epsilon));
+                    _mm512_mask_storeu_ps(m + i, mask, mi);
+                    _mm512_mask_storeu_ps(v + i, mask, vi);
+                    _mm512_mask_storeu_ps(w + i, mask, _mm512_fmsub_ps(wi, decay, update));
+                    _mm512_mask_storeu_ps(g + i, mask, zero);
+                }
+            }
+
+            __attribute__((target("avx512f")))
+            float max_avx512(const float *x, size_t size) {
+                float result = x[0];
+                size_t i = 0;
+                if (size >= 16) {
+                    __m512 vmax = _mm512_loadu_ps(x);
+                    for (i = 16; i + 16 <= size; i += 16) {
+                        vmax = _mm512_max_ps(vmax, _mm512_loadu_ps(x + i));
+                    }
+                    result = _mm512_reduce_max_ps(vmax);
+                }
+                for (; i < size; i++) { result = std::max(result, x[i]); }
+                return result;
+            }
+
+            __attribute__((target("avx512f")))
+            void divide_avx512(float *y, size_t size, float d) {
+                const __m512 vd = _mm512_set1_ps(d);
+                size_t i = 0;
+                for (; i + 16 <= size; i += 16) {
+                    _mm512_storeu_ps(y + i, _mm512_div_ps(_mm512_loadu_ps(y + i), vd));
+                }
+                for (; i < size; i++) { y[i] /= d; }
+            }
+            __attribute__((target("avx512f")))
+            inline __m512 fast_exp_avx512(__m512 x) {
+                x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(fast_exp_lo)), _mm512_set1_ps(fast_exp_hi));
+                const __m512 n = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(fast_log2e), _mm512_set1_ps(0.5f)),
+                                                      _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+                __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(fast_ln2_hi), x);
+                r = _mm512_fnmadd_ps(n, _mm512_set1_ps(fast_ln2_lo), r);
+
+                __m512 y = _mm512_set1_ps(fast_exp_p0);
+                y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(fast_exp_p1));
+                y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(fast_exp_p2));
+                y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(fast_exp_p3));
+                y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(fast_exp_p4));
+                y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(fast_exp_p5));
+                y = _mm512_add_ps(_mm512_fmadd_ps(y, _mm512_mul_ps(r, r), r), _mm512_set1_ps(1.f));
+
+                const __m512i bits = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+                return _mm512_mul_ps(y, _mm512_castsi512_ps(bits));
+            }
+
+            __attribute__((target("avx512f")))
+            inline __m512 fast_sigmoid_avx512(__m512 x) {
+                const __m512 one = _mm512_set1_ps(1.f);
+                return _mm512_div_ps(one, _mm512_add_ps(one, fast_exp_avx512(_mm512_sub_ps(_mm512_setzero_ps(), x))));
+            }
+
+            __attribute__((target("avx512f")))
+            inline __m512 fast_tanh_avx512(__m512 x) {
+                const __m512 ax = _mm512_abs_ps(x);
+                const __m512 one = _mm512_set1_ps(1.f);
+
+                const __m512 z = _mm512_mul_ps(x, x);
+                __m512 small = _mm512_set1_ps(fast_tanh_p0);
+                small = _mm512_fmadd_ps(small, z, _mm512_set1_ps(fast_tanh_p1));
+                small = _mm512_fmadd_ps(small, z, _mm512_set1_ps(fast_tanh_p2));
+                small = _mm512_fmadd_ps(small, z, _mm512_set1_ps(fast_tanh_p3));
+                small = _mm512_fmadd_ps(small, z, _mm512_set1_ps(fast_tanh_p4));
+                small = _mm512_fmadd_ps(_mm512_mul_ps(small, z), x, x);
+
+                const __m512 e = fast_exp_avx512(_mm512_add_ps(ax, ax));
+                __m512 large = _mm512_sub_ps(one, _mm512_div_ps(_mm512_set1_ps(2.f), _mm512_add_ps(e, one)));
+                // copy sign of x
+                const __m512i sign = _mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x80000000));
+                large = _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(large), sign));
+
+                const __mmask16 is_small = _mm512_cmp_ps_mask(ax, _mm512_set1_ps(fast_tanh_small), _CMP_LT_OQ);
+                return _mm512_mask_blend_ps(is_small, large, small);
+            }
+
+            template<__m512 (*f)(__m512)>
+            __attribute__((target("avx512f")))
+            void map_avx512(const float *x, float *y, size_t size) {
+                size_t i = 0;
+                for (; i + 16 <= size; i += 16) {
+                    _mm512_storeu_ps(y + i, f(_mm512_loadu_ps(x + i)));
+                }
+                if (i < size) {
+                    const __mmask16 mask = (__mmask16)((1u << (size - i)) - 1);
+                    _mm512_mask_storeu_ps(y + i, mask, f(_mm512_maskz_loadu_ps(mask, x + i)));
+                }
+            }
+#endif // YANNPP_X86_SIMD
+
+            struct kernels_t {
+                isa_type isa;
+                float (*inner_product)(const float *, const float *, size_t);
+                void (*dot21)(const float *, const float *, float *, size_t, size_t);
+                void (*transpose_dot21)(const float *, const float *, float *, size_t, size_t);
+                void (*outer_product)(const float *, const float *, float *, size_t, size_t);
+                void (*stable_softmax)(const float *, float *, size_t);
+                void (*sgd_update)(float *, float *, float, float, size_t);
+                void (*momentum_update)(float *, float *, float *, float, float, float, bool, size_t);
+                void (*adam_update)(float *, float *, float *, float *, adam_coefficients_t const &, size_t);
+                void (*fast_exp)(const float *, float *, size_t);
+                void (*fast_sigmoid)(const float *, float *, size_t);
+                void (*fast_tanh)(const float *, float *, size_t);
+                void (*fast_softmax)(const float *, float *, size_t);
+                void (*gemm_micro_kernel)(size_t, const float *, const float *, float *, size_t,
+                                          size_t, size_t, float, float);
+            };
+
+            kernels_t make_kernels(isa_type isa) {
+                switch (isa) {
+#ifdef YANNPP_X86_SIMD
+                case isa_type::avx512:
+                    return kernels_t{isa,
+                                inner_product_avx512, dot21_avx512, transpose_dot21_avx512, outer_product_avx512,
+                                stable_softmax_impl<max_avx512, divide_avx512>, sgd_update_avx512, momentum_update_avx512, adam_update_avx512,
+                                map_avx512<fast_exp_avx512>, map_avx512<fast_sigmoid_avx512>, map_avx512<fast_tanh_avx512>,
+                                fast_softmax_impl<max_avx512, map_avx512<fast_exp_avx512>, divide_avx512>,
+                                gemm_micro_kernel_avx512};
+                case isa_type::avx2:
+                    return kernels_t{isa,
+                                inner_product_avx2, dot21_avx2, transpose_dot21_avx2, outer_product_avx2,
+                                stable_softmax_impl<max_avx2, divide_avx2>, sgd_update_avx2, momentum_update_avx2, adam_update_avx2,
+                                map_avx2<fast_exp_avx2>, map_avx2<fast_sigmoid_avx2>, map_avx2<fast_tanh_avx2>,
+                                fast_softmax_impl<max_avx2, map_avx2<fast_exp_avx2>, divide_avx2>,
+                                gemm_micro_kernel_avx2};
+                case isa_type::sse42:
+                    return kernels_t{isa,
+                                inner_product_sse42, dot21_sse42, transpose_dot21_sse42, outer_product_sse42,
+                                stable_softmax_impl<max_sse42, divide_sse42>, sgd_update_sse42, momentum_update_sse42, adam_update_sse42,
+                                map_sse42<fast_exp_sse42>, map_sse42<fast_sigmoid_sse42>, map_sse42<fast_tanh_sse42>,
+                                fast_softmax_impl<max_sse42, map_sse42<fast_exp_sse42>, divide_sse42>,
+                                gemm_micro_kernel_sse42};
+#endif
+                default:
+                    return kernels_t{isa_type::scalar,
+                                inner_product_scalar, dot21_scalar, transpose_dot21_scalar, outer_product_scalar,
+                                stable_softmax_impl<max_scalar, divide_scalar>, sgd_update_scalar, momentum_update_scalar, adam_update_scalar,
+                                map_scalar<fast_exp1>, map_scalar<fast_sigmoid1>, map_scalar<fast_tanh1>,
+                                fast_softmax_impl<max_scalar, map_scalar<fast_exp1>, divide_scalar>,
+                                gemm_micro_kernel_scalar};
+                }
+            }
+
+            isa_type detect_isa() {
+#ifdef YANNPP_X86_SIMD
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx512f")) { return isa_type::avx512; }
+                if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { return isa_type::avx2; }
+                if (__builtin_cpu_supports("sse4.2")) { return isa_type::sse42; }
+#endif
+                return isa_type::scalar;
+            }
+
+            kernels_t &active_kernels() {
+                // initialized once on first use (thread-safe since C++11)
+                static kernels_t kernels = make_kernels(detect_isa());
+                return kernels;
+            }
+        }
+
+        isa_type detected_isa() {
+            static const isa_type isa = detect_isa();
+            return isa;
+        }
+
+        isa_type current_isa() { return active_kernels().isa; }
+
+        void set_isa(isa_type isa) {
+            active_kernels() = make_kernels(std::min(isa, detected_isa()));
+        }
+
+        const char *isa_name(isa_type isa) {
+            switch (isa) {
+            case isa_type::avx512: return "AVX-512";
+            case isa_type::avx2: return "AVX2";
+            case isa_type::sse42: return "SSE4.2";
+            default: return "scalar";
+            }
+        }
+
+        float inner_product(const float *a, const float *b, size_t size) {
+            return active_kernels().inner_product(a, b, size);
+        }
+
+        void dot21(const float *m, const float *v, float *y, size_t height, size_t width) {
+            active_kernels().dot21(m, v, y, height, width);
+        }
+
+        void transpose_dot21(const float *m, const float *v, float *y, size_t height, size_t width) {
+            active_kernels().transpose_dot21(m, v, y, height, width);
+        }
+
+        void outer_product(const float *a, const float *b, float *c, size_t height, size_t width) {
+            active_kernels().outer_product(a, b, c, height, width);
+        }
+
+        void stable_softmax(const float *x, float *y, size_t size) {
+            active_kernels().stable_softmax(x, y, size);
+        }
+
+        void sgd_update(float *w, float *g, float decay, float scale, size_t size) {
+            active_kernels().sgd_update(w, g, decay, scale, size);
+        }
+
+        void momentum_update(float *w, float *g, float *v, float decay, float scale,
+                             float momentum, bool nesterov, size_t size) {
+            active_kernels().momentum_update(w, g, v, decay, scale, momentum, nesterov, size);
+        }
+
+        void adam_update(float *w, float *g, float *m, float *v, adam_coefficients_t const &c, size_t size) {
+            active_kernels().adam_update(w, g, m, v, c, size);
+        }
+
+        void fast_exp(const float *x, float *y, size_t size) {
+            active_kernels().fast_exp(x, y, size);
+        }
+
+        void fast_sigmoid(const float *x, float *y, size_t size) {
+            active_kernels().fast_sigmoid(x, y, size);
+        }
+
+        void fast_tanh(const float *x, float *y, size_t size) {
+            active_kernels().fast_tanh(x, y, size);
+        }
+
+        void fast_softmax(const float *x, float *y, size_t size) {
+            active_kernels().fast_softmax(x, y, size);
+        }
+
+        void gemm_micro_kernel(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                               size_t mr, size_t nr, float alpha, float beta) {
+            active_kernels().gemm_micro_kernel(kc, a, b, c, ldc, mr, nr, alpha, beta);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+
+namespace yannpp {
+    namespace simd {
+        // instruction sets with dedicated kernels, ordered from the slowest
+        enum struct isa_type {
+            scalar = 0,
+            sse42 = 1,
+            avx2 = 2,
+            avx512 = 3
+        };
+
+        // best instruction set supported by the CPU (detected using CPUID)
+        isa_type detected_isa();
+        // instruction set used by the kernels, selected at startup
+        isa_type current_isa();
+        // forces kernels for the given instruction set (clamped to the detected one)
+        // not thread-safe, meant to be called before any computations (tests, benchmarks)
+        void set_isa(isa_type isa);
+        const char *isa_name(isa_type isa);
+
+        // sum of a[i] * b[i]
+        float inner_product(const float *a, const float *b, size_t size);
+        // y = m * v where m is row-major matrix (height, width)
+        void dot21(const float *m, const float *v, float *y, size_t height, size_t width);
+        // y = transpose(m) * v where m is row-major matrix (height, width)
+        void transpose_dot21(const float *m, const float *v, float *y, size_t height, size_t width);
+        // c[i, j] = a[i] * b[j] where c is row-major matrix (height, width)
+        void outer_product(const float *a, const float *b, float *c, size_t height, size_t width);
+        // y = exp(x - max(x)) / sum(exp(x - max(x))), y can be the same as x
+        void stable_softmax(const float *x, float *y, size_t size);
+        // w = w * decay - g * scale and g = 0 in one pass (gradient descent step)
+        void sgd_update(float *w, float *g, float decay, float scale, size_t size);
+        // v = momentum * v - g * scale, w = w * decay + v (or momentum * v - g * scale for nesterov)
+        // and g = 0 in one pass
+        void momentum_update(float *w, float *g, float *v, float decay, float scale,
+                             float momentum, bool nesterov, size_t size);
+
+        // coefficients of one Adam step with bias correction folded into step_size and epsilon
+        struct adam_coefficients_t {
+            float beta1;
+            float beta2;
+            // learning_rate * sqrt(1 - beta2^t) / (1 - beta1^t)
+            float step_size;
+            // epsilon * sqrt(1 - beta2^t)
+            float epsilon;
+            float gradient_scale;
+            // weight decay added to the gradient (Adam)
+            float l2;
+            // decoupled weight decay multiplier (AdamW)
+            float decay;
+        };
+
+        // g = g * gradient_scale + l2 * w, m = beta1 * m + (1 - beta1) * g, v = beta2 * v + (1 - beta2) * g^2,
+        // w = w * decay - step_size * m / (sqrt(v) + epsilon) and g = 0 in one pass
+        void adam_update(float *w, float *g, float *m, float *v, adam_coefficients_t const &c, size_t size);
+
+        // register block of gemm_micro_kernel(), gemm() packs A in slivers of gemm_mr rows
+        // stored column by column and B in slivers of gemm_nr columns stored row by row
+        const size_t gemm_mr = 6;
+        const size_t gemm_nr = 16;
+
+        // C[mr x nr] = alpha * A_sliver * B_sliver + beta * C for packed slivers of kc length
+        // partial blocks (mr <= gemm_mr, nr <= gemm_nr) are zero padded in the slivers
+        // beta == 0 means C is write-only (it can contain garbage)
+        void gemm_micro_kernel(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                               size_t mr, size_t nr, float alpha, float beta);
+
+        // fast approximations using range reduction and polynomials, y can be the same as x
+        // maximum errors against correctly rounded results, checked on all floats for all instruction sets:
+        // exp - 1 ULP for x in [-87.3, 88], input is clamped to this range
+        // sigmoid - 2 ULP for x in [-87, 87]
+        // tanh - 1 ULP
+        // softmax - exp with 1 ULP error, normalized same way as in stable_softmax()
+        void fast_exp(const float *x, float *y, size_t size);
+        void fast_sigmoid(const float *x, float *y, size_t size);
+        void fast_tanh(const float *x, float *y, size_t size);
+        void fast_softmax(const float *x, float *y, size_t size);
+    }
+}
+
+#endif // SIMD_H
@@ -0,0 +1,178 @@
+#include "thread_pool.h"
+
+namespace yannpp {
+    namespace {
+        // pool and queue of the current worker thread
+        thread_local thread_pool_t *current_pool = nullptr;
+        thread_local size_t current_worker = 0;
+
+        size_t hardware_threads() {
+            return std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+
+        // one parallel section submits at most 4 tasks per thread (see parallel_for())
+        // and queues grow only if many sections are nested
+        size_t queue_capacity(size_t threads_number) {
+            return 8 * threads_number;
+        }
+
+        std::unique_ptr<thread_pool_t> &default_pool_instance() {
+            // initialization of the local static is thread-safe
+            static std::unique_ptr<thread_pool_t> pool(new thread_pool_t(hardware_threads()));
+            return pool;
+        }
+    }
+
+    thread_pool_t::thread_pool_t(size_t threads_number):
+        pending_(0),
+        stop_(false)
+    {
+        assert(threads_number > 0);
+        for (size_t i = 0; i < threads_number; i++) {
+            queues_.emplace_back(new task_queue_t(queue_capacity(threads_number)));
+        }
+    }
+
+    void thread_pool_t::start_workers() {
+        const size_t threads_number = queues_.size();
+        workers_.reserve(threads_number - 1);
+        for (size_t i = 1; i < threads_number; i++) {
+            workers_.emplace_back(&thread_pool_t::worker_loop, this, i);
+        }
+    }
+
+    thread_pool_t::~thread_pool_t() {
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock_);
+            stop_ = true;
+        }
+        wakeup_.notify_all();
+
+        for (auto &w: workers_) { w.join(); }
+    }
+
+    void thread_pool_t::submit(task_t &&task, counter_t &counter) {
+        std::call_once(workers_started_, &thread_pool_t::start_workers, this);
+
+        // pending tasks are counted before they can be taken so the counter never wraps
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock_);
+            pending_++;
+        }
+
+        auto &q = *queues_[current_queue()];
+        {
+            std::lock_guard<std::mutex> guard(q.lock);
+            const size_t capacity = q.tasks.size();
+            if (q.size == capacity) {
+                // tasks are moved in order to the beginning of the bigger buffer
+                std::vector<entry_t> tasks(2 * capacity);
+                for (size_t i = 0; i < q.size; i++) { tasks[i] = std::move(q.tasks[(q.head + i) % capacity]); }
+                q.tasks.swap(tasks);
+                q.head = 0;
+            }
+            q.tasks[(q.head + q.size) % q.tasks.size()] = entry_t{std::move(task), &counter};
+            q.size++;
+        }
+        wakeup_.notify_one();
+    }
+
+    void thread_pool_t::wait(counter_t &counter) {
+        const size_t queue = current_queue();
+        while (counter.load() > 0) {
+            if (try_run_one(queue)) { continue; }
+
+            std::unique_lock<std::mutex> lock(sleep_lock_);
+            done_.wait(lock, [this, &counter]() { return (counter.load() == 0) || (pending_.load() > 0); });
+        }
+
+        if (counter.error_) { std::rethrow_exception(counter.error_); }
+    }
+
+    size_t thread_pool_t::current_queue() const {
+        return (current_pool == this) ? current_worker : 0;
+    }
+
+    bool thread_pool_t::try_pop(size_t queue, entry_t &entry) {
+        auto &q = *queues_[queue];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.size == 0) { return false; }
+        // owner takes the most recent task which is still hot in cache
+        entry = std::move(q.tasks[(q.head + q.size - 1) % q.tasks.size()]);
+        q.size--;
+        return true;
+    }
+
+    bool thread_pool_t::try_steal(size_t queue, entry_t &entry) {
+        auto &q = *queues_[queue];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.size == 0) { return false; }
+        // thieves take the oldest task from the other end
+        entry = std::move(q.tasks[q.head]);
+        q.head = (q.head + 1) % q.tasks.size();
+        q.size--;
+        return true;
+    }
+
+    bool thread_pool_t::try_run_one(size_t queue) {
+        if (pending_.load() == 0) { return false; }
+
+        entry_t entry{task_t(), nullptr};
+        bool found = try_pop(queue, entry);
+        const size_t queues_size = queues_.size();
+        for (size_t i = 1; !found && i < queues_size; i++) {
+            found = try_steal((queue + i) % queues_size, entry);
+        }
+
+        if (!found) { return false; }
+
+        pending_--;
+        run(entry);
+        return true;
+    }
+
+    void thread_pool_t::run(entry_t &entry) {
+        counter_t &counter = *entry.counter;
+        // counter is decremented even if the task throws, the exception is kept
+        // for wait() so it does not leave worker threads or the section too early
+        try {
+            entry.task();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(counter.error_lock_);
+            if (!counter.error_) { counter.error_ = std::current_exception(); }
+        }
+
+        if (counter.count_.fetch_sub(1) == 1) {
+            // waiter checks the counter under this lock so the notification is not lost
+            std::lock_guard<std::mutex> guard(sleep_lock_);
+            done_.notify_all();
+        }
+    }
+
+    void thread_pool_t::worker_loop(size_t queue) {
+        current_pool = this;
+        current_worker = queue;
+
+        while (true) {
+            if (try_run_one(queue)) { continue; }
+
+            std::unique_lock<std::mutex> lock(sleep_lock_);
+            wakeup_.wait(lock, [this]() { return stop_ || (pending_.load() > 0); });
+            if (stop_) { break; }
+        }
+    }
+
+    thread_pool_t &default_thread_pool() {
+        return *default_pool_instance();
+    }
+
+    size_t threads_number() {
+        return default_thread_pool().threads_number();
+    }
+
+    void set_threads_number(size_t threads_number) {
+        auto &pool = default_pool_instance();
+        pool.reset();
+        pool.reset(new thread_pool_t(std::max<size_t>(1, threads_number)));
+    }
+}
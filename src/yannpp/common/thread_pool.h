@@ -0,0 +1,170 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <yannpp/common/shape.h>
+
+namespace yannpp {
+    // pool of threads where each worker has its own queue of tasks
+    // idle workers steal tasks from the queues of other workers
+    class thread_pool_t {
+    public:
+        using task_t = std::function<void()>;
+
+        // number of not finished tasks of one parallel section
+        // and the first exception thrown by them (rethrown by wait())
+        class counter_t {
+        public:
+            explicit counter_t(size_t count): count_(count) {}
+            size_t load() const { return count_.load(); }
+
+        private:
+            friend class thread_pool_t;
+            std::atomic<size_t> count_;
+            std::mutex error_lock_;
+            std::exception_ptr error_;
+        };
+
+    public:
+        // threads number includes the calling thread so 1 means no workers
+        // workers are started by the first submit() so idle pools cost no threads
+        explicit thread_pool_t(size_t threads_number);
+        ~thread_pool_t();
+
+        thread_pool_t(thread_pool_t const &) = delete;
+        thread_pool_t &operator=(thread_pool_t const &) = delete;
+
+    public:
+        size_t threads_number() const { return queues_.size(); }
+        // schedules task which decrements counter after completion
+        void submit(task_t &&task, counter_t &counter);
+        // runs pending tasks in the calling thread until counter drops to zero
+        // so nested parallel sections cannot deadlock, sleeps when nothing can be stolen
+        // rethrows the first exception of the tasks after all of them are finished
+        void wait(counter_t &counter);
+
+    private:
+        struct entry_t {
+            task_t task;
+            counter_t *counter;
+        };
+
+        // ring buffer which only grows so the steady state does not allocate
+        // owner works with the back and thieves take tasks from the front
+        struct task_queue_t {
+            explicit task_queue_t(size_t capacity): tasks(capacity), head(0), size(0) {}
+
+            std::mutex lock;
+            std::vector<entry_t> tasks;
+            size_t head;
+            size_t size;
+        };
+
+        void start_workers();
+        size_t current_queue() const;
+        bool try_pop(size_t queue, entry_t &entry);
+        bool try_steal(size_t queue, entry_t &entry);
+        bool try_run_one(size_t queue);
+        void run(entry_t &entry);
+        void worker_loop(size_t queue);
+
+    private:
+        // queue 0 is shared by threads outside of the pool
+        // and queue i belongs to the worker i
+        std::vector<std::unique_ptr<task_queue_t>> queues_;
+        std::vector<std::thread> workers_;
+        std::once_flag workers_started_;
+        std::atomic<size_t> pending_;
+        std::mutex sleep_lock_;
+        // workers wait for new tasks and waiters also for their tasks to finish
+        std::condition_variable wakeup_;
+        std::condition_variable done_;
+        bool stop_;
+    };
+
+    // pool used by the library, created with hardware concurrency on the first use
+    // and its threads are started only when some parallel section is big enough
+    thread_pool_t &default_thread_pool();
+    size_t threads_number();
+    // recreates default pool with the given number of threads (1 disables threading)
+    // not thread-safe, meant to be called before any computations
+    void set_threads_number(size_t threads_number);
+
+    // approximate number of multiply-adds worth running as a separate task
+    const size_t parallel_grain_work = 1 << 15;
+
+    // number of loop iterations each doing work_per_item operations to form one task
+    inline size_t grain_size(size_t work_per_item) {
+        return std::max<size_t>(1, parallel_grain_work / std::max<size_t>(1, work_per_item));
+    }
+
+    // calls f(chunk_begin, chunk_end) for chunks of [begin, end) in parallel
+    // ranges not bigger than grain run in the calling thread without synchronization
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F const &f) {
+        assert(grain > 0);
+        if (end <= begin) { return; }
+
+        const size_t size = end - begin;
+        if (size <= grain) { f(begin, end); return; }
+
+        thread_pool_t &pool = default_thread_pool();
+        const size_t threads = pool.threads_number();
+        if (threads == 1) { f(begin, end); return; }
+
+        // few chunks per thread so stealing can balance uneven work
+        const size_t chunks = std::min((size + grain - 1) / grain, threads * 4);
+        thread_pool_t::counter_t counter(chunks - 1);
+        // tasks capture only the section and the chunk number so they
+        // fit into the small buffer of std::function and do not allocate
+        struct section_t {
+            F const &f;
+            size_t begin, size, chunks;
+        } section{f, begin, size, chunks};
+        for (size_t c = 1; c < chunks; c++) {
+            pool.submit([&section, c]() {
+                section.f(section.begin + c * section.size / section.chunks,
+                          section.begin + (c + 1) * section.size / section.chunks);
+            }, counter);
+        }
+
+        // tasks reference f and the counter so they must finish before leaving
+        std::exception_ptr error;
+        try {
+            f(begin, begin + size / chunks);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        pool.wait(counter);
+        if (error) { std::rethrow_exception(error); }
+    }
+
+    // calls f(x, y, z) for each index of the shape in parallel
+    // grain is the minimal number of indices in one task
+    template<typename F>
+    void parallel_for(shape3d_t const &shape, size_t grain, F const &f) {
+        const size_t size_y = shape.y(), size_z = shape.z();
+        parallel_for(0, shape.capacity(), grain, [&](size_t begin, size_t end) {
+            int x = begin / (size_y * size_z), y = (begin / size_z) % size_y, z = begin % size_z;
+            for (size_t i = begin; i < end; i++) {
+                f(x, y, z);
+                if (++z == (int)size_z) {
+                    z = 0;
+                    if (++y == (int)size_y) { y = 0; x++; }
+                }
+            }
+        });
+    }
+}
+
+#endif // THREAD_POOL_H
@@ -4,12 +4,17 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
-#include <deque>
+#include <memory>
 #include <vector>
 
+#include <yannpp/common/allocator.h>
+#include <yannpp/common/arena.h>
 #include <yannpp/common/array3d.h>
 #include <yannpp/common/array3d_math.h>
+#include <yannpp/common/array3d_view.h>
+#include <yannpp/common/array4d.h>
 #include <yannpp/common/shape.h>
+#include <yannpp/common/thread_pool.h>
 #include <yannpp/common/utils.h>
 #include <yannpp/layers/layer_base.h>
 #include <yannpp/layers/layer_metadata.h>
@@ -27,7 +32,7 @@ namespace yannpp {
     template<typename T>
     array3d_t<T> unvectorize(std::vector<array3d_t<T>> const &vectorized) {
         const size_t size = vectorized.size();
-        std::vector<T> result;
+        aligned_vector_t<T> result;
         result.reserve(size);
         for (size_t i = 0; i < size; i++) {
             result.insert(result.end(), vectorized[i].data().begin(), vectorized[i].data().end());
@@ -54,7 +59,8 @@ namespace yannpp {
                         filters_number),
             stride_(stride_length, stride_length, 0),
             padding_(padding),
-            activator_(activator)
+            activator_(activator),
+            input_(nullptr)
         {
             assert(filter_shape.z() == input_shape.z());
         }
@@ -87,16 +93,19 @@ namespace yannpp {
                     nabla_biases_.emplace_back(shape_row(1), T(0));
                 }
             }
+
+            place_nabla_weights();
+            this->parameters_replaced();
         }
 
         virtual void optimize(optimizer_t<T> const &strategy) override {
             const size_t filters_size = filter_weights_.size();
             for (size_t i = 0; i < filters_size; i++) {
-                strategy.update_weights(filter_weights_[i], nabla_weights_[i]);
-                strategy.update_bias(filter_biases_[i], nabla_biases_[i]);
-                nabla_weights_[i].reset(0);
-                nabla_biases_[i].reset(0);
+                // same order as in parameters()
+                strategy.update_weights(filter_weights_[i], nabla_weights_[i], this->optimizer_state(i));
+                strategy.update_bias(filter_biases_[i], nabla_biases_[i], this->optimizer_state(filters_size + i));
             }
+            this->parameters_changed();
         }
 
         virtual void load(std::vector<array3d_t<T>> &&weights, std::vector<array3d_t<T>> &&biases) override {
@@ -111,6 +120,17 @@ namespace yannpp {
 
             filter_weights_ = std::move(weights);
             filter_biases_ = std::move(biases);
+            this->parameters_replaced();
+        }
+
+        // weights of all filters and then all biases, so flat storage of the network
+        // keeps nabla weights as one matrix (see nabla_weights_matrix())
+        virtual std::vector<parameter_t<T>> parameters() override {
+            std::vector<parameter_t<T>> result;
+            const size_t filters_size = filter_weights_.size();
+            for (size_t i = 0; i < filters_size; i++) { result.push_back({&filter_weights_[i], &nabla_weights_[i]}); }
+            for (size_t i = 0; i < filters_size; i++) { result.push_back({&filter_biases_[i], &nabla_biases_[i]}); }
+            return result;
         }
 
         shape3d_t get_output_shape() const {
@@ -121,7 +141,39 @@ namespace yannpp {
             return shape3d_t((int)width, (int)height, /*filters_number*/conv_shape_.z());
         }
 
+        // input shape is fixed at construction
+        virtual shape3d_t get_output_shape(shape3d_t const &input_shape) const override {
+            assert(input_shape == input_shape_);
+            (void)input_shape;
+            return get_output_shape();
+        }
+
     protected:
+        // moves nabla weights to own flat arena as rows of nabla_weights_matrix()
+        // done in init() and clone() only, never during backpropagation
+        void place_nabla_weights() {
+            auto arena = std::make_shared<flat_arena_t>(nabla_weights_.size() * nabla_weights_stride() * sizeof(T));
+            for (auto &nabla_w: nabla_weights_) { move_to_arena(nabla_w, arena); }
+        }
+
+        // nabla weights of all filters as rows of [filters_number, nabla_weights_stride()] matrix
+        // so gradients of the whole batch are accumulated by one gemm() right into them
+        // nullptr when arrays were placed differently since then (e.g. by the caller)
+        T *nabla_weights_matrix() {
+            const size_t filters_size = nabla_weights_.size();
+            const size_t stride = nabla_weights_stride();
+            T *data = nabla_weights_[0].data().data();
+            for (size_t f = 1; f < filters_size; f++) {
+                if (nabla_weights_[f].data().data() != data + f * stride) { return nullptr; }
+            }
+            return data;
+        }
+
+        // distance between rows of nabla_weights_matrix() including the alignment padding
+        size_t nabla_weights_stride() const {
+            return flat_arena_t::footprint(filter_shape_.capacity() * sizeof(T)) / sizeof(T);
+        }
+
         int get_top_padding() const {
             if (padding_ == padding_type::valid) { return 0; }
             return utils::get_top_padding(input_shape_, filter_shape_, stride_.y());
@@ -143,7 +195,10 @@ namespace yannpp {
         std::vector<array3d_t<T>> filter_weights_;
         std::vector<array3d_t<T>> filter_biases_;
         // calculation support
-        array3d_t<T> input_, output_;
+        // input of the last feedforward, owned only when it was moved in
+        array4d_t<T> const *input_;
+        array4d_t<T> input_storage_;
+        array4d_t<T> output_;
         std::vector<array3d_t<T>> nabla_weights_;
         std::vector<array3d_t<T>> nabla_biases_;
     };
@@ -153,100 +208,260 @@ namespace yannpp {
     public:
         // use same constructor
         using convolution_layer_base_t<T>::convolution_layer_base_t;
+        using layer_base_t<T>::feedforward;
+        using layer_base_t<T>::backpropagate;
 
     public:
-        virtual array3d_t<T> feedforward(array3d_t<T> &&input) override {
+        virtual std::shared_ptr<layer_base_t<T>> clone() const override {
+            return std::make_shared<convolution_layer_loop_t<T>>(*this);
+        }
+
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) override {
+            // input is kept for backpropagation without copying
+            this->input_storage_ = std::move(input);
+            array4d_t<T> output;
+            feedforward_into(this->input_storage_, output);
+            return output;
+        }
+
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &output) override {
+            if (this->is_inference()) {
+                // nothing is kept, z is computed in the output and activated in place
+                // caches are not written but keep their memory for the next training step
+                convolve(input, output);
+                this->activator_.activate_inplace(output);
+                return;
+            }
+
+            // input is read again in backpropagation, z is kept for the derivative
+            this->input_ = &input;
+            convolve(input, this->output_);
+            this->activator_.activate(this->output_, output);
+        }
+
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&error) override {
+            array4d_t<T> delta = std::move(error), delta_next;
+            backpropagate_into(delta, delta_next);
+            return delta_next;
+        }
+
+        virtual void backpropagate_into(array4d_t<T> &error, array4d_t<T> &delta_next) override {
+            // error shape was already transformed in the prev layer as delta(l+1)(*)rot180(w(l+1))
+            assert(error.shape() == this->output_.shape());
+            // gradients with regards to input of this layer
+            array4d_t<T> &delta = error; this->activator_.derivative_mul(this->output_, delta);
+
+            const size_t batch = delta.batch();
+            delta_next.resize(batch, this->input_shape_);
+            delta_next.reset(T(0));
+
+            for (size_t b = 0; b < batch; b++) {
+                accumulate_nablas(this->input_->view(b), delta.view(b));
+                propagate_error(delta.view(b), delta_next.view(b));
+            }
+        }
+
+    private:
+        // z = input (*) filters + biases, z is resized to the output of the batch
+        // samples of the batch are convolved independently
+        void convolve(array4d_t<T> const &input, array4d_t<T> &z) {
             assert(input.shape() == this->input_shape_);
+            const size_t batch = input.batch();
+            z.resize(batch, this->get_output_shape());
+            for (size_t b = 0; b < batch; b++) {
+                convolve(input.view(b), z.view(b));
+            }
+        }
 
-            this->input_ = std::move(input);
-            const shape3d_t output_shape = this->get_output_shape();
-            array3d_t<T> result(output_shape, 0);
+        // register blocks: filters x output pixels in the forward pass,
+        // filters x channels for the weights gradient and channels for the error
+        static const int filters_block = 4;
+        static const int pixels_block = 4;
+        static const int channels_block = 8;
+
+        void convolve(array3d_view_t<const T> const &input, array3d_view_t<T> const &result) {
+            auto &output_shape = result.shape();
+            auto &input_shape = input.shape();
+            auto &filter_shape = this->filter_shape_;
+            auto &stride = this->stride_;
 
             const int pad_x = this->get_left_padding();
             const int pad_y = this->get_top_padding();
+            // range of output columns with the whole window inside of the input
+            // so blocks can skip bounds checks, padding is handled by window_dot()
+            const int y_inner_begin = (pad_y + stride.y() - 1) / stride.y();
+            const int y_inner_end = std::min(output_shape.y(),
+                                             (input_shape.y() - filter_shape.y() + pad_y) / stride.y() + 1);
 
             const int fsize = this->filter_weights_.size();
-            auto &filter_shape = this->filter_shape_;
-            auto &input_shape = this->input_.shape();
-            // perform convolution for each filter
-            for (int fi = 0; fi < fsize; fi++) {
-                auto filter = this->filter_weights_[fi].slice();
-                auto &bias = this->filter_biases_[fi](0);
-                // 2D loop over the input and calculation convolution of input and current filter
-                // convolution is S(i, j) = (I ∗ K)(i, j) = Sum[ I(m, n)K(i − m, j − n) ]
-                // which is commutative i.e. (I ∗ K)(i, j) = Sum[ I(i - m, j - n)K(m, n) ]
-                // where I is input and K is kernel (filter weights)
-                for (int y = 0; y < output_shape.y(); y++) {
-                    int ys = y * this->stride_.y() - pad_y;
+            const int fblocks = (fsize + filters_block - 1) / filters_block;
+            const size_t block_work = output_shape.x() * output_shape.y() * filter_shape.capacity() * filters_block;
+            // perform convolution for each block of filters, filters are independent
+            parallel_for(0, fblocks, grain_size(block_work), [&](size_t b_begin, size_t b_end) {
+                for (int fb = b_begin; fb < (int)b_end; fb++) {
+                    const int f_begin = fb * filters_block;
+                    const int f_end = std::min(fsize, f_begin + filters_block);
+                    const bool full_block = (f_end - f_begin == filters_block);
 
                     for (int x = 0; x < output_shape.x(); x++) {
-                        int xs = x * this->stride_.x() - pad_x;
-                        // in this case cross-correlation (I(m, n)K(i + m, j + n)) is used
-                        // (kernel is not rot180() flipped for the convolution, not commutative)
-                        // previous formula (w*x + b) is used with convolution instead of product
-                        result(x, y, fi) =
-                                bias +
-                                dot<T>(
-                                    this->input_.slice(
-                                        index3d_t(xs, ys, 0),
-                                        index3d_t(xs + filter_shape.x() - 1,
-                                                  ys + filter_shape.y() - 1,
-                                                  input_shape.z() - 1)),
-                                    filter);
+                        int xs = x * stride.x() - pad_x;
+                        const bool x_inside = (xs >= 0) && (xs + filter_shape.x() <= input_shape.x());
+
+                        for (int y = 0; y < output_shape.y();) {
+                            int ys = y * stride.y() - pad_y;
+
+                            if (full_block && x_inside && (y >= y_inner_begin) && (y + pixels_block <= y_inner_end)) {
+                                convolve_block<filters_block, pixels_block>(input, xs, ys, f_begin, result, x, y);
+                                y += pixels_block;
+                                continue;
+                            }
+
+                            // in this case cross-correlation (I(m, n)K(i + m, j + n)) is used
+                            // (kernel is not rot180() flipped for the convolution, not commutative)
+                            // previous formula (w*x + b) is used with convolution instead of product
+                            for (int fi = f_begin; fi < f_end; fi++) {
+                                array3d_view_t<const T> filter = this->filter_weights_[fi].view();
+                                result(x, y, fi) = this->filter_biases_[fi](0) +
+                                        window_dot<T>(input, index3d_t(xs, ys, 0), filter);
+                            }
+                            y++;
+                        }
+                    }
+                }
+            });
+        }
+
+        // FB filters at PX consecutive output pixels (y, y+1, ...) in registers
+        // windows are inside of the input and taps are summed in the same (x, y, z) order as window_dot()
+        template<int FB, int PX>
+        void convolve_block(array3d_view_t<const T> const &input, int xs, int ys, int f_begin,
+                            array3d_view_t<T> const &result, int x, int y) {
+            auto &filter_shape = this->filter_shape_;
+            const int channels = filter_shape.z();
+            const int stride_y = this->stride_.y();
+            assert(input.strides().z() == 1);
+
+            T acc[FB][PX];
+            for (int f = 0; f < FB; f++) {
+                for (int p = 0; p < PX; p++) { acc[f][p] = 0; }
+            }
+
+            for (int fx = 0; fx < filter_shape.x(); fx++) {
+                for (int fy = 0; fy < filter_shape.y(); fy++) {
+                    const T *in[PX];
+                    for (int p = 0; p < PX; p++) { in[p] = input.ptr(xs + fx, ys + p*stride_y + fy, 0); }
+                    const T *w[FB];
+                    for (int f = 0; f < FB; f++) { w[f] = &this->filter_weights_[f_begin + f](fx, fy, 0); }
+
+                    for (int z = 0; z < channels; z++) {
+                        for (int f = 0; f < FB; f++) {
+                            const T wv = w[f][z];
+                            for (int p = 0; p < PX; p++) { acc[f][p] += in[p][z] * wv; }
+                        }
                     }
                 }
             }
 
-            this->output_ = std::move(result);
-            return this->activator_.activate(this->output_);
+            for (int f = 0; f < FB; f++) {
+                const T bias = this->filter_biases_[f_begin + f](0);
+                for (int p = 0; p < PX; p++) { result(x, y + p, f_begin + f) = bias + acc[f][p]; }
+            }
         }
 
-        virtual array3d_t<T> backpropagate(array3d_t<T> &&error) override {
-            // error shape was already transformed in the prev layer as delta(l+1)(*)rot180(w(l+1))
-            assert(error.shape() == this->output_.shape());
-            auto &error_shape = error.shape();
-            // gradients with regards to input of this layer
-            array3d_t<T> delta;
-            delta = this->activator_.derivative(this->output_); delta.element_mul(error);
+        void accumulate_nablas(array3d_view_t<const T> const &input, array3d_view_t<const T> const &delta) {
+            auto &error_shape = delta.shape();
 
             const int pad_x = this->get_left_padding();
             const int pad_y = this->get_top_padding();
 
-            const size_t fsize = this->filter_weights_.size();
+            const int fsize = this->filter_weights_.size();
             auto &filter_shape = this->filter_shape_, &input_shape = this->input_shape_;
             auto &stride = this->stride_;
-            // calculate nabla_w for each filter
-            for (int fi = 0; fi < fsize; fi++) {
-                auto &nabla_w = this->nabla_weights_[fi];
-                auto &nabla_b = this->nabla_biases_[fi](0);
-                auto delta_fi = delta.slice(dim_type::Z, fi, fi);
-                // dC/db = delta(l)
-                nabla_b += delta_fi.sum();
+            const int fblocks = (fsize + filters_block - 1) / filters_block;
+            const size_t block_work = error_shape.x() * error_shape.y() * filter_shape.capacity() * filters_block;
+            // calculate nabla_w for each block of filters, filters are independent
+            parallel_for(0, fblocks, grain_size(block_work), [&](size_t b_begin, size_t b_end) {
+                for (int fb = b_begin; fb < (int)b_end; fb++) {
+                    const int f_begin = fb * filters_block;
+                    const int f_end = std::min(fsize, f_begin + filters_block);
+
+                    // dC/db = delta(l)
+                    for (int fi = f_begin; fi < f_end; fi++) {
+                        T delta_sum = 0;
+                        for (int x = 0; x < error_shape.x(); x++) {
+                            for (int y = 0; y < error_shape.y(); y++) {
+                                delta_sum += delta(x, y, fi);
+                            }
+                        }
+                        this->nabla_biases_[fi](0) += delta_sum;
+                    }
 
-                for (int z = 0; z < input_shape.z(); z++) {
                     // convolution of input and filter gives us output (same as error size)
                     // and convolution of input and error gives us filter size
                     for (int y = 0; y < filter_shape.y(); y++) {
                         int ys = y * stride.y() - pad_y;
+                        // part of the error window inside of the input is the same for all channels
+                        const int j0 = std::max(0, -ys), j1 = std::min(error_shape.y(), input_shape.y() - ys);
 
                         for (int x = 0; x < filter_shape.x(); x++) {
                             int xs = x * stride.x() - pad_x;
-
-                            // dC/dw = a(l-1) (x) delta(l)
-                            nabla_w(x, y, z) +=
-                                    dot<T>(
-                                        this->input_.slice(
-                                            index3d_t(xs, ys, z),
-                                            index3d_t(xs + error_shape.x() - 1,
-                                                      ys + error_shape.y() - 1,
-                                                      z)),
-                                        delta_fi);
+                            const int i0 = std::max(0, -xs), i1 = std::min(error_shape.x(), input_shape.x() - xs);
+                            if ((i0 >= i1) || (j0 >= j1)) { continue; }
+
+                            int z = 0;
+                            if (f_end - f_begin == filters_block) {
+                                for (; z + channels_block <= input_shape.z(); z += channels_block) {
+                                    nabla_block<filters_block, channels_block>(input, delta, xs, ys, i0, i1, j0, j1,
+                                                                               f_begin, x, y, z);
+                                }
+                            }
+                            // remaining channels and filters
+                            for (int fi = f_begin; fi < f_end; fi++) {
+                                const int z_begin = (f_end - f_begin == filters_block) ? z : 0;
+                                for (int zi = z_begin; zi < input_shape.z(); zi++) {
+                                    nabla_block<1, 1>(input, delta, xs, ys, i0, i1, j0, j1, fi, x, y, zi);
+                                }
+                            }
                         }
                     }
                 }
+            });
+        }
+
+        // dC/dw = a(l-1) (x) delta(l) for FB filters and CB channels at the filter tap (x, y)
+        // error positions are summed in the same order as window_dot()
+        template<int FB, int CB>
+        void nabla_block(array3d_view_t<const T> const &input, array3d_view_t<const T> const &delta,
+                         int xs, int ys, int i0, int i1, int j0, int j1,
+                         int f_begin, int x, int y, int z) {
+            assert(input.strides().z() == 1 && delta.strides().z() == 1);
+            T acc[FB][CB];
+            for (int f = 0; f < FB; f++) {
+                for (int c = 0; c < CB; c++) { acc[f][c] = 0; }
             }
 
-            array3d_t<T> delta_next(this->input_shape_, T(0));
+            for (int i = i0; i < i1; i++) {
+                for (int j = j0; j < j1; j++) {
+                    const T *in = input.ptr(xs + i, ys + j, z);
+                    const T *d = delta.ptr(i, j, f_begin);
+                    for (int f = 0; f < FB; f++) {
+                        const T dv = d[f];
+                        for (int c = 0; c < CB; c++) { acc[f][c] += in[c] * dv; }
+                    }
+                }
+            }
+
+            for (int f = 0; f < FB; f++) {
+                auto nabla_w = this->nabla_weights_[f_begin + f].view();
+                for (int c = 0; c < CB; c++) { nabla_w(x, y, z + c) += acc[f][c]; }
+            }
+        }
+
+        void propagate_error(array3d_view_t<const T> const &delta, array3d_view_t<T> const &delta_next) {
+            auto &error_shape = delta.shape();
+            const size_t fsize = this->filter_weights_.size();
+            auto &filter_shape = this->filter_shape_, &input_shape = this->input_shape_;
+            auto &stride = this->stride_;
 
             // use 'full' convolution (http://www.johnloomis.org/ece563/notes/filter/conv/convolution.html)
             // so we need to set appropriate padding
@@ -256,33 +471,58 @@ namespace yannpp {
             // input gradient of next layer is scaled by weights gradient of this layer
             // gradient for the next layer is delta(l) (*) rot180(w(l))
             // so for delta we apply "full" convolution with filter
-            for (size_t fi = 0; fi < fsize; fi++) {
-                // each output layer was created using full input (*) filter
-                // so each delta (output error) layer will influence errors of whole input as well
-                for (int z = 0; z < input_shape.z(); z++) {
-                    auto filter = this->filter_weights_[fi].slice(dim_type::Z, z, z);
+            // input channels are independent so they are split between threads
+            // while filters are summed in the same order for each channel
+            const size_t channel_work = input_shape.x() * input_shape.y() * filter_shape.x() * filter_shape.y() * fsize;
+            parallel_for(0, input_shape.z(), grain_size(channel_work), [&](size_t z_begin, size_t z_end) {
+                // result of the convolution of delta and filter will be input size
+                for (int x = 0; x < input_shape.x(); x++) {
+                    int xs = x*stride.x() - weight_pad_x;
+                    // part of the filter window inside of the delta is the same for all channels
+                    const int i0 = std::max(0, -xs), i1 = std::min(filter_shape.x(), error_shape.x() - xs);
 
-                    // result of the convolution of delta and filter will be input size
                     for (int y = 0; y < input_shape.y(); y++) {
                         int ys = y*stride.y() - weight_pad_y;
+                        const int j0 = std::max(0, -ys), j1 = std::min(filter_shape.y(), error_shape.y() - ys);
+                        if ((i0 >= i1) || (j0 >= j1)) { continue; }
 
-                        for (int x = 0; x < input_shape.x(); x++) {
-                            int xs = x*stride.x() - weight_pad_x;
-
-                            delta_next(x, y, z) +=
-                                    dot<T>(
-                                        delta.slice(
-                                            index3d_t(xs, ys, fi),
-                                            index3d_t(xs + filter_shape.x() - 1,
-                                                      ys + filter_shape.y() - 1,
-                                                      fi)),
-                                        filter);
+                        int z = z_begin;
+                        for (; z + channels_block <= (int)z_end; z += channels_block) {
+                            error_block<channels_block>(delta, delta_next, xs, ys, i0, i1, j0, j1, x, y, z);
+                        }
+                        for (; z < (int)z_end; z++) {
+                            error_block<1>(delta, delta_next, xs, ys, i0, i1, j0, j1, x, y, z);
                         }
                     }
                 }
-            }
+            });
+        }
 
-            return delta_next;
+        // error of CB channels at input pixel (x, y), each output layer was created using
+        // full input (*) filter so each delta (output error) layer influences errors of whole input
+        // filters are added one by one as with window_dot() of each filter
+        template<int CB>
+        void error_block(array3d_view_t<const T> const &delta, array3d_view_t<T> const &delta_next,
+                         int xs, int ys, int i0, int i1, int j0, int j1, int x, int y, int z) {
+            const size_t fsize = this->filter_weights_.size();
+            T *out = delta_next.ptr(x, y, z);
+            assert(delta_next.strides().z() == 1);
+
+            for (size_t fi = 0; fi < fsize; fi++) {
+                auto &filter = this->filter_weights_[fi];
+                T acc[CB];
+                for (int c = 0; c < CB; c++) { acc[c] = 0; }
+
+                for (int i = i0; i < i1; i++) {
+                    for (int j = j0; j < j1; j++) {
+                        const T dv = delta(xs + i, ys + j, fi);
+                        const T *w = &filter(i, j, z);
+                        for (int c = 0; c < CB; c++) { acc[c] += dv * w[c]; }
+                    }
+                }
+
+                for (int c = 0; c < CB; c++) { out[c] += acc[c]; }
+            }
         }
     };
 
@@ -291,248 +531,280 @@ namespace yannpp {
     public:
         // use same constructor
         using convolution_layer_base_t<T>::convolution_layer_base_t;
+        using layer_base_t<T>::feedforward;
+        using layer_base_t<T>::backpropagate;
 
     public:
-        virtual array3d_t<T> feedforward(array3d_t<T> &&input) override {
-            assert(input.shape() == this->input_shape_);
-            this->input_ = std::move(input);
-            // Extracts image patches from the input to form a
-            //  [out_height * out_width, filter_height * filter_width * in_channels]
-            this->input_patches_ = input_patches();
-            auto &patches = this->input_patches_;
-            // flattens filters to 2d matrix of size [filters_number, filter_height * filter_width * in_channels]
-            auto filters = flat_filters();
-            // convert biases to 1 array of size [filters_number]
-            auto biases = flat_biases();
+        virtual std::shared_ptr<layer_base_t<T>> clone() const override {
+            // copies of the arrays are allocated separately
+            auto copy = std::make_shared<convolution_layer_2d_t<T>>(*this);
+            copy->place_nabla_weights();
+            return copy;
+        }
 
-            const shape3d_t output_shape = this->get_output_shape();
-            std::vector<T> result;
-            result.reserve(output_shape.capacity());
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) override {
+            // backpropagation reads only the input patches so input is not kept
+            array4d_t<T> output;
+            feedforward_into(input, output);
+            return output;
+        }
 
-            // number of patches is [out_height * out_width]
-            const size_t patches_size = patches.size();
-            for (size_t i = 0; i < patches_size; i++) {
-                // result has size of [filters_number]
-                auto conv = dot21(filters, patches[i]);
-                assert(conv.shape() == shape3d_t(output_shape.z(), 1, 1));
-                conv.add(biases);
-                result.insert(result.end(), conv.data().begin(), conv.data().end());
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &output) override {
+            if (this->is_inference()) {
+                // nothing is kept, z is computed in the output and activated in place
+                // caches are not written but keep their memory for the next training step
+                convolve(input, output);
+                this->activator_.activate_inplace(output);
+                return;
             }
 
-            this->output_ = array3d_t<T>(output_shape, std::move(result));
-            return this->activator_.activate(this->output_);
+            // backpropagation reads only the input patches, z is kept for the derivative
+            convolve(input, this->output_);
+            this->activator_.activate(this->output_, output);
         }
 
-        virtual array3d_t<T> backpropagate(array3d_t<T> &&error) override {
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&error) override {
             // error shape was already transformed in the prev layer as delta(l+1)(*)rot180(w(l+1))
+            assert(error.shape() == this->output_.shape());
+            array4d_t<T> delta = std::move(error), delta_next;
+            backpropagate_into(delta, delta_next);
+            return delta_next;
+        }
+
+        virtual void backpropagate_into(array4d_t<T> &error, array4d_t<T> &delta_next) override {
             assert(error.shape() == this->output_.shape());
             // gradients with regards to input of this layer
-            array3d_t<T> delta;
-            delta = this->activator_.derivative(this->output_); delta.element_mul(error);
-
-            /*
-             * transposed input patches are of size
-             * [filter_height * filter_width * filter_channels, out_width * out_height]
-             * so if we convolve them with deltas of size [filters_count, out_width * out_height]
-             * result will be of [filter_width * filter_height * filter_channels, filters_count]
-             */
-            auto input_patches = input_patches_transpose();
-            // reshape [out_height, out_width, filters_count] errors into
-            // [filters_count, output_height * output_width] array
-            auto deltas = reshape_deltas(delta);
-
-            const size_t deltas_size = deltas.size();
-            assert(deltas_size == this->nabla_weights_.size());
-            const size_t patches_size = input_patches.size();
-            // this is a workaround for the fact that array3d cannot be used
-            // for dot product of 4d arrays
-            // so do dot products of each row separately
-            for (size_t d = 0; d < deltas_size; d++) {
-                std::vector<T> nabla_w;
-                nabla_w.reserve(this->filter_shape_.capacity());
-                for (size_t p = 0; p < patches_size; p++) {
-                    nabla_w.push_back(inner_product(deltas[d], input_patches[p]));
-                }
-                this->nabla_weights_[d].add(array3d_t<T>(this->filter_shape_, std::move(nabla_w)));
-                this->nabla_biases_[d](0) += deltas[d].sum();
-            }
+            array4d_t<T> &delta = error; this->activator_.derivative_mul(this->output_, delta);
 
-            // precreate placeholders for sum
-            std::vector<array3d_t<T>> delta_input_channel;
-            for (size_t z = 0; z < this->input_shape_.z(); z++) {
-                delta_input_channel.emplace_back(
-                            array3d_t<T>(
-                                shape3d_t(this->input_shape_.x() * this->input_shape_.y(), 1, 1), T(0)));
-            }
-            // extract patches for convolution from each layer of deltas (# of layers == # of filters)
-            // returns array [filters_count, input_width * input_height, filter_width * filter_height] of deltas
-            auto dpatches = delta_patches(delta);
-            shape3d_t filter_slice_shape(this->filter_shape_.x()*this->filter_shape_.y(), 1, 1);
-            for (size_t d = 0; d < deltas_size; d++) {
-                // delta patch has size [input_width * input_height, filter_width * filter_height]
-                auto &delta_patch = dpatches[d];
-
-                // each output layer was created using full input (*) filter
-                // so each delta (output error) layer will influence errors of whole input as well
-                for (size_t z = 0; z < this->input_shape_.z(); z++) {
-                    auto filter_z = this->filter_weights_[d].extract(
-                                        index3d_t(0, 0, z),
-                                        index3d_t(this->filter_shape_.x() - 1,
-                                                  this->filter_shape_.y() - 1,
-                                                  z));
-                    // result of size [input_width * input_height] - errors scaled by weights
-                    auto delta_z = dot21(delta_patch,
-                                         array3d_t<T>(filter_slice_shape, std::move(filter_z)));
-                    delta_input_channel[z].add(delta_z);
-                }
-            }
+            accumulate_nablas(delta);
+            propagate_error(delta, delta_next);
+        }
 
-            array3d_t<T> delta_next(this->input_shape_, T(0));
-            // just transpose errors of size [channels, input_height * input_width]
-            // to proper 3d array [input_height, input_width, channels]
-            for (size_t x = 0; x < this->input_shape_.x(); x++) {
-                for (size_t y = 0; y < this->input_shape_.y(); y++) {
-                    for (size_t z = 0; z < this->input_shape_.z(); z++) {
-                        delta_next(x, y, z) = delta_input_channel[z](y*this->input_shape_.x() + x);
-                    }
+    private:
+        void accumulate_nablas(array4d_t<T> const &delta) {
+            const size_t filters_count = delta.shape().z();
+            const size_t filter_flat_size = this->filter_shape_.capacity();
+            const size_t rows = this->input_patches_.shape().x();
+            assert(filters_count == this->nabla_weights_.size());
+            assert(rows == delta.batch() * delta.shape().x() * delta.shape().y());
+
+            // deltas [batch * out_height * out_width, filters_count] transposed times input patches
+            // [batch * out_height * out_width, filter_height * filter_width * in_channels]
+            // give [filters_count, filter_height * filter_width * in_channels] which rows are flat filters
+            arena_scope_t scope;
+            T *nabla_weights = this->nabla_weights_matrix();
+            if (nabla_weights != nullptr) {
+                gemm(true, false,
+                     filters_count, filter_flat_size, rows,
+                     T(1), delta.data().data(), filters_count,
+                     this->input_patches_.data().data(), filter_flat_size,
+                     T(1), nabla_weights, this->nabla_weights_stride());
+            } else {
+                // rows are scattered so the product goes to scratch and is added to each nabla
+                T *product = scope.arena().allocate<T>(filters_count * filter_flat_size);
+                gemm(true, false,
+                     filters_count, filter_flat_size, rows,
+                     T(1), delta.data().data(), filters_count,
+                     this->input_patches_.data().data(), filter_flat_size,
+                     T(0), product, filter_flat_size);
+                for (size_t f = 0; f < filters_count; f++) {
+                    T *nabla_w = this->nabla_weights_[f].data().data();
+                    const T *row = product + f * filter_flat_size;
+                    for (size_t i = 0; i < filter_flat_size; i++) { nabla_w[i] += row[i]; }
                 }
             }
 
-            return delta_next;
+            // sum the batch separately so small deltas are not lost in the big accumulated nabla
+            T *biases_sum = scope.arena().allocate<T>(filters_count);
+            std::fill(biases_sum, biases_sum + filters_count, T(0));
+            const T *raw = delta.data().data();
+            for (size_t r = 0; r < rows; r++) {
+                const T *row = raw + r * filters_count;
+                for (size_t f = 0; f < filters_count; f++) { biases_sum[f] += row[f]; }
+            }
+            for (size_t f = 0; f < filters_count; f++) { this->nabla_biases_[f](0) += biases_sum[f]; }
         }
 
-    private:
-        array3d_t<T> flat_filters() {
-            const int fsize = this->filter_weights_.size();
-            const int flength = this->filter_shape_.capacity();
-            std::vector<T> filters_matrix;
-            filters_matrix.reserve(fsize * flength);
-            for (int fi = 0; fi < fsize; fi++) {
-                auto &data = this->filter_weights_[fi].data();
-                filters_matrix.insert(filters_matrix.end(), data.begin(), data.end());
-            }
-            return array3d_t<T>(shape3d_t(fsize, flength, 1), std::move(filters_matrix));
+        void propagate_error(array4d_t<T> const &delta, array4d_t<T> &delta_next) {
+            const size_t batch = delta.batch();
+            const shape3d_t &delta_shape = delta.shape();
+            const size_t positions = delta_shape.x() * delta_shape.y();
+            const size_t filters_count = delta_shape.z();
+            const size_t filter_flat_size = this->filter_shape_.capacity();
+            assert(filters_count == this->filter_weights_.size());
+
+            // deltas of the batch are exactly a [batch * out_height * out_width, filters_count] matrix
+            // so errors scaled by weights of each patch are [batch * out_height * out_width,
+            // filter_height * filter_width * in_channels] matrix in the same order as input patches
+            // both matrices are temporaries of this call
+            arena_scope_t scope;
+            T *filters = scope.arena().allocate<T>(filters_count * filter_flat_size);
+            flat_filters(filters);
+            T *columns = scope.arena().allocate<T>(batch * positions * filter_flat_size);
+            gemm(false, false,
+                 batch * positions, filter_flat_size, filters_count,
+                 T(1), delta.data().data(), filters_count,
+                 filters, filter_flat_size,
+                 T(0), columns, filter_flat_size);
+
+            delta_next.resize(batch, this->input_shape_);
+            delta_next.reset(T(0));
+            col2im(columns, delta_shape, delta_next);
         }
 
-        std::deque<array3d_t<T>> input_patches() {
-            std::deque<array3d_t<T>> patches;
-            const shape3d_t output_shape = this->get_output_shape();
+        // sums patch columns back into the input positions they were taken from
+        // input (x, y) gets the column of the delta (x*stride - pad + fx, y*stride - pad + fy)
+        void col2im(const T *columns, shape3d_t const &delta_shape, array4d_t<T> &delta_next) {
             auto &filter_shape = this->filter_shape_;
+            auto &input_shape = this->input_shape_;
 
-            const int pad_x = this->get_left_padding();
-            const int pad_y = this->get_top_padding();
+            const int weight_pad_x = utils::get_left_padding(delta_shape, filter_shape, this->stride_.x());
+            const int weight_pad_y = utils::get_top_padding(delta_shape, filter_shape, this->stride_.y());
 
-            for (int x = 0; x < output_shape.x(); x++) {
-                int xs = x * this->stride_.x() - pad_x;
+            const int delta_x = delta_shape.x(), delta_y = delta_shape.y();
+            const int channels = input_shape.z();
+            const size_t filter_flat_size = filter_shape.capacity();
+            const size_t positions = delta_x * delta_y;
+            const size_t rows = delta_next.batch() * input_shape.x();
+            const T *raw = columns;
 
-                for (int y = 0; y < output_shape.y(); y++) {
-                    int ys = y * this->stride_.y() - pad_y;
+            // every (sample, input row) writes only its own part of delta_next
+            parallel_for(0, rows, grain_size(input_shape.y() * filter_flat_size), [&](size_t begin, size_t end) {
+                for (size_t r = begin; r < end; r++) {
+                    const size_t b = r / input_shape.x();
+                    const int x = r % input_shape.x();
+                    const T *sample_columns = raw + b * positions * filter_flat_size;
+                    array3d_view_t<T> result = delta_next.view(b);
 
-                    patches.emplace_back(
-                                shape3d_t(filter_shape.capacity(), 1, 1),
-                                std::move(
-                                    this->input_.extract(
-                                        index3d_t(xs, ys, 0),
-                                        index3d_t(xs + filter_shape.x() - 1,
-                                                  ys + filter_shape.y() - 1,
-                                                  this->input_shape_.z() - 1))));
+                    for (int y = 0; y < input_shape.y(); y++) {
+                        T *channels_sum = result.ptr(x, y, 0);
+                        const int xs = x * this->stride_.x() - weight_pad_x;
+                        const int ys = y * this->stride_.y() - weight_pad_y;
+
+                        for (int fx = 0; fx < filter_shape.x(); fx++) {
+                            const int dx = xs + fx;
+                            if (dx < 0 || dx >= delta_x) { continue; }
+
+                            for (int fy = 0; fy < filter_shape.y(); fy++) {
+                                const int dy = ys + fy;
+                                if (dy < 0 || dy >= delta_y) { continue; }
+
+                                const T *column = sample_columns +
+                                        (dx * delta_y + dy) * filter_flat_size +
+                                        (fx * filter_shape.y() + fy) * channels;
+                                for (int z = 0; z < channels; z++) {
+                                    channels_sum[z] += column[z];
+                                }
+                            }
+                        }
+                    }
                 }
-            }
-
-            return patches;
+            });
         }
 
-        std::vector<array3d_t<T>> input_patches_transpose() {
-            assert(!this->input_patches_.empty());
-            std::vector<array3d_t<T>> patches;
-
-            // flat size == filter_height * filter_width * in_channels
-            const int filter_flat_size = this->filter_shape_.capacity();
-            // patch size is equal to [out_width * out_height]
-            const size_t patches_size = this->input_patches_.size();
-            for (size_t i = 0; i < filter_flat_size; i++) {
-                patches.emplace_back(shape3d_t(patches_size, 1, 1), T(0));
+        // filters as [filters_number, filter_height * filter_width * in_channels] matrix
+        void flat_filters(T *filters_matrix) {
+            const int fsize = this->filter_weights_.size();
+            const int flength = this->filter_shape_.capacity();
+            for (int fi = 0; fi < fsize; fi++) {
+                auto &data = this->filter_weights_[fi].data();
+                std::copy(data.begin(), data.end(), filters_matrix + fi * flength);
             }
+        }
 
-            // input patches are of size
-            // [out_height * out_width, filter_height * filter_width * in_channels]
+        // z = input (*) filters + biases, z is resized to the output of the batch
+        void convolve(array4d_t<T> const &input, array4d_t<T> &z) {
+            assert(input.shape() == this->input_shape_);
+            const size_t batch = input.batch();
+            const shape3d_t output_shape = this->get_output_shape();
+            const size_t patches_size = batch * output_shape.x() * output_shape.y();
+            const size_t filter_flat_size = this->filter_shape_.capacity();
+            arena_scope_t scope;
+            // Extracts image patches from all inputs of the batch to form a
+            //  [batch * out_height * out_width, filter_height * filter_width * in_channels] matrix
+            // which is kept for backpropagation or is a temporary from the arena in inference
+            T *patches = nullptr;
+            if (this->is_inference()) {
+                patches = scope.arena().allocate<T>(patches_size * filter_flat_size);
+            } else {
+                // memory of the previous patches is reused
+                aligned_vector_t<T> buffer = std::move(this->input_patches_.data());
+                buffer.resize(patches_size * filter_flat_size);
+                this->input_patches_ = array3d_t<T>(shape3d_t(patches_size, filter_flat_size, 1), std::move(buffer));
+                patches = this->input_patches_.data().data();
+            }
+            input_patches(input, patches);
+            // flattens filters to 2d matrix of size [filters_number, filter_height * filter_width * in_channels]
+            T *filters = scope.arena().allocate<T>(output_shape.z() * filter_flat_size);
+            flat_filters(filters);
+
+            // result has size of [batch * out_height * out_width, filters_number] which is
+            // exactly the memory layout of the batch of [out_height, out_width, filters_number] outputs
+            const size_t filters_size = output_shape.z();
+            z.resize(batch, output_shape);
+            gemm(false, true, patches_size, filters_size, filter_flat_size,
+                 T(1), patches, filter_flat_size,
+                 filters, filter_flat_size,
+                 T(0), z.data().data(), filters_size);
+
+            T *conv = z.data().data();
             for (size_t i = 0; i < patches_size; i++) {
-                auto &slice = this->input_patches_[i].data();
-                assert(slice.size() == filter_flat_size);
-                for (size_t j = 0; j < filter_flat_size; j++) {
-                    patches[j](i) = slice[j];
+                for (size_t f = 0; f < filters_size; f++) {
+                    conv[i * filters_size + f] += this->filter_biases_[f](0);
                 }
             }
-
-            // this->input_patches_.clear();
-
-            return patches;
         }
 
-        std::vector<array3d_t<T>> delta_patches(array3d_t<T> const &delta) {
-            std::vector<array3d_t<T>> result;
-            auto &delta_shape = delta.shape();
-            auto &input_shape = this->input_shape_;
-
-            const int weight_pad_x = utils::get_left_padding(delta_shape, this->filter_shape_, this->stride_.x());
-            const int weight_pad_y = utils::get_top_padding(delta_shape, this->filter_shape_, this->stride_.y());
 
-            const size_t filters_count = delta_shape.z();
-            result.reserve(filters_count);
-            for (size_t di = 0; di < filters_count; di++) {
-                std::vector<T> patches;
-                patches.reserve(this->filter_shape_.capacity() * input_shape.x() * input_shape.y());
-                // result of the convolution of delta and filter will be input size
-                for (int y = 0; y < input_shape.y(); y++) {
-                    int ys = y*this->stride_.y() - weight_pad_y;
-
-                    for (int x = 0; x < input_shape.x(); x++) {
-                        int xs = x*this->stride_.x() - weight_pad_x;
+        // writes the im2col matrix of the whole batch to patches
+        void input_patches(array4d_t<T> const &input_batch, T *patches) {
+            const shape3d_t output_shape = this->get_output_shape();
+            auto &filter_shape = this->filter_shape_;
+            auto &input_shape = this->input_shape_;
 
-                        auto slice = delta.extract(
-                                         index3d_t(xs, ys, di),
-                                         index3d_t(xs + this->filter_shape_.x() - 1,
-                                                   ys + this->filter_shape_.y() - 1,
-                                                   di));
+            const int pad_x = this->get_left_padding();
+            const int pad_y = this->get_top_padding();
 
-                        patches.insert(patches.end(), slice.begin(), slice.end());
+            const size_t batch = input_batch.batch();
+            const int channels = filter_shape.z();
+            T *patch = patches;
+
+            for (size_t b = 0; b < batch; b++) {
+                array3d_view_t<const T> input = input_batch.view(b);
+
+                for (int x = 0; x < output_shape.x(); x++) {
+                    int xs = x * this->stride_.x() - pad_x;
+
+                    for (int y = 0; y < output_shape.y(); y++) {
+                        int ys = y * this->stride_.y() - pad_y;
+
+                        // each row of the matrix is a patch in the same
+                        // (x, y, z) order as the flattened filter
+                        for (int fx = 0; fx < filter_shape.x(); fx++) {
+                            const int ix = xs + fx;
+                            const bool x_inside = (0 <= ix) && (ix < input_shape.x());
+
+                            for (int fy = 0; fy < filter_shape.y(); fy++) {
+                                const int iy = ys + fy;
+                                const bool inside = x_inside && (0 <= iy) && (iy < input_shape.y());
+
+                                if (inside) {
+                                    const T *input_channels = input.ptr(ix, iy, 0);
+                                    std::copy(input_channels, input_channels + channels, patch);
+                                } else {
+                                    std::fill(patch, patch + channels, T(0));
+                                }
+                                patch += channels;
+                            }
+                        }
                     }
                 }
-                result.emplace_back(
-                            shape3d_t(input_shape.x() * input_shape.y(),
-                                      this->filter_shape_.x() * this->filter_shape_.y(),
-                                      1),
-                            std::move(patches));
             }
-
-            return result;
-        }
-
-        array3d_t<T> flat_biases() { return unvectorize(this->filter_biases_); }
-        array3d_t<T> flat_nabla_b() { return unvectorize(this->nabla_biases_); }
-
-        std::vector<array3d_t<T>> reshape_deltas(array3d_t<T> const &delta) {
-            std::vector<array3d_t<T>> deltas;
-            auto &delta_shape = delta.shape();
-            deltas.reserve(delta_shape.z());
-
-            const int delta_WxH = delta_shape.x() * delta_shape.y();
-            const int zn = delta.shape().z();
-
-            for (int z = 0; z < zn; z++) {
-                deltas.emplace_back(shape3d_t(delta_WxH, 1, 1),
-                                    delta.extract(
-                                        index3d_t(0, 0, z),
-                                        index3d_t(delta_shape.x() - 1,
-                                                  delta_shape.y() - 1,
-                                                  z)));
-            }
-
-            return deltas;
         }
 
     private:
-        std::deque<array3d_t<T>> input_patches_;
+        // im2col matrix of size [batch * out_height * out_width, filter_height * filter_width * in_channels]
+        array3d_t<T> input_patches_;
     };
 }
 
@@ -0,0 +1,381 @@
+#ifndef CONVOLUTIONPOOLINGLAYER_H
+#define CONVOLUTIONPOOLINGLAYER_H
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <yannpp/common/allocator.h>
+#include <yannpp/common/arena.h>
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/array3d_math.h>
+#include <yannpp/common/array3d_view.h>
+#include <yannpp/common/array4d.h>
+#include <yannpp/common/shape.h>
+#include <yannpp/common/thread_pool.h>
+#include <yannpp/common/utils.h>
+#include <yannpp/layers/convolutionlayer.h>
+#include <yannpp/layers/layer_base.h>
+#include <yannpp/layers/layer_metadata.h>
+#include <yannpp/layers/poolinglayer.h>
+#include <yannpp/network/activator.h>
+
+namespace yannpp {
+    // convolution_layer_2d_t followed by pooling_layer_t computed in one pass
+    // rows of convolution needed for one row of the pooled output are convolved,
+    // activated and max-pooled right away so full resolution output is never stored
+    // only pooled values and window offsets of maximums are kept for backpropagation
+    // activation has to be element-wise
+    template<typename T>
+    class convolution_pooling_layer_t: public convolution_layer_base_t<T> {
+    public:
+        convolution_pooling_layer_t(shape3d_t const &input_shape,
+                                    shape3d_t const &filter_shape,
+                                    int filters_number,
+                                    int stride_length,
+                                    padding_type padding,
+                                    activator_t<T> const &activator,
+                                    size_t pool_window,
+                                    int pool_stride,
+                                    layer_metadata_t const &metadata={}):
+            convolution_layer_base_t<T>(input_shape, filter_shape, filters_number,
+                                        stride_length, padding, activator, metadata),
+            pool_window_(pool_window),
+            pool_stride_(pool_stride),
+            pooled_shape_(POOL_DIM(this->get_output_shape().x(), (int)pool_window, pool_stride),
+                          POOL_DIM(this->get_output_shape().y(), (int)pool_window, pool_stride),
+                          filters_number)
+        {
+            // offset in the window is stored in one byte
+            assert(pool_window * pool_window <= 256);
+        }
+
+        using layer_base_t<T>::feedforward;
+        using layer_base_t<T>::backpropagate;
+
+    public:
+        virtual std::shared_ptr<layer_base_t<T>> clone() const override {
+            return std::make_shared<convolution_pooling_layer_t<T>>(*this);
+        }
+
+        shape3d_t get_pooled_shape() const { return pooled_shape_; }
+
+        using convolution_layer_base_t<T>::get_output_shape;
+        virtual shape3d_t get_output_shape(shape3d_t const &input_shape) const override {
+            assert(input_shape == this->input_shape_);
+            (void)input_shape;
+            return pooled_shape_;
+        }
+
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) override {
+            // input is kept for backpropagation without copying
+            this->input_storage_ = std::move(input);
+            array4d_t<T> output;
+            feedforward_into(this->input_storage_, output);
+            return output;
+        }
+
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &output) override {
+            if (this->is_inference()) {
+                // caches are not written but keep their memory for the next training step
+                convolve_pool(input, output);
+                return;
+            }
+
+            // input is read again in backpropagation
+            this->input_ = &input;
+            convolve_pool(input, output);
+        }
+
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&error) override {
+            assert(error.shape() == pooled_shape_);
+            assert(error.batch() == pooled_z_.batch());
+            // only maximums of the pooling windows have non-zero gradients
+            array4d_t<T> delta = std::move(error), delta_next;
+            backpropagate_into(delta, delta_next);
+            return delta_next;
+        }
+
+        virtual void backpropagate_into(array4d_t<T> &error, array4d_t<T> &delta_next) override {
+            assert(error.shape() == pooled_shape_);
+            assert(error.batch() == pooled_z_.batch());
+            // only maximums of the pooling windows have non-zero gradients
+            array4d_t<T> &delta = error;
+            this->activator_.derivative_mul(pooled_z_, delta);
+
+            accumulate_nablas(delta);
+            propagate_error(delta, delta_next);
+        }
+
+    private:
+        // result = pooled activations of input (*) filters + biases
+        // result is resized to the pooled output of the batch
+        void convolve_pool(array4d_t<T> const &input, array4d_t<T> &result) {
+            assert(input.shape() == this->input_shape_);
+            const size_t batch = input.batch();
+            const int window = (int)pool_window_;
+            const int filters_count = pooled_shape_.z();
+            // only these columns of the convolution are covered by pooling windows
+            const int conv_y = (pooled_shape_.y() - 1) * pool_stride_ + window;
+            const size_t filter_flat_size = this->filter_shape_.capacity();
+
+            // filters matrix lives until the end of this call
+            arena_scope_t scope;
+            T *filters = scope.arena().allocate<T>(filters_count * filter_flat_size);
+            flat_filters(filters);
+            // every element of the result and caches is written below
+            result.resize(batch, pooled_shape_);
+            // pre-activations and positions of maximums are needed only for backpropagation
+            // and their memory is reused by the next batches (also after inference)
+            const bool keep_caches = !this->is_inference();
+            if (keep_caches) {
+                pooled_z_.resize(batch, pooled_shape_);
+                max_index_.resize(batch * pooled_shape_.capacity());
+            }
+
+            // one task is one row of the pooled output of one sample
+            const size_t rows = batch * pooled_shape_.x();
+            const size_t grain = grain_size(window * conv_y * filter_flat_size * filters_count);
+            parallel_for(0, rows, grain, [&](size_t begin, size_t end) {
+                for (size_t r = begin; r < end; r++) {
+                    const size_t b = r / pooled_shape_.x();
+                    const int px = r % pooled_shape_.x();
+
+                    // temporaries of the row are taken from the arena of the thread running it
+                    arena_scope_t row_scope;
+                    arena_t &arena = row_scope.arena();
+                    const int conv_rows = window * conv_y;
+
+                    // [window * conv_y, filters_count] convolution of the rows under the pooling windows
+                    T *patches = arena.allocate<T>(conv_rows * filter_flat_size);
+                    input_patches(input, b, px * pool_stride_, window, conv_y, patches);
+                    array3d_view_t<T> conv_view(arena.allocate<T>(conv_rows * filters_count),
+                                                shape3d_t(conv_rows, filters_count, 1));
+                    gemm(false, true, conv_rows, filters_count, filter_flat_size,
+                         T(1), patches, filter_flat_size,
+                         filters, filter_flat_size,
+                         T(0), conv_view.data(), filters_count);
+                    add_biases(conv_view);
+
+                    // pre-activations are kept only for backpropagation
+                    array3d_view_t<T> activated_view = conv_view;
+                    if (keep_caches) {
+                        activated_view = array3d_view_t<T>(arena.allocate<T>(conv_rows * filters_count), conv_view.shape());
+                        std::copy(conv_view.data(), conv_view.data() + conv_rows * filters_count, activated_view.data());
+                    }
+                    this->activator_.activate_inplace(activated_view);
+
+                    auto result_view = result.view(b);
+                    array3d_view_t<T> pooled_z_view;
+                    uint8_t *max_index = nullptr;
+                    if (keep_caches) {
+                        pooled_z_view = pooled_z_.view(b);
+                        max_index = max_index_.data() + b * pooled_shape_.capacity();
+                    }
+
+                    for (int py = 0; py < pooled_shape_.y(); py++) {
+                        const int ys = py * pool_stride_;
+                        for (int f = 0; f < filters_count; f++) {
+                            // same selection of the maximum as in pooling_layer_t
+                            int imax_x = 0, imax_y = 0;
+                            T vmax = std::numeric_limits<T>::min();
+                            for (int wx = 0; wx < window; wx++) {
+                                for (int wy = 0; wy < window; wy++) {
+                                    T v = activated_view(wx * conv_y + ys + wy, f);
+                                    if (v > vmax) { vmax = v; imax_x = wx; imax_y = wy; }
+                                }
+                            }
+
+                            const int imax = imax_x * conv_y + ys + imax_y;
+                            result_view(px, py, f) = activated_view(imax, f);
+                            if (keep_caches) {
+                                pooled_z_view(px, py, f) = conv_view(imax, f);
+                                max_index[(px * pooled_shape_.y() + py) * filters_count + f] = (uint8_t)(imax_x * window + imax_y);
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        // position in the convolution output of the maximum for the pooled index i
+        inline void conv_position(size_t b, size_t i, int px, int py, int &x, int &y) const {
+            const int offset = max_index_[b * pooled_shape_.capacity() + i];
+            x = px * pool_stride_ + offset / (int)pool_window_;
+            y = py * pool_stride_ + offset % (int)pool_window_;
+        }
+
+        void accumulate_nablas(array4d_t<T> const &delta) {
+            const size_t batch = delta.batch();
+            const int filters_count = pooled_shape_.z();
+            const int channels = this->filter_shape_.z();
+            auto &filter_shape = this->filter_shape_;
+            auto &input_shape = this->input_shape_;
+            const int pad_x = this->get_left_padding();
+            const int pad_y = this->get_top_padding();
+
+            // filters are independent so every task updates only its own nablas
+            const size_t grain = grain_size(batch * pooled_shape_.x() * pooled_shape_.y() * filter_shape.capacity());
+            parallel_for(0, filters_count, grain, [&](size_t f_begin, size_t f_end) {
+                for (int f = f_begin; f < (int)f_end; f++) {
+                    auto nabla_w = this->nabla_weights_[f].view();
+                    T bias_sum = 0;
+
+                    for (size_t b = 0; b < batch; b++) {
+                        array3d_view_t<const T> input = this->input_->view(b);
+                        array3d_view_t<const T> delta_view = delta.view(b);
+
+                        for (int px = 0; px < pooled_shape_.x(); px++) {
+                            for (int py = 0; py < pooled_shape_.y(); py++) {
+                                const T d = delta_view(px, py, f);
+                                if (d == T(0)) { continue; }
+                                bias_sum += d;
+
+                                int x, y;
+                                conv_position(b, (px * pooled_shape_.y() + py) * filters_count + f, px, py, x, y);
+                                const int xs = x * this->stride_.x() - pad_x;
+                                const int ys = y * this->stride_.y() - pad_y;
+
+                                for (int fx = 0; fx < filter_shape.x(); fx++) {
+                                    const int ix = xs + fx;
+                                    if (ix < 0 || ix >= input_shape.x()) { continue; }
+
+                                    for (int fy = 0; fy < filter_shape.y(); fy++) {
+                                        const int iy = ys + fy;
+                                        if (iy < 0 || iy >= input_shape.y()) { continue; }
+
+                                        const T *in = input.ptr(ix, iy, 0);
+                                        T *nabla = nabla_w.ptr(fx, fy, 0);
+                                        for (int z = 0; z < channels; z++) { nabla[z] += d * in[z]; }
+                                    }
+                                }
+                            }
+                        }
+                    }
+
+                    this->nabla_biases_[f](0) += bias_sum;
+                }
+            });
+        }
+
+        // scatters non-zero deltas back the same way as col2im() of convolution_layer_2d_t
+        // delta (x, y) gets to input (i, j) where x = i*stride - pad + fx and y = j*stride - pad + fy
+        void propagate_error(array4d_t<T> const &delta, array4d_t<T> &delta_next) {
+            const size_t batch = delta.batch();
+            const int filters_count = pooled_shape_.z();
+            const int channels = this->input_shape_.z();
+            auto &filter_shape = this->filter_shape_;
+            auto &input_shape = this->input_shape_;
+            const int stride_x = this->stride_.x(), stride_y = this->stride_.y();
+
+            const shape3d_t conv_shape = this->get_output_shape();
+            const int weight_pad_x = utils::get_left_padding(conv_shape, filter_shape, stride_x);
+            const int weight_pad_y = utils::get_top_padding(conv_shape, filter_shape, stride_y);
+
+            delta_next.resize(batch, input_shape);
+            delta_next.reset(T(0));
+            parallel_for(0, batch, 1, [&](size_t b_begin, size_t b_end) {
+                for (size_t b = b_begin; b < b_end; b++) {
+                    array3d_view_t<const T> delta_view = delta.view(b);
+                    auto result = delta_next.view(b);
+
+                    for (int px = 0; px < pooled_shape_.x(); px++) {
+                        for (int py = 0; py < pooled_shape_.y(); py++) {
+                            for (int f = 0; f < filters_count; f++) {
+                                const T d = delta_view(px, py, f);
+                                if (d == T(0)) { continue; }
+
+                                int x, y;
+                                conv_position(b, (px * pooled_shape_.y() + py) * filters_count + f, px, py, x, y);
+                                auto weights = this->filter_weights_[f].view();
+
+                                for (int fx = 0; fx < filter_shape.x(); fx++) {
+                                    const int tx = x + weight_pad_x - fx;
+                                    if (tx < 0 || tx % stride_x != 0 || tx / stride_x >= input_shape.x()) { continue; }
+
+                                    for (int fy = 0; fy < filter_shape.y(); fy++) {
+                                        const int ty = y + weight_pad_y - fy;
+                                        if (ty < 0 || ty % stride_y != 0 || ty / stride_y >= input_shape.y()) { continue; }
+
+                                        const T *w = weights.ptr(fx, fy, 0);
+                                        T *out = result.ptr(tx / stride_x, ty / stride_y, 0);
+                                        for (int z = 0; z < channels; z++) { out[z] += d * w[z]; }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        // filters as [filters_number, filter_height * filter_width * in_channels] matrix
+        void flat_filters(T *filters_matrix) {
+            const int fsize = this->filter_weights_.size();
+            const int flength = this->filter_shape_.capacity();
+            for (int fi = 0; fi < fsize; fi++) {
+                auto &data = this->filter_weights_[fi].data();
+                std::copy(data.begin(), data.end(), filters_matrix + fi * flength);
+            }
+        }
+
+        // im2col matrix [rows * cols, filter_height * filter_width * in_channels]
+        // of the convolution output rows [x_begin, x_begin + rows) and columns [0, cols) of sample b
+        void input_patches(array4d_t<T> const &input_batch, size_t b, int x_begin, int rows, int cols, T *patches) {
+            auto &filter_shape = this->filter_shape_;
+            auto &input_shape = this->input_shape_;
+            const int pad_x = this->get_left_padding();
+            const int pad_y = this->get_top_padding();
+
+            array3d_view_t<const T> input = input_batch.view(b);
+
+            for (int x = x_begin; x < x_begin + rows; x++) {
+                const int xs = x * this->stride_.x() - pad_x;
+
+                for (int y = 0; y < cols; y++) {
+                    const int ys = y * this->stride_.y() - pad_y;
+
+                    for (int fx = 0; fx < filter_shape.x(); fx++) {
+                        const int ix = xs + fx;
+                        const bool x_inside = (0 <= ix) && (ix < input_shape.x());
+
+                        for (int fy = 0; fy < filter_shape.y(); fy++) {
+                            const int iy = ys + fy;
+                            const bool inside = x_inside && (0 <= iy) && (iy < input_shape.y());
+
+                            if (inside) {
+                                const T *channels = input.ptr(ix, iy, 0);
+                                patches = std::copy(channels, channels + filter_shape.z(), patches);
+                            } else {
+                                patches = std::fill_n(patches, filter_shape.z(), T(0));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        void add_biases(array3d_view_t<T> const &conv_view) {
+            const size_t patches_size = conv_view.shape().x();
+            const size_t filters_size = conv_view.shape().y();
+            for (size_t i = 0; i < patches_size; i++) {
+                for (size_t f = 0; f < filters_size; f++) {
+                    conv_view(i, f) += this->filter_biases_[f](0);
+                }
+            }
+        }
+
+    private:
+        size_t pool_window_;
+        int pool_stride_;
+        shape3d_t pooled_shape_;
+        // values before activation of the pooled maximums
+        array4d_t<T> pooled_z_;
+        // offset wx * window + wy of the maximum in each pooling window
+        aligned_vector_t<uint8_t> max_index_;
+    };
+}
+
+#endif // CONVOLUTIONPOOLINGLAYER_H
@@ -11,29 +11,59 @@ namespace yannpp {
     class crossentropy_output_layer_t : public layer_base_t<T> {
     public:
         crossentropy_output_layer_t(layer_metadata_t const &metadata={}):
-            layer_base_t<T>(metadata)
+            layer_base_t<T>(metadata),
+            input_(nullptr)
         { }
 
+    public:
+        using layer_base_t<T>::feedforward;
+        using layer_base_t<T>::backpropagate;
+
     public:
         virtual void init() override { }
 
-        virtual array3d_t<T> feedforward(array3d_t<T> &&input) override {
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) override {
+            // activation is not kept in inference but its memory is
+            if (this->is_inference()) { return std::move(input); }
+
             last_activation_ = std::move(input);
+            input_ = &last_activation_;
             return last_activation_;
         }
 
-        virtual array3d_t<T> backpropagate(array3d_t<T> &&result) override {
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&result) override {
+            array4d_t<T> delta_next;
+            backpropagate_into(result, delta_next);
+            return delta_next;
+        }
+
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &output) override {
+            // input is read again in backpropagation
+            if (!this->is_inference()) { input_ = &input; }
+            output.assign(input);
+        }
+
+        virtual void backpropagate_into(array4d_t<T> &result, array4d_t<T> &delta_next) override {
             // delta(L) = cost_deriv [X] activation_deriv(z(L))
             // cross-entropy derivative is [a(x) - y]
-            last_activation_.subtract(result);
-            return last_activation_;
+            assert(input_ != nullptr);
+            delta_next.assign(*input_);
+            delta_next.subtract(result);
         }
 
+        virtual shape3d_t get_output_shape(shape3d_t const &input_shape) const override { return input_shape; }
+
         virtual void optimize(optimizer_t<T> const &) override {}
         virtual void load(std::vector<array3d_t<T>> &&, std::vector<array3d_t<T>> &&) override {}
 
+        virtual std::shared_ptr<layer_base_t<T>> clone() const override {
+            return std::make_shared<crossentropy_output_layer_t<T>>(*this);
+        }
+
     private:
-        array3d_t<T> last_activation_;
+        // input of the last feedforward, owned only when it was moved in
+        array4d_t<T> const *input_;
+        array4d_t<T> last_activation_;
     };
 }
 
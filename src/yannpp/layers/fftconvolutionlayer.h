@@ -0,0 +1,332 @@
+#ifndef FFTCONVOLUTIONLAYER_H
+#define FFTCONVOLUTIONLAYER_H
+
+#include <algorithm>
+#include <cassert>
+#include <complex>
+#include <memory>
+#include <vector>
+
+#include <yannpp/common/arena.h>
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/array3d_view.h>
+#include <yannpp/common/array4d.h>
+#include <yannpp/common/fft.h>
+#include <yannpp/common/shape.h>
+#include <yannpp/common/thread_pool.h>
+#include <yannpp/common/utils.h>
+#include <yannpp/layers/convolutionlayer.h>
+#include <yannpp/layers/layer_base.h>
+#include <yannpp/layers/layer_metadata.h>
+#include <yannpp/network/activator.h>
+#include <yannpp/optimizer/optimizer.h>
+
+namespace yannpp {
+    // convolution layer computing correlations as products of 2D spectra
+    // so the cost depends on the input size and not on the filter size
+    // filter spectra are cached and recalculated only after weights change
+    // transforms are padded to powers of two in each dimension which can make
+    // them up to 4 times bigger (e.g. 34x34 -> 64x64) so sizes near a power of two fit best
+    template<typename T>
+    class convolution_layer_fft_t: public convolution_layer_base_t<T> {
+        using complex_t = std::complex<T>;
+
+    public:
+        convolution_layer_fft_t(shape3d_t const &input_shape,
+                                shape3d_t const &filter_shape,
+                                int filters_number,
+                                int stride_length,
+                                padding_type padding,
+                                activator_t<T> const &activator,
+                                layer_metadata_t const &metadata={}):
+            convolution_layer_base_t<T>(input_shape, filter_shape, filters_number,
+                                        stride_length, padding, activator, metadata),
+            // linear correlation of the input (or error) and filter
+            // does not wrap around with these sizes
+            plan_(next_power_of_two(input_shape.x() + filter_shape.x() - 1),
+                  next_power_of_two(input_shape.y() + filter_shape.y() - 1)),
+            spectra_version_(0)
+        {
+            const shape3d_t output_shape = this->get_output_shape();
+            nabla_plan_ = fft2d_plan_t<T>(next_power_of_two(input_shape.x() + output_shape.x() - 1),
+                                          next_power_of_two(input_shape.y() + output_shape.y() - 1));
+        }
+
+        using layer_base_t<T>::feedforward;
+        using layer_base_t<T>::backpropagate;
+
+    public:
+        virtual std::shared_ptr<layer_base_t<T>> clone() const override {
+            return std::make_shared<convolution_layer_fft_t<T>>(*this);
+        }
+
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) override {
+            // input is kept for backpropagation without copying
+            this->input_storage_ = std::move(input);
+            array4d_t<T> output;
+            feedforward_into(this->input_storage_, output);
+            return output;
+        }
+
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &output) override {
+            if (this->is_inference()) {
+                // nothing is kept, z is computed in the output and activated in place
+                // caches are not written but keep their memory for the next training step
+                convolve(input, output);
+                this->activator_.activate_inplace(output);
+                return;
+            }
+
+            // input is read again in backpropagation, z is kept for the derivative
+            this->input_ = &input;
+            convolve(input, this->output_);
+            this->activator_.activate(this->output_, output);
+        }
+
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&error) override {
+            array4d_t<T> delta = std::move(error), delta_next;
+            backpropagate_into(delta, delta_next);
+            return delta_next;
+        }
+
+        virtual void backpropagate_into(array4d_t<T> &error, array4d_t<T> &delta_next) override {
+            // error shape was already transformed in the prev layer as delta(l+1)(*)rot180(w(l+1))
+            assert(error.shape() == this->output_.shape());
+            // gradients with regards to input of this layer
+            array4d_t<T> &delta = error; this->activator_.derivative_mul(this->output_, delta);
+
+            accumulate_nablas(delta);
+
+            auto &delta_shape = delta.shape();
+            const size_t batch = delta.batch();
+            const size_t filters_size = delta_shape.z(), channels = this->input_shape_.z();
+            const size_t plane = plan_.size();
+            // same 'full' convolution of delta and filters as in the loop layer
+            const int weight_pad_x = utils::get_left_padding(delta_shape, this->filter_shape_, this->stride_.x());
+            const int weight_pad_y = utils::get_top_padding(delta_shape, this->filter_shape_, this->stride_.y());
+            delta_next.resize(batch, this->input_shape_);
+            delta_next.reset(T(0));
+
+            for (size_t b = 0; b < batch; b++) {
+                arena_scope_t scope;
+                complex_t *delta_spectra = scope.arena().allocate<complex_t>(filters_size * plane);
+                spectra(plan_, delta.view(b), delta_spectra);
+                auto output = delta_next.view(b);
+
+                // delta_next(x, y, z) = Sum[ delta(x*s - pad + i, y*s - pad + j, f) * w_f(i, j, z) ]
+                const size_t grain = grain_size(filters_size * plane + transform_work(plan_));
+                parallel_for(0, channels, grain, [&](size_t z_begin, size_t z_end) {
+                    arena_scope_t task_scope;
+                    complex_t *product = task_scope.arena().allocate<complex_t>(plane);
+                    for (size_t z = z_begin; z < z_end; z++) {
+                        std::fill(product, product + plane, complex_t(0));
+                        for (size_t f = 0; f < filters_size; f++) {
+                            multiply_add(&delta_spectra[f * plane], &filter_spectra_[(f * channels + z) * plane],
+                                         product, plane);
+                        }
+                        plan_.inverse(product);
+
+                        sample(plan_, product, delta_shape.x(), delta_shape.y(),
+                               this->filter_shape_.x(), this->filter_shape_.y(),
+                               weight_pad_x, weight_pad_y, output, z);
+                    }
+                });
+            }
+        }
+
+    private:
+        // z = input (*) filters + biases, z is resized to the output of the batch
+        void convolve(array4d_t<T> const &input, array4d_t<T> &z) {
+            assert(input.shape() == this->input_shape_);
+            update_filter_spectra();
+
+            const size_t batch = input.batch();
+            const shape3d_t output_shape = this->get_output_shape();
+            const size_t filters_size = output_shape.z(), channels = this->input_shape_.z();
+            const size_t plane = plan_.size();
+            z.resize(batch, output_shape);
+            z.reset(T(0));
+
+            for (size_t b = 0; b < batch; b++) {
+                arena_scope_t scope;
+                complex_t *input_spectra = scope.arena().allocate<complex_t>(channels * plane);
+                spectra(plan_, input.view(b), input_spectra);
+                auto output = z.view(b);
+
+                // output(x, y, f) = Sum[ input(x*s - pad + i, y*s - pad + j, z) * w_f(i, j, z) ]
+                const size_t grain = grain_size(channels * plane + transform_work(plan_));
+                parallel_for(0, filters_size, grain, [&](size_t f_begin, size_t f_end) {
+                    arena_scope_t task_scope;
+                    complex_t *product = task_scope.arena().allocate<complex_t>(plane);
+                    for (size_t f = f_begin; f < f_end; f++) {
+                        std::fill(product, product + plane, complex_t(0));
+                        for (size_t c = 0; c < channels; c++) {
+                            multiply_add(&input_spectra[c * plane], &filter_spectra_[(f * channels + c) * plane],
+                                         product, plane);
+                        }
+                        plan_.inverse(product);
+
+                        sample(plan_, product, this->input_shape_.x(), this->input_shape_.y(),
+                               this->filter_shape_.x(), this->filter_shape_.y(),
+                               this->get_left_padding(), this->get_top_padding(), output, f);
+                        add_bias(output, f, this->filter_biases_[f](0));
+                    }
+                });
+            }
+        }
+
+        void accumulate_nablas(array4d_t<T> const &delta) {
+            auto &delta_shape = delta.shape();
+            const size_t batch = delta.batch();
+            const size_t filters_size = delta_shape.z(), channels = this->input_shape_.z();
+            const size_t plane = nabla_plan_.size();
+
+            // dC/db = delta(l)
+            for (size_t b = 0; b < batch; b++) {
+                const T *d = delta.sample_data(b);
+                const size_t pixels = delta_shape.x() * delta_shape.y();
+                for (size_t f = 0; f < filters_size; f++) {
+                    T delta_sum = 0;
+                    for (size_t p = 0; p < pixels; p++) { delta_sum += d[p * filters_size + f]; }
+                    this->nabla_biases_[f](0) += delta_sum;
+                }
+            }
+
+            // spectra of all samples live until the end of this call
+            arena_scope_t scope;
+            complex_t *input_spectra = scope.arena().allocate<complex_t>(batch * channels * plane);
+            complex_t *delta_spectra = scope.arena().allocate<complex_t>(batch * filters_size * plane);
+            for (size_t b = 0; b < batch; b++) {
+                spectra(nabla_plan_, this->input_->view(b), input_spectra + b * channels * plane);
+                complex_t *sample_delta = delta_spectra + b * filters_size * plane;
+                spectra(nabla_plan_, delta.view(b), sample_delta);
+                // delta is the kernel of this correlation
+                for (size_t i = 0; i < filters_size * plane; i++) { sample_delta[i] = std::conj(sample_delta[i]); }
+            }
+
+            // nabla_w(i, j, z) += Sum[ input(i*s - pad + x, j*s - pad + y, z) * delta(x, y, f) ]
+            // products are summed over the batch before the inverse transform
+            const size_t grain = grain_size(batch * plane + transform_work(nabla_plan_));
+            parallel_for(0, filters_size * channels, grain, [&](size_t begin, size_t end) {
+                arena_scope_t task_scope;
+                complex_t *product = task_scope.arena().allocate<complex_t>(plane);
+                for (size_t i = begin; i < end; i++) {
+                    const size_t f = i / channels, z = i % channels;
+                    std::fill(product, product + plane, complex_t(0));
+                    for (size_t b = 0; b < batch; b++) {
+                        multiply_add(&input_spectra[(b * channels + z) * plane],
+                                     &delta_spectra[(b * filters_size + f) * plane], product, plane);
+                    }
+                    nabla_plan_.inverse(product);
+
+                    auto nabla_w = this->nabla_weights_[f].view();
+                    auto nabla_slice = nabla_w.subview(index3d_t(0, 0, z),
+                                                       shape3d_t(this->filter_shape_.x(), this->filter_shape_.y(), 1));
+                    sample(nabla_plan_, product, this->input_shape_.x(), this->input_shape_.y(),
+                           delta_shape.x(), delta_shape.y(),
+                           this->get_left_padding(), this->get_top_padding(), nabla_slice, 0);
+                }
+            });
+        }
+
+        // conjugated spectra of all filters and channels in [filters, channels] order
+        void update_filter_spectra() {
+            if (!filter_spectra_.empty() && spectra_version_ == this->values_version()) { return; }
+
+            const size_t filters_size = this->filter_weights_.size(), channels = this->filter_shape_.z();
+            const size_t plane = plan_.size();
+            filter_spectra_.assign(filters_size * channels * plane, complex_t(0));
+
+            parallel_for(0, filters_size, grain_size(channels * transform_work(plan_)), [&](size_t f_begin, size_t f_end) {
+                for (size_t f = f_begin; f < f_end; f++) {
+                    auto filter = this->filter_weights_[f].view();
+                    for (size_t z = 0; z < channels; z++) {
+                        complex_t *spectrum = &filter_spectra_[(f * channels + z) * plane];
+                        fill_plane(plan_, filter, z, spectrum);
+                        plan_.forward(spectrum);
+                        for (size_t i = 0; i < plane; i++) { spectrum[i] = std::conj(spectrum[i]); }
+                    }
+                }
+            });
+
+            spectra_version_ = this->values_version();
+        }
+
+        // spectra of all channels of the 3d array in the [channels] order
+        // result has channels * plan.size() elements
+        void spectra(fft2d_plan_t<T> const &plan, array3d_view_t<const T> const &source, complex_t *result) const {
+            const size_t channels = source.shape().z(), plane = plan.size();
+            parallel_for(0, channels, grain_size(transform_work(plan)), [&](size_t z_begin, size_t z_end) {
+                for (size_t z = z_begin; z < z_end; z++) {
+                    complex_t *spectrum = result + z * plane;
+                    std::fill(spectrum, spectrum + plane, complex_t(0));
+                    fill_plane(plan, source, z, spectrum);
+                    plan.forward(spectrum);
+                }
+            });
+        }
+
+        // approximate number of butterflies of one 2D transform of the plan
+        static size_t transform_work(fft2d_plan_t<T> const &plan) {
+            size_t levels = 0;
+            while ((size_t(1) << levels) < plan.size()) { levels++; }
+            return plan.size() * levels;
+        }
+
+        static void fill_plane(fft2d_plan_t<T> const &plan, array3d_view_t<const T> const &source,
+                               size_t z, complex_t *plane) {
+            auto &shape = source.shape();
+            const size_t cols = plan.cols();
+            for (int x = 0; x < shape.x(); x++) {
+                for (int y = 0; y < shape.y(); y++) {
+                    plane[x * cols + y] = complex_t(source(x, y, z));
+                }
+            }
+        }
+
+        // product += a * b (b is already conjugated)
+        static void multiply_add(const complex_t *a, const complex_t *b, complex_t *product, size_t size) {
+            for (size_t i = 0; i < size; i++) { product[i] += a[i] * b[i]; }
+        }
+
+        // writes linear correlation c(t) = Sum[ source(t + k) * kernel(k) ] of the source of size
+        // (source_x, source_y) and kernel of size (kernel_x, kernel_y) at points t = o*stride - pad
+        // to output(o_x, o_y, channel), circular correlation is exact for -kernel < t < source
+        void sample(fft2d_plan_t<T> const &plan, const complex_t *circular,
+                    int source_x, int source_y, int kernel_x, int kernel_y,
+                    int pad_x, int pad_y, array3d_view_t<T> const &output, int channel) const {
+            auto &shape = output.shape();
+            const int rows = plan.rows(), cols = plan.cols();
+            for (int x = 0; x < shape.x(); x++) {
+                const int tx = x * this->stride_.x() - pad_x;
+                if (tx <= -kernel_x || tx >= source_x) { continue; }
+
+                for (int y = 0; y < shape.y(); y++) {
+                    const int ty = y * this->stride_.y() - pad_y;
+                    if (ty <= -kernel_y || ty >= source_y) { continue; }
+
+                    const int row = (tx + rows) % rows, col = (ty + cols) % cols;
+                    output(x, y, channel) += circular[row * cols + col].real();
+                }
+            }
+        }
+
+        static void add_bias(array3d_view_t<T> const &output, int channel, T bias) {
+            auto &shape = output.shape();
+            for (int x = 0; x < shape.x(); x++) {
+                for (int y = 0; y < shape.y(); y++) {
+                    output(x, y, channel) += bias;
+                }
+            }
+        }
+
+    private:
+        fft2d_plan_t<T> plan_;
+        fft2d_plan_t<T> nabla_plan_;
+        std::vector<complex_t> filter_spectra_;
+        // values_version() of the weights the spectra were computed of
+        size_t spectra_version_;
+    };
+}
+
+#endif // FFTCONVOLUTIONLAYER_H
@@ -2,9 +2,11 @@
 #define FULLY_CONNECTED_LAYER_H
 
 #include <functional>
+#include <memory>
 
 #include <yannpp/optimizer/optimizer.h>
 #include <yannpp/common/array3d.h>
+#include <yannpp/common/array4d.h>
 #include <yannpp/common/array3d_math.h>
 #include <yannpp/common/log.h>
 #include <yannpp/common/shape.h>
@@ -22,9 +24,15 @@ namespace yannpp {
                                 layer_metadata_t const &metadata = {}):
             layer_base_t<T>(metadata),
             activator_(activator),
-            input_shape_(layer_out, layer_in, 1)
+            layer_out_(layer_out),
+            input_shape_(layer_out, layer_in, 1),
+            input_(nullptr)
         { }
 
+    public:
+        using layer_base_t<T>::feedforward;
+        using layer_base_t<T>::backpropagate;
+
     public:
         virtual void init() override {
             const int layer_in = input_shape_.y(), layer_out = input_shape_.x();
@@ -43,38 +51,85 @@ namespace yannpp {
 
             nabla_w_ = array3d_t<T>(shape3d_t(layer_out, layer_in, 1), 0);
             nabla_b_ = array3d_t<T>(shape_row(layer_out), 0);
+            this->parameters_replaced();
         }
 
-        virtual array3d_t<T> feedforward(array3d_t<T> &&input) override {
-            input_shape_ = input.shape();
-            input_ = std::move(input);
-            input_.flatten();
-            // z = w*a + b
-            output_ = dot21(weights_, input_); output_.add(bias_);
-            return activator_.activate(output_);
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) override {
+            // input is kept for backpropagation without copying
+            input_storage_ = std::move(input);
+            array4d_t<T> output;
+            feedforward_into(input_storage_, output);
+            return output;
+        }
+
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &output) override {
+            if (this->is_inference()) {
+                // nothing is kept, z is computed in the output and activated in place
+                // caches are not written but keep their memory for the next training step
+                weighted_input(input, output);
+                activator_.activate_inplace(output);
+                return;
+            }
+
+            // input is read again in backpropagation, z is kept for the derivative
+            input_ = &input;
+            weighted_input(input, output_);
+            activator_.activate(output_, output);
         }
 
-        virtual array3d_t<T> backpropagate(array3d_t<T> &&error) override {
-            array3d_t<T> delta, delta_next, delta_nabla_w;
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&error) override {
+            array4d_t<T> delta = std::move(error), delta_next;
+            backpropagate_into(delta, delta_next);
+            return delta_next;
+        }
+
+        virtual void backpropagate_into(array4d_t<T> &error, array4d_t<T> &delta_next) override {
+            const int layer_in = weights_.shape().y(), layer_out = weights_.shape().x();
+            const size_t batch = error.batch();
+            assert(batch == output_.batch());
+            assert(input_ != nullptr && input_->batch() == batch);
+
             // delta(l) = (w(l+1) * delta(l+1)) [X] derivative(z(l))
             // (w(l+1) * delta(l+1)) comes as the gradient (error) from the "previous" layer
-            delta = activator_.derivative(output_); delta.element_mul(error);
-            // dC/db = delta(l)
-            nabla_b_.add(delta);
-            // dC/dw = a(l-1) * delta(l)
-            delta_nabla_w = outer_product(delta, input_);
-            nabla_w_.add(delta_nabla_w);
+            array4d_t<T> &delta = error; activator_.derivative_mul(output_, delta);
+            // dC/db = delta(l) summed over the batch
+            auto &nabla_b = nabla_b_.data();
+            for (size_t b = 0; b < batch; b++) {
+                const T *d = delta.sample_data(b);
+                for (int i = 0; i < layer_out; i++) { nabla_b[i] += d[i]; }
+            }
+            // dC/dw = a(l-1) * delta(l) summed over the batch
+            // nabla_w(out, in) += delta(batch, out)^T * A(batch, in)
+            gemm(true, false, layer_out, layer_in, batch,
+                 T(1), delta.data().data(), layer_out,
+                 input_->data().data(), layer_in,
+                 T(1), nabla_w_.data().data(), layer_in);
             // w(l) * delta(l)
-            delta_next = transpose_dot21(weights_, delta);
-            delta_next.reshape(input_shape_);
-            return delta_next;
+            // delta_next(batch, in) = delta(batch, out) * W(out, in)
+            assert(input_shape_.capacity() == layer_in);
+            delta_next.resize(batch, input_shape_);
+            gemm(false, false, batch, layer_in, layer_out,
+                 T(1), delta.data().data(), layer_out,
+                 weights_.data().data(), layer_in,
+                 T(0), delta_next.data().data(), layer_in);
+        }
+
+        virtual shape3d_t get_output_shape(shape3d_t const &) const override {
+            return shape_row((int)layer_out_);
         }
 
         virtual void optimize(optimizer_t<T> const &strategy) override {
-            strategy.update_bias(bias_, nabla_b_);
-            strategy.update_weights(weights_, nabla_w_);
-            nabla_b_.reset(0);
-            nabla_w_.reset(0);
+            strategy.update_weights(weights_, nabla_w_, this->optimizer_state(0));
+            strategy.update_bias(bias_, nabla_b_, this->optimizer_state(1));
+            this->parameters_changed();
+        }
+
+        virtual std::shared_ptr<layer_base_t<T>> clone() const override {
+            return std::make_shared<fully_connected_layer_t<T>>(*this);
+        }
+
+        virtual std::vector<parameter_t<T>> parameters() override {
+            return {{&weights_, &nabla_w_}, {&bias_, &nabla_b_}};
         }
 
     public:
@@ -89,6 +144,29 @@ namespace yannpp {
 
             weights_ = std::move(weights[0]);
             bias_ = std::move(biases[0]);
+            this->parameters_replaced();
+        }
+
+    private:
+        // z = w*a + b for the whole batch at once
+        void weighted_input(array4d_t<T> const &input, array4d_t<T> &z) {
+            const int layer_in = weights_.shape().y(), layer_out = weights_.shape().x();
+            input_shape_ = input.shape();
+            assert(input.sample_size() == (size_t)layer_in);
+
+            const size_t batch = input.batch();
+            // Z(batch, out) = A(batch, in) * W(out, in)^T
+            z.resize(batch, shape_row(layer_out));
+            gemm(false, true, batch, layer_out, layer_in,
+                 T(1), input.data().data(), layer_in,
+                 weights_.data().data(), layer_in,
+                 T(0), z.data().data(), layer_out);
+
+            auto &bias = bias_.data();
+            for (size_t b = 0; b < batch; b++) {
+                T *zb = z.sample_data(b);
+                for (int i = 0; i < layer_out; i++) { zb[i] += bias[i]; }
+            }
         }
 
     private:
@@ -96,9 +174,13 @@ namespace yannpp {
         array3d_t<T> weights_;
         array3d_t<T> bias_;
         activator_t<T> const &activator_;
+        size_t layer_out_;
         // calculation support
         shape3d_t input_shape_;
-        array3d_t<T> output_, input_;
+        // input of the last feedforward, owned only when it was moved in
+        array4d_t<T> const *input_;
+        array4d_t<T> input_storage_;
+        array4d_t<T> output_;
         array3d_t<T> nabla_w_;
         array3d_t<T> nabla_b_;
     };
@@ -1,33 +1,93 @@
 #ifndef ILAYER_H
 #define ILAYER_H
 
+#include <memory>
 #include <vector>
 
 #include <yannpp/common/array3d.h>
+#include <yannpp/common/array4d.h>
 #include <yannpp/layers/layer_metadata.h>
+#include <yannpp/optimizer/optimizer.h>
 
 namespace yannpp {
+    // trainable parameter of the layer together with its accumulated gradient
     template<typename T>
-    class optimizer_t;
+    struct parameter_t {
+        array3d_t<T> *value;
+        array3d_t<T> *nabla;
+    };
 
     template<typename T>
     class layer_base_t {
     public:
-        layer_base_t(layer_metadata_t const &m={}): metadata_(m) {}
+        layer_base_t(layer_metadata_t const &m={}): metadata_(m), inference_(false), parameters_version_(0), values_version_(0) {}
         virtual ~layer_base_t() {}
         // input is the output of the previous layer
-        virtual array3d_t<T> feedforward(array3d_t<T> &&input) = 0;
+        array3d_t<T> feedforward(array3d_t<T> &&input) {
+            return feedforward(array4d_t<T>(std::move(input))).release();
+        }
         // error is the gradient with regards to input
-        virtual array3d_t<T> backpropagate(array3d_t<T> &&error) = 0;
+        array3d_t<T> backpropagate(array3d_t<T> &&error) {
+            return backpropagate(array4d_t<T>(std::move(error))).release();
+        }
+        // batched versions process the whole minibatch (batch, X, Y, Z) at once
+        // and single input is processed as a batch of one
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) = 0;
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&error) = 0;
+        // versions which write into the preallocated buffers planned by the network
+        // (memory of the output is reused when it is big enough)
+        // in training layers can read the input again in backpropagate_into()
+        // so it has to stay alive and unchanged until then (see network2_t::plan_memory())
+        // default implementations fall back to the allocating versions
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &output) {
+            output = feedforward(array4d_t<T>(input));
+        }
+        // error can be modified in place
+        virtual void backpropagate_into(array4d_t<T> &error, array4d_t<T> &delta_next) {
+            delta_next = backpropagate(std::move(error));
+        }
+        // shape of one output sample for the given shape of one input sample
+        virtual shape3d_t get_output_shape(shape3d_t const &input_shape) const = 0;
         virtual void load(std::vector<array3d_t<T>> &&weights, std::vector<array3d_t<T>> &&biases) = 0;
         virtual void optimize(optimizer_t<T> const &) = 0;
         virtual void init() = 0;
+        // copy of the layer with own activation caches and gradients
+        // used as a replica for the data-parallel training
+        virtual std::shared_ptr<layer_base_t<T>> clone() const = 0;
+        virtual std::vector<parameter_t<T>> parameters() { return {}; }
 
     public:
         layer_metadata_t const &get_metadata() const { return metadata_; }
+        // in inference mode feedforward does not keep anything needed only for
+        // backpropagation (inputs, pre-activations, patches, pooling indices)
+        // so backpropagate() can not be called until inference is turned off
+        // caches are not freed either so training continues without allocations
+        void set_inference(bool inference) { inference_ = inference; }
+        bool is_inference() const { return inference_; }
+        // changes whenever arrays of parameters() are replaced (e.g. by load())
+        // so owners of the flat storage (see network2_t) know to place them again
+        size_t parameters_version() const { return parameters_version_; }
+        // changes whenever values of parameters() are written (e.g. by optimize() or
+        // through the flat storage) so layers can cache what they compute of them
+        size_t values_version() const { return values_version_; }
+        void parameters_changed() { values_version_++; }
+
+    protected:
+        void parameters_replaced() { parameters_version_++; values_version_++; }
+
+        // state of the optimizer (e.g. velocity) for the parameters array
+        // with the same index as in parameters(), kept between the updates
+        optimizer_state_t<T> &optimizer_state(size_t parameter) {
+            if (optimizer_states_.size() <= parameter) { optimizer_states_.resize(parameter + 1); }
+            return optimizer_states_[parameter];
+        }
 
     private:
         layer_metadata_t metadata_;
+        bool inference_;
+        size_t parameters_version_;
+        size_t values_version_;
+        std::vector<optimizer_state_t<T>> optimizer_states_;
     };
 }
 
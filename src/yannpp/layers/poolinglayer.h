@@ -1,7 +1,11 @@
 #ifndef POOLINGLAYER_H
 #define POOLINGLAYER_H
 
+#include <limits>
+
+#include <yannpp/common/array3d_view.h>
 #include <yannpp/common/shape.h>
+#include <yannpp/common/thread_pool.h>
 #include <yannpp/layers/layer_base.h>
 #include <yannpp/layers/layer_metadata.h>
 
@@ -20,68 +24,122 @@ namespace yannpp {
             stride_(stride_length, stride_length, 0)
         { }
 
+    public:
+        using layer_base_t<T>::feedforward;
+        using layer_base_t<T>::backpropagate;
+
     public:
         virtual void init() override { }
 
-        virtual array3d_t<T> feedforward(array3d_t<T> &&input) override {
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) override {
+            array4d_t<T> result;
+            feedforward_into(input, result);
+            return result;
+        }
+
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &result) override {
             input_shape_ = input.shape();
             // downsample input using window with step stride
-            shape3d_t output_shape(POOL_DIM(input_shape_.x(), window_size_, stride_.x()),
-                                   POOL_DIM(input_shape_.y(), window_size_, stride_.y()),
-                                   input_shape_.z());
-            array3d_t<T> result(output_shape, T(0));
-            max_index_ = array3d_t<index3d_t>(output_shape, index3d_t(0, 0, 0));
-
-            // z axis corresponds to each filter from convolution layer
-            for (int z = 0; z < output_shape.z(); z++) {
-                // 2D loop over convoluted image from each filter
-                for (int y = 0; y < output_shape.y(); y++) {
-                    int ys = y * stride_.y();
-
-                    for (int x = 0; x < output_shape.x(); x++) {
-                        int xs = x * stride_.x();
-                        // pooling layer does max-pooling, selecting a maximum
-                        // activation within the bounds of it's "window"
-                        auto input_slice = input.slice(
-                                               index3d_t(xs, ys, z),
-                                               index3d_t(xs + window_size_ - 1,
-                                                         ys + window_size_ - 1,
-                                                         z));
-                        max_index_(x, y, z) = input_slice.argmax();
-                        result(x, y, z) = input_slice.at(max_index_(x, y, z));
-                    }
+            const shape3d_t output_shape = get_output_shape(input_shape_);
+            const size_t batch = input.batch();
+            result.resize(batch, output_shape);
+            // indices of all samples are stacked along x axis
+            // and they are needed only for backpropagation
+            const bool keep_indices = !this->is_inference();
+            if (keep_indices) {
+                // memory of the previous indices is reused
+                aligned_vector_t<index3d_t> indices = std::move(max_index_.data());
+                indices.resize(batch * output_shape.capacity(), index3d_t(0, 0, 0));
+                max_index_ = array3d_t<index3d_t>(shape3d_t(batch * output_shape.x(), output_shape.y(), output_shape.z()),
+                                                  std::move(indices));
+            }
+
+            const int window = (int)window_size_;
+            const size_t grain = grain_size(output_shape.x() * output_shape.y() * window * window);
+
+            for (size_t b = 0; b < batch; b++) {
+                array3d_view_t<const T> input_view = input.view(b);
+                auto result_view = result.view(b);
+                array3d_view_t<index3d_t> max_index_view;
+                if (keep_indices) {
+                    max_index_view = max_index_.view().subview(index3d_t(b * output_shape.x(), 0, 0), output_shape);
                 }
+
+                // z axis corresponds to each filter from convolution layer
+                // channels are independent so they are split between threads
+                parallel_for(0, output_shape.z(), grain, [&](size_t z_begin, size_t z_end) {
+                    for (int z = z_begin; z < (int)z_end; z++) {
+                        // 2D loop over convoluted image from each filter
+                        for (int y = 0; y < output_shape.y(); y++) {
+                            int ys = y * stride_.y();
+
+                            for (int x = 0; x < output_shape.x(); x++) {
+                                int xs = x * stride_.x();
+                                // pooling layer does max-pooling, selecting a maximum
+                                // activation within the bounds of it's "window"
+                                // (window always lies within the input because of POOL_DIM)
+                                int imax_x = 0, imax_y = 0;
+                                T vmax = std::numeric_limits<T>::min();
+                                for (int wx = 0; wx < window; wx++) {
+                                    for (int wy = 0; wy < window; wy++) {
+                                        T v = input_view(xs + wx, ys + wy, z);
+                                        if (v > vmax) { vmax = v; imax_x = wx; imax_y = wy; }
+                                    }
+                                }
+                                if (keep_indices) { max_index_view(x, y, z) = index3d_t(imax_x, imax_y, 0); }
+                                result_view(x, y, z) = input_view(xs + imax_x, ys + imax_y, z);
+                            }
+                        }
+                    }
+                });
             }
+        }
 
-            return result;
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&error) override {
+            array4d_t<T> output;
+            backpropagate_into(error, output);
+            return output;
         }
 
-        virtual array3d_t<T> backpropagate(array3d_t<T> &&error) override {
+        virtual void backpropagate_into(array4d_t<T> &error, array4d_t<T> &output) override {
             auto &error_shape = error.shape();
-            array3d_t<T> output(input_shape_, T(0));
-            assert(error.shape() == max_index_.shape());
-
-            // z axis corresponds to each filter from convolution layer
-            for (int z = 0; z < error_shape.z(); z++) {
-                // 2D loop same as in feedforward()
-                for (int y = 0; y < error_shape.y(); y++) {
-                    int ys = y * stride_.y();
-
-                    for (int x = 0; x < error_shape.x(); x++) {
-                        int xs = x * stride_.x();
-
-                        // same slice as input used for max() calculation
-                        output.slice(
-                                    index3d_t(xs, ys, z),
-                                    index3d_t(xs + window_size_ - 1,
-                                              ys + window_size_ - 1,
-                                              z))
-                                .at(max_index_(x, y, z)) = error(x, y, z);
+            const size_t batch = error.batch();
+            // only maximums of the windows get the gradient
+            output.resize(batch, input_shape_);
+            output.reset(T(0));
+            assert(max_index_.shape() == shape3d_t(batch * error_shape.x(), error_shape.y(), error_shape.z()));
+            const size_t grain = grain_size(error_shape.x() * error_shape.y());
+
+            for (size_t b = 0; b < batch; b++) {
+                array3d_view_t<const T> error_view = error.view(b);
+                array3d_view_t<const index3d_t> max_index_view =
+                        max_index_.view().subview(index3d_t(b * error_shape.x(), 0, 0), error_shape);
+                auto output_view = output.view(b);
+
+                // z axis corresponds to each filter from convolution layer
+                parallel_for(0, error_shape.z(), grain, [&](size_t z_begin, size_t z_end) {
+                    for (int z = z_begin; z < (int)z_end; z++) {
+                        // 2D loop same as in feedforward()
+                        for (int y = 0; y < error_shape.y(); y++) {
+                            int ys = y * stride_.y();
+
+                            for (int x = 0; x < error_shape.x(); x++) {
+                                int xs = x * stride_.x();
+
+                                // same window as input used for max() calculation
+                                index3d_t const &imax = max_index_view(x, y, z);
+                                output_view(xs + imax.x(), ys + imax.y(), z) = error_view(x, y, z);
+                            }
+                        }
                     }
-                }
+                });
             }
+        }
 
-            return output;
+        virtual shape3d_t get_output_shape(shape3d_t const &input_shape) const override {
+            return shape3d_t(POOL_DIM(input_shape.x(), (int)window_size_, stride_.x()),
+                             POOL_DIM(input_shape.y(), (int)window_size_, stride_.y()),
+                             input_shape.z());
         }
 
         virtual void optimize(optimizer_t<T> const &) override {
@@ -89,6 +147,10 @@ namespace yannpp {
         }
         virtual void load(std::vector<array3d_t<T>> &&, std::vector<array3d_t<T>> &&) override {}
 
+        virtual std::shared_ptr<layer_base_t<T>> clone() const override {
+            return std::make_shared<pooling_layer_t<T>>(*this);
+        }
+
     private:
         size_t window_size_;
         shape3d_t input_shape_;
@@ -0,0 +1,429 @@
+#ifndef WINOGRADCONVOLUTIONLAYER_H
+#define WINOGRADCONVOLUTIONLAYER_H
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#include <yannpp/common/arena.h>
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/array3d_math.h>
+#include <yannpp/common/array3d_view.h>
+#include <yannpp/common/array4d.h>
+#include <yannpp/common/shape.h>
+#include <yannpp/common/thread_pool.h>
+#include <yannpp/common/utils.h>
+#include <yannpp/layers/convolutionlayer.h>
+#include <yannpp/layers/layer_base.h>
+#include <yannpp/layers/layer_metadata.h>
+#include <yannpp/network/activator.h>
+
+namespace yannpp {
+    namespace detail {
+        // matrices of the minimal filtering algorithm F(m x m, 3 x 3) for tile d of size n x n (n = m + 2)
+        // Y = AT * [(G * g * GT) [X] (BT * d * B)] * A computes correlation of d and 3x3 filter g
+        // (A. Lavin, S. Gray "Fast Algorithms for Convolutional Neural Networks")
+        template<typename T>
+        struct winograd_matrices_t {
+            winograd_matrices_t(int tile_size):
+                m(tile_size),
+                n(tile_size + 2)
+            {
+                if (m == 2) {
+                    bt = {1,  0, -1,  0,
+                          0,  1,  1,  0,
+                          0, -1,  1,  0,
+                          0,  1,  0, -1};
+                    g = {T(1),     T(0),    T(0),
+                         T(0.5),   T(0.5),  T(0.5),
+                         T(0.5),  T(-0.5),  T(0.5),
+                         T(0),     T(0),    T(1)};
+                    at = {1, 1,  1,  0,
+                          0, 1, -1, -1};
+                } else {
+                    assert(m == 4);
+                    bt = {4,  0, -5,  0, 1, 0,
+                          0, -4, -4,  1, 1, 0,
+                          0,  4, -4, -1, 1, 0,
+                          0, -2, -1,  2, 1, 0,
+                          0,  2, -1, -2, 1, 0,
+                          0,  4,  0, -5, 0, 1};
+                    g = {T(1)/T(4),   T(0),        T(0),
+                         T(-1)/T(6),  T(-1)/T(6),  T(-1)/T(6),
+                         T(-1)/T(6),  T(1)/T(6),   T(-1)/T(6),
+                         T(1)/T(24),  T(1)/T(12),  T(1)/T(6),
+                         T(1)/T(24),  T(-1)/T(12), T(1)/T(6),
+                         T(0),        T(0),        T(1)};
+                    at = {1, 1,  1, 1,  1, 0,
+                          0, 1, -1, 2, -2, 0,
+                          0, 1,  1, 4,  4, 0,
+                          0, 1, -1, 8, -8, 1};
+                }
+
+                a = transpose(at, m, n);
+                gt = transpose(g, n, 3);
+            }
+
+            static std::vector<T> transpose(std::vector<T> const &mat, int rows, int cols) {
+                std::vector<T> result(rows * cols);
+                for (int i = 0; i < rows; i++) {
+                    for (int j = 0; j < cols; j++) {
+                        result[j * rows + i] = mat[i * cols + j];
+                    }
+                }
+                return result;
+            }
+
+            // output tile size and input tile size
+            int m, n;
+            // row-major matrices: AT (m x n), A (n x m), G (n x 3), GT (3 x n), BT (n x n)
+            std::vector<T> at, a, g, gt, bt;
+        };
+
+        // out = mat * in * transpose(mat) for mat (rows x cols) and in (cols x cols)
+        template<typename T>
+        void winograd_sandwich(const T *mat, int rows, int cols, const T *in, T *out) {
+            // transforms are at most 6x6
+            T tmp[6 * 6];
+            for (int i = 0; i < rows; i++) {
+                for (int j = 0; j < cols; j++) {
+                    T sum = 0;
+                    for (int k = 0; k < cols; k++) { sum += mat[i * cols + k] * in[k * cols + j]; }
+                    tmp[i * cols + j] = sum;
+                }
+            }
+
+            for (int i = 0; i < rows; i++) {
+                for (int j = 0; j < rows; j++) {
+                    T sum = 0;
+                    for (int k = 0; k < cols; k++) { sum += tmp[i * cols + k] * mat[j * cols + k]; }
+                    out[i * rows + j] = sum;
+                }
+            }
+        }
+    }
+
+    // convolution layer for 3x3 filters with stride 1 using Winograd minimal filtering
+    // F(2x2, 3x3) needs 2.25x and F(4x4, 3x3) needs 4x less multiplications than direct convolution
+    // tiles of all samples in the batch are multiplied at once as n*n gemm()
+    // of transformed filters [filters, channels] and inputs [channels, tiles]
+    template<typename T, int TileSize = 4>
+    class convolution_layer_winograd_t: public convolution_layer_base_t<T> {
+        static_assert(TileSize == 2 || TileSize == 4, "Only F(2x2, 3x3) and F(4x4, 3x3) are supported");
+
+    public:
+        convolution_layer_winograd_t(shape3d_t const &input_shape,
+                                     shape3d_t const &filter_shape,
+                                     int filters_number,
+                                     int stride_length,
+                                     padding_type padding,
+                                     activator_t<T> const &activator,
+                                     layer_metadata_t const &metadata={}):
+            convolution_layer_base_t<T>(input_shape, filter_shape, filters_number,
+                                        stride_length, padding, activator, metadata),
+            matrices_(TileSize)
+        {
+            assert(filter_shape.x() == 3 && filter_shape.y() == 3);
+            assert(stride_length == 1);
+        }
+
+        using layer_base_t<T>::feedforward;
+        using layer_base_t<T>::backpropagate;
+
+    public:
+        virtual std::shared_ptr<layer_base_t<T>> clone() const override {
+            return std::make_shared<convolution_layer_winograd_t<T, TileSize>>(*this);
+        }
+
+        virtual array4d_t<T> feedforward(array4d_t<T> &&input) override {
+            // input is kept for backpropagation without copying
+            this->input_storage_ = std::move(input);
+            array4d_t<T> output;
+            feedforward_into(this->input_storage_, output);
+            return output;
+        }
+
+        virtual void feedforward_into(array4d_t<T> const &input, array4d_t<T> &output) override {
+            if (this->is_inference()) {
+                // nothing is kept, z is computed in the output and activated in place
+                // caches are not written but keep their memory for the next training step
+                convolve(input, output);
+                this->activator_.activate_inplace(output);
+                return;
+            }
+
+            // input is read again in backpropagation, z is kept for the derivative
+            this->input_ = &input;
+            convolve(input, this->output_);
+            this->activator_.activate(this->output_, output);
+        }
+
+        virtual array4d_t<T> backpropagate(array4d_t<T> &&error) override {
+            array4d_t<T> delta = std::move(error), delta_next;
+            backpropagate_into(delta, delta_next);
+            return delta_next;
+        }
+
+        virtual void backpropagate_into(array4d_t<T> &error, array4d_t<T> &delta_next) override {
+            // error shape was already transformed in the prev layer as delta(l+1)(*)rot180(w(l+1))
+            assert(error.shape() == this->output_.shape());
+            // gradients with regards to input of this layer
+            array4d_t<T> &delta = error; this->activator_.derivative_mul(this->output_, delta);
+
+            accumulate_nablas(delta);
+
+            // same 'full' convolution of delta and filters as in the loop layer
+            delta_next.resize(delta.batch(), this->input_shape_);
+            delta_next.reset(T(0));
+            const int weight_pad_x = utils::get_left_padding(delta.shape(), this->filter_shape_, 1);
+            const int weight_pad_y = utils::get_top_padding(delta.shape(), this->filter_shape_, 1);
+            arena_scope_t scope;
+            T *u = scope.arena().allocate<T>(filters_transform_size());
+            transform_filters(true, u);
+            correlate(delta, weight_pad_x, weight_pad_y, u, delta_next);
+        }
+
+    private:
+        // z = input (*) filters + biases, z is resized to the output of the batch
+        void convolve(array4d_t<T> const &input, array4d_t<T> &z) {
+            assert(input.shape() == this->input_shape_);
+            const size_t batch = input.batch();
+            const shape3d_t output_shape = this->get_output_shape();
+            const size_t filters_size = output_shape.z();
+            z.resize(batch, output_shape);
+            // output memory is [batch * out_height * out_width, filters_number]
+            const size_t pixels = batch * output_shape.x() * output_shape.y();
+            T *z_data = z.data().data();
+            for (size_t p = 0; p < pixels; p++) {
+                for (size_t f = 0; f < filters_size; f++) {
+                    z_data[p * filters_size + f] = this->filter_biases_[f](0);
+                }
+            }
+
+            arena_scope_t scope;
+            T *u = scope.arena().allocate<T>(filters_transform_size());
+            transform_filters(false, u);
+            correlate(input, this->get_left_padding(), this->get_top_padding(), u, z);
+        }
+
+        size_t filters_transform_size() const {
+            return matrices_.n * matrices_.n * this->filter_weights_.size() * this->filter_shape_.z();
+        }
+
+        // transformed filters G * g * GT as n*n matrices [filters, channels]
+        // or [channels, filters] if transposed (for the error propagation)
+        void transform_filters(bool transposed, T *u) const {
+            const int n = matrices_.n, nn = n * n;
+            const size_t filters_size = this->filter_weights_.size();
+            const size_t channels = this->filter_shape_.z();
+
+            T g[3 * 3], tile[6 * 6];
+            for (size_t f = 0; f < filters_size; f++) {
+                auto &filter = this->filter_weights_[f];
+                for (size_t z = 0; z < channels; z++) {
+                    for (int i = 0; i < 3; i++) {
+                        for (int j = 0; j < 3; j++) { g[i * 3 + j] = filter(i, j, z); }
+                    }
+
+                    detail::winograd_sandwich(matrices_.g.data(), n, 3, g, tile);
+
+                    const size_t offset = transposed ? (z * filters_size + f) : (f * channels + z);
+                    for (int xi = 0; xi < nn; xi++) {
+                        u[xi * filters_size * channels + offset] = tile[xi];
+                    }
+                }
+            }
+        }
+
+        // transformed input tiles BT * d * B as n*n matrices [channels, tiles]
+        // where tiles of the output (tiles_x, tiles_y) of each sample are stacked
+        // v has n * n * channels * batch * tiles_x * tiles_y elements
+        void transform_input(array4d_t<T> const &src, int pad_x, int pad_y,
+                             size_t tiles_x, size_t tiles_y, T *v) const {
+            const int m = matrices_.m, n = matrices_.n, nn = n * n;
+            const size_t channels = src.shape().z();
+            const size_t tiles = src.batch() * tiles_x * tiles_y;
+
+            parallel_for(0, tiles, grain_size(channels * nn * n * 2), [&](size_t t_begin, size_t t_end) {
+                T d[6 * 6], tile[6 * 6];
+                for (size_t t = t_begin; t < t_end; t++) {
+                    const size_t b = t / (tiles_x * tiles_y);
+                    const int xs = (int)((t / tiles_y) % tiles_x) * m - pad_x;
+                    const int ys = (int)(t % tiles_y) * m - pad_y;
+                    array3d_view_t<const T> input = src.view(b);
+
+                    for (size_t c = 0; c < channels; c++) {
+                        // zero padded window of the input
+                        for (int i = 0; i < n; i++) {
+                            for (int j = 0; j < n; j++) {
+                                d[i * n + j] = input.in_bounds(xs + i, ys + j, c) ? input(xs + i, ys + j, c) : T(0);
+                            }
+                        }
+
+                        detail::winograd_sandwich(matrices_.bt.data(), n, n, d, tile);
+
+                        for (int xi = 0; xi < nn; xi++) {
+                            v[(xi * channels + c) * tiles + t] = tile[xi];
+                        }
+                    }
+                }
+            });
+        }
+
+        // dst(x, y, o) += Sum[ src(x - pad_x + i, y - pad_y + j, c) * w(i, j) ] over 3x3 windows
+        // and input channels where transformed filters u are n*n matrices [dst channels, src channels]
+        void correlate(array4d_t<T> const &src, int pad_x, int pad_y,
+                       const T *u, array4d_t<T> &dst) const {
+            const int m = matrices_.m, n = matrices_.n, nn = n * n;
+            auto &dst_shape = dst.shape();
+            const size_t in_channels = src.shape().z(), out_channels = dst_shape.z();
+            const size_t tiles_x = (dst_shape.x() + m - 1) / m, tiles_y = (dst_shape.y() + m - 1) / m;
+            const size_t tiles = dst.batch() * tiles_x * tiles_y;
+
+            // transforms and products live until the end of this call
+            arena_scope_t scope;
+            T *v = scope.arena().allocate<T>(nn * in_channels * tiles);
+            transform_input(src, pad_x, pad_y, tiles_x, tiles_y, v);
+
+            // elementwise products summed over channels are n*n independent matrix products
+            T *products = scope.arena().allocate<T>(nn * out_channels * tiles);
+            parallel_for(0, nn, grain_size(out_channels * in_channels * tiles), [&](size_t begin, size_t end) {
+                for (size_t xi = begin; xi < end; xi++) {
+                    gemm(false, false, out_channels, tiles, in_channels,
+                         T(1), u + xi * out_channels * in_channels, in_channels,
+                         v + xi * in_channels * tiles, tiles,
+                         T(0), products + xi * out_channels * tiles, tiles);
+                }
+            });
+
+            // inverse transform AT * M * A gives m x m outputs of each tile
+            parallel_for(0, tiles, grain_size(out_channels * nn * n * 2), [&](size_t t_begin, size_t t_end) {
+                T tile[6 * 6], y[4 * 4];
+                for (size_t t = t_begin; t < t_end; t++) {
+                    const size_t b = t / (tiles_x * tiles_y);
+                    const int xs = (int)((t / tiles_y) % tiles_x) * m;
+                    const int ys = (int)(t % tiles_y) * m;
+                    auto output = dst.view(b);
+
+                    for (size_t o = 0; o < out_channels; o++) {
+                        for (int xi = 0; xi < nn; xi++) {
+                            tile[xi] = products[(xi * out_channels + o) * tiles + t];
+                        }
+
+                        detail::winograd_sandwich(matrices_.at.data(), m, n, tile, y);
+
+                        for (int i = 0; i < m; i++) {
+                            for (int j = 0; j < m; j++) {
+                                if (output.in_bounds(xs + i, ys + j, o)) { output(xs + i, ys + j, o) += y[i * m + j]; }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        // backpropagation through the forward transforms:
+        // dU = (A * dY * AT) [X] V summed over tiles and dw = GT * dU * G
+        void accumulate_nablas(array4d_t<T> const &delta) {
+            const int m = matrices_.m, n = matrices_.n, nn = n * n;
+            auto &delta_shape = delta.shape();
+            const size_t batch = delta.batch();
+            const size_t filters_size = delta_shape.z(), channels = this->input_shape_.z();
+
+            // dC/db = delta(l)
+            for (size_t b = 0; b < batch; b++) {
+                const T *d = delta.sample_data(b);
+                const size_t pixels = delta_shape.x() * delta_shape.y();
+                for (size_t f = 0; f < filters_size; f++) {
+                    T delta_sum = 0;
+                    for (size_t p = 0; p < pixels; p++) { delta_sum += d[p * filters_size + f]; }
+                    this->nabla_biases_[f](0) += delta_sum;
+                }
+            }
+
+            const size_t tiles_x = (delta_shape.x() + m - 1) / m, tiles_y = (delta_shape.y() + m - 1) / m;
+            const size_t tiles = batch * tiles_x * tiles_y;
+            // transforms live until the end of this call
+            arena_scope_t scope;
+            T *v = scope.arena().allocate<T>(nn * channels * tiles);
+            transform_input(*this->input_, this->get_left_padding(), this->get_top_padding(),
+                            tiles_x, tiles_y, v);
+
+            // transformed deltas as n*n matrices [filters, tiles]
+            T *delta_tiles = scope.arena().allocate<T>(nn * filters_size * tiles);
+            parallel_for(0, tiles, grain_size(filters_size * nn * m * 2), [&](size_t t_begin, size_t t_end) {
+                T dy[4 * 4], tile[6 * 6];
+                for (size_t t = t_begin; t < t_end; t++) {
+                    const size_t b = t / (tiles_x * tiles_y);
+                    const int xs = (int)((t / tiles_y) % tiles_x) * m;
+                    const int ys = (int)(t % tiles_y) * m;
+                    array3d_view_t<const T> delta_view = delta.view(b);
+
+                    for (size_t f = 0; f < filters_size; f++) {
+                        for (int i = 0; i < m; i++) {
+                            for (int j = 0; j < m; j++) {
+                                dy[i * m + j] = delta_view.in_bounds(xs + i, ys + j, f) ? delta_view(xs + i, ys + j, f) : T(0);
+                            }
+                        }
+
+                        detail::winograd_sandwich(matrices_.a.data(), n, m, dy, tile);
+
+                        for (int xi = 0; xi < nn; xi++) {
+                            delta_tiles[(xi * filters_size + f) * tiles + t] = tile[xi];
+                        }
+                    }
+                }
+            });
+
+            // dU(filters, channels) = dM(filters, tiles) * V(channels, tiles)^T
+            T *nabla_u = scope.arena().allocate<T>(nn * filters_size * channels);
+            parallel_for(0, nn, grain_size(filters_size * channels * tiles), [&](size_t begin, size_t end) {
+                for (size_t xi = begin; xi < end; xi++) {
+                    gemm(false, true, filters_size, channels, tiles,
+                         T(1), delta_tiles + xi * filters_size * tiles, tiles,
+                         v + xi * channels * tiles, tiles,
+                         T(0), nabla_u + xi * filters_size * channels, channels);
+                }
+            });
+
+            T tile[6 * 6], dg[3 * 3];
+            for (size_t f = 0; f < filters_size; f++) {
+                auto &nabla_w = this->nabla_weights_[f];
+                for (size_t z = 0; z < channels; z++) {
+                    for (int xi = 0; xi < nn; xi++) {
+                        tile[xi] = nabla_u[(xi * filters_size + f) * channels + z];
+                    }
+
+                    detail::winograd_sandwich(matrices_.gt.data(), 3, n, tile, dg);
+
+                    for (int i = 0; i < 3; i++) {
+                        for (int j = 0; j < 3; j++) { nabla_w(i, j, z) += dg[i * 3 + j]; }
+                    }
+                }
+            }
+        }
+
+    private:
+        detail::winograd_matrices_t<T> matrices_;
+    };
+
+    // Winograd layer for 3x3 filters with stride 1 and im2col based layer otherwise
+    template<typename T>
+    std::shared_ptr<convolution_layer_base_t<T>> make_convolution_layer(shape3d_t const &input_shape,
+                                                                        shape3d_t const &filter_shape,
+                                                                        int filters_number,
+                                                                        int stride_length,
+                                                                        padding_type padding,
+                                                                        activator_t<T> const &activator,
+                                                                        layer_metadata_t const &metadata={}) {
+        if (filter_shape.x() == 3 && filter_shape.y() == 3 && stride_length == 1) {
+            return std::make_shared<convolution_layer_winograd_t<T>>(
+                        input_shape, filter_shape, filters_number, stride_length, padding, activator, metadata);
+        }
+
+        return std::make_shared<convolution_layer_2d_t<T>>(
+                    input_shape, filter_shape, filters_number, stride_length, padding, activator, metadata);
+    }
+}
+
+#endif // WINOGRADCONVOLUTIONLAYER_H
@@ -1,31 +1,290 @@
 #ifndef ACTIVATOR_H
 #define ACTIVATOR_H
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <functional>
 
 #include <yannpp/common/array3d.h>
+#include <yannpp/common/array3d_math.h>
+#include <yannpp/common/array3d_view.h>
+#include <yannpp/common/array4d.h>
+#include <yannpp/common/simd.h>
 
 namespace yannpp {
+    // activations with built-in kernels
+    // custom activation calls user functions and is much slower
+    enum struct activation_kind {
+        identity,
+        sigmoid,
+        relu,
+        tanh,
+        softmax,
+        custom
+    };
+
+    // fast mode uses vectorized approximations of exp, sigmoid, tanh and softmax
+    // (see simd.h for error bounds), precise mode is the reference implementation
+    enum struct activation_precision {
+        precise,
+        fast
+    };
+
+    namespace detail {
+        // precise versions work for any type, fast versions are implemented for float only
+        // y = f(x), y can be the same as x
+        template<typename T>
+        void sigmoid_apply(const T *x, T *y, size_t size, activation_precision) {
+            for (size_t i = 0; i < size; i++) { y[i] = sigmoid(x[i]); }
+        }
+
+        inline void sigmoid_apply(const float *x, float *y, size_t size, activation_precision precision) {
+            if (precision == activation_precision::fast) { simd::fast_sigmoid(x, y, size); return; }
+            for (size_t i = 0; i < size; i++) { y[i] = sigmoid(x[i]); }
+        }
+
+        template<typename T>
+        void tanh_apply(const T *x, T *y, size_t size, activation_precision) {
+            for (size_t i = 0; i < size; i++) { y[i] = std::tanh(x[i]); }
+        }
+
+        inline void tanh_apply(const float *x, float *y, size_t size, activation_precision precision) {
+            if (precision == activation_precision::fast) { simd::fast_tanh(x, y, size); return; }
+            for (size_t i = 0; i < size; i++) { y[i] = std::tanh(x[i]); }
+        }
+
+        template<typename T>
+        void softmax_apply(const T *x, T *y, size_t size, activation_precision) {
+            stable_softmax(x, y, size);
+        }
+
+        inline void softmax_apply(const float *x, float *y, size_t size, activation_precision precision) {
+            if (precision == activation_precision::fast) { simd::fast_softmax(x, y, size); return; }
+            stable_softmax(x, y, size);
+        }
+
+        // y = f(x) for size elements in one pass, y can be the same as x
+        // softmax is computed for each sample_size elements separately
+        template<typename T>
+        void activate(activation_kind kind, activation_precision precision,
+                      const T *x, T *y, size_t size, size_t sample_size) {
+            switch (kind) {
+            case activation_kind::identity:
+                if (x != y) { std::copy(x, x + size, y); }
+                break;
+            case activation_kind::sigmoid:
+                sigmoid_apply(x, y, size, precision);
+                break;
+            case activation_kind::relu:
+                for (size_t i = 0; i < size; i++) { y[i] = relu(x[i]); }
+                break;
+            case activation_kind::tanh:
+                tanh_apply(x, y, size, precision);
+                break;
+            case activation_kind::softmax:
+                assert(sample_size > 0 && size % sample_size == 0);
+                for (size_t s = 0; s < size; s += sample_size) { softmax_apply(x + s, y + s, sample_size, precision); }
+                break;
+            case activation_kind::custom:
+                assert(false);
+                break;
+            }
+        }
+
+        // x = f(x) for size elements, softmax is computed for each sample_size elements separately
+        template<typename T>
+        void activate_inplace(activation_kind kind, activation_precision precision,
+                              T *x, size_t size, size_t sample_size) {
+            activate(kind, precision, x, x, size, sample_size);
+        }
+
+        // x = f'(x) for size elements
+        template<typename T>
+        void derivative_inplace(activation_kind kind, activation_precision precision, T *x, size_t size) {
+            switch (kind) {
+            case activation_kind::identity:
+            // derivative of softmax is cancelled out by the cross-entropy cost
+            case activation_kind::softmax:
+                std::fill(x, x + size, T(1));
+                break;
+            case activation_kind::sigmoid:
+                sigmoid_apply(x, x, size, precision);
+                for (size_t i = 0; i < size; i++) { x[i] = x[i] * (T(1) - x[i]); }
+                break;
+            case activation_kind::relu:
+                for (size_t i = 0; i < size; i++) { x[i] = x[i] > T(0) ? T(1) : T(0); }
+                break;
+            case activation_kind::tanh:
+                tanh_apply(x, x, size, precision);
+                for (size_t i = 0; i < size; i++) { x[i] = T(1) - x[i] * x[i]; }
+                break;
+            case activation_kind::custom:
+                assert(false);
+                break;
+            }
+        }
+
+        // error = error [X] f'(z) for size elements
+        template<typename T>
+        void derivative_mul(activation_kind kind, activation_precision precision,
+                            const T *z, T *error, size_t size) {
+            // f(z) of sigmoid and tanh is computed in small chunks which stay in cache
+            const size_t chunk = 256;
+            T f[chunk];
+
+            switch (kind) {
+            case activation_kind::identity:
+            // derivative of softmax is cancelled out by the cross-entropy cost
+            case activation_kind::softmax:
+                break;
+            case activation_kind::sigmoid:
+                for (size_t i = 0; i < size; i += chunk) {
+                    const size_t n = std::min(chunk, size - i);
+                    std::copy(z + i, z + i + n, f);
+                    sigmoid_apply(f, f, n, precision);
+                    for (size_t j = 0; j < n; j++) { error[i + j] *= f[j] * (T(1) - f[j]); }
+                }
+                break;
+            case activation_kind::relu:
+                for (size_t i = 0; i < size; i++) { error[i] = z[i] > T(0) ? error[i] : T(0); }
+                break;
+            case activation_kind::tanh:
+                for (size_t i = 0; i < size; i += chunk) {
+                    const size_t n = std::min(chunk, size - i);
+                    std::copy(z + i, z + i + n, f);
+                    tanh_apply(f, f, n, precision);
+                    for (size_t j = 0; j < n; j++) { error[i + j] *= T(1) - f[j] * f[j]; }
+                }
+                break;
+            case activation_kind::custom:
+                assert(false);
+                break;
+            }
+        }
+    }
+
     template<typename T>
     class activator_t {
         using activator_func_t = std::function<array3d_t<T>(const array3d_t<T>&)>;
     public:
+        explicit activator_t(activation_kind kind,
+                             activation_precision precision = activation_precision::precise):
+            kind_(kind),
+            precision_(precision)
+        {
+            assert(kind != activation_kind::custom);
+        }
+
+        // custom functions are called for each sample and return new arrays
         activator_t(activator_func_t const &activation_func,
                     activator_func_t const &derivative):
+            kind_(activation_kind::custom),
+            precision_(activation_precision::precise),
             activation_func_(activation_func),
             derivative_(derivative)
         { }
 
         activator_t(activator_t const &other):
+            kind_(other.kind_),
+            precision_(other.precision_),
             activation_func_(other.activation_func_),
             derivative_(other.derivative_)
         { }
 
     public:
-        array3d_t<T> activate(array3d_t<T> const &v) const { return activation_func_(v); }
-        array3d_t<T> derivative(array3d_t<T> const &v) const { return derivative_(v); }
+        activation_kind kind() const { return kind_; }
+        activation_precision precision() const { return precision_; }
+
+        array3d_t<T> activate(array3d_t<T> const &v) const {
+            if (kind_ == activation_kind::custom) { return activation_func_(v); }
+            array3d_t<T> result(v);
+            activate_inplace(result);
+            return result;
+        }
+
+        array3d_t<T> derivative(array3d_t<T> const &v) const {
+            if (kind_ == activation_kind::custom) { return derivative_(v); }
+            array3d_t<T> result(v);
+            derivative_inplace(result);
+            return result;
+        }
+
+        array4d_t<T> activate(array4d_t<T> const &v) const {
+            array4d_t<T> result(v);
+            activate_inplace(result);
+            return result;
+        }
+
+        array4d_t<T> derivative(array4d_t<T> const &v) const {
+            array4d_t<T> result(v);
+            derivative_inplace(result);
+            return result;
+        }
+
+        void activate_inplace(array3d_t<T> &v) const {
+            if (kind_ == activation_kind::custom) { v = activation_func_(v); return; }
+            detail::activate_inplace(kind_, precision_, v.data().data(), v.size(), v.size());
+        }
+
+        void derivative_inplace(array3d_t<T> &v) const {
+            if (kind_ == activation_kind::custom) { v = derivative_(v); return; }
+            detail::derivative_inplace(kind_, precision_, v.data().data(), v.size());
+        }
+
+        // functions are applied to each sample separately (e.g. softmax)
+        void activate_inplace(array4d_t<T> &v) const {
+            if (kind_ == activation_kind::custom) { apply(activation_func_, v); return; }
+            detail::activate_inplace(kind_, precision_, v.data().data(), v.data().size(), v.shape().capacity());
+        }
+
+        void derivative_inplace(array4d_t<T> &v) const {
+            if (kind_ == activation_kind::custom) { apply(derivative_, v); return; }
+            detail::derivative_inplace(kind_, precision_, v.data().data(), v.data().size());
+        }
+
+        // output = f(z) in one pass, output is resized to z
+        void activate(array4d_t<T> const &z, array4d_t<T> &output) const {
+            output.resize(z.batch(), z.shape());
+            if (kind_ == activation_kind::custom) {
+                std::copy(z.data().begin(), z.data().end(), output.data().begin());
+                apply(activation_func_, output);
+                return;
+            }
+            detail::activate(kind_, precision_, z.data().data(), output.data().data(),
+                             z.data().size(), z.shape().capacity());
+        }
+
+        // dense view is activated as one sample (e.g. temporaries from the arena)
+        void activate_inplace(array3d_view_t<T> const &v) const {
+            const size_t size = v.shape().capacity();
+            if (kind_ == activation_kind::custom) {
+                array3d_t<T> result = activation_func_(array3d_t<T>(v.shape(), aligned_vector_t<T>(v.data(), v.data() + size)));
+                std::copy(result.data().begin(), result.data().end(), v.data());
+                return;
+            }
+            detail::activate_inplace(kind_, precision_, v.data(), size, size);
+        }
+
+        // error = error [X] f'(z) in one pass without temporary arrays
+        void derivative_mul(array4d_t<T> const &z, array4d_t<T> &error) const {
+            assert(z.batch() == error.batch());
+            assert(z.shape() == error.shape());
+            if (kind_ == activation_kind::custom) { error.element_mul(derivative(z)); return; }
+            detail::derivative_mul(kind_, precision_, z.data().data(), error.data().data(), error.data().size());
+        }
+
+    private:
+        static void apply(activator_func_t const &f, array4d_t<T> &v) {
+            const size_t batch = v.batch();
+            for (size_t b = 0; b < batch; b++) {
+                v.set_sample(b, f(v.sample(b)));
+            }
+        }
 
     private:
+        activation_kind kind_;
+        activation_precision precision_;
         activator_func_t activation_func_;
         activator_func_t derivative_;
     };
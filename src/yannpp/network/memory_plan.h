@@ -0,0 +1,95 @@
+#ifndef MEMORY_PLAN_H
+#define MEMORY_PLAN_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+namespace yannpp {
+    // static plan of the memory for tensors with known sizes and live ranges
+    // tensors which live ranges do not intersect share the same buffer
+    class memory_plan_t {
+    private:
+        struct tensor_t {
+            size_t size;
+            // steps of the execution when tensor is written first and read last
+            size_t first, last;
+            size_t buffer;
+        };
+
+        struct buffer_t {
+            size_t size;
+            size_t last;
+        };
+
+    public:
+        // returns id of the tensor
+        size_t add(size_t size, size_t first, size_t last) {
+            assert(first <= last);
+            tensors_.push_back({size, first, last, 0});
+            return tensors_.size() - 1;
+        }
+
+        // tensors are assigned in the order of their first step to a free buffer
+        // which size is the closest (this gives the minimal number of buffers)
+        void build() {
+            buffers_.clear();
+            std::vector<size_t> order(tensors_.size());
+            std::iota(order.begin(), order.end(), size_t(0));
+            std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+                return tensors_[a].first < tensors_[b].first;
+            });
+
+            for (size_t t: order) {
+                tensor_t &tensor = tensors_[t];
+                size_t best = buffers_.size();
+                for (size_t b = 0; b < buffers_.size(); b++) {
+                    if (buffers_[b].last >= tensor.first) { continue; }
+                    if (best == buffers_.size() || fits_better(buffers_[b].size, buffers_[best].size, tensor.size)) {
+                        best = b;
+                    }
+                }
+
+                if (best == buffers_.size()) {
+                    buffers_.push_back({tensor.size, tensor.last});
+                } else {
+                    buffers_[best].size = std::max(buffers_[best].size, tensor.size);
+                    buffers_[best].last = tensor.last;
+                }
+                tensor.buffer = best;
+            }
+        }
+
+        void clear() {
+            tensors_.clear();
+            buffers_.clear();
+        }
+
+    public:
+        size_t buffer(size_t tensor) const { return tensors_[tensor].buffer; }
+        size_t buffers_count() const { return buffers_.size(); }
+        // size of the biggest tensor assigned to the buffer
+        size_t buffer_size(size_t buffer) const { return buffers_[buffer].size; }
+        size_t total_size() const {
+            size_t total = 0;
+            for (auto &b: buffers_) { total += b.size; }
+            return total;
+        }
+
+    private:
+        // smallest buffer that fits the tensor, otherwise the biggest one
+        static bool fits_better(size_t candidate, size_t best, size_t size) {
+            const bool candidate_fits = candidate >= size, best_fits = best >= size;
+            if (candidate_fits != best_fits) { return candidate_fits; }
+            return candidate_fits ? (candidate < best) : (candidate > best);
+        }
+
+    private:
+        std::vector<tensor_t> tensors_;
+        std::vector<buffer_t> buffers_;
+    };
+}
+
+#endif // MEMORY_PLAN_H
@@ -137,8 +137,8 @@ void network1_t::update_mini_batch(const network1_t::training_data &data,
     // w = w - eta/minibatch_size * gradient_w
     // b = b - eta/minibatch_size * gradient_b
     for (size_t i = 0; i < size; i++) {
-        biases_[i].add(nabla_b[i].mul(-scale));
-        weights_[i].mul(decay).add(nabla_w[i].mul(-scale));
+        biases_[i] -= nabla_b[i] * scale;
+        weights_[i] = weights_[i] * decay - nabla_w[i] * scale;
     }
 }
 
@@ -1,16 +1,25 @@
 #ifndef NETWORK2_H
 #define NETWORK2_H
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <numeric>
 #include <initializer_list>
 #include <vector>
 #include <tuple>
 #include <memory>
 
+#include <yannpp/common/allocator.h>
+#include <yannpp/common/arena.h>
+#include <yannpp/common/array4d.h>
 #include <yannpp/common/cpphelpers.h>
 #include <yannpp/common/log.h>
+#include <yannpp/common/thread_pool.h>
 #include <yannpp/optimizer/optimizer.h>
 #include <yannpp/layers/fullyconnectedlayer.h>
 #include <yannpp/network/activator.h>
+#include <yannpp/network/memory_plan.h>
 
 namespace yannpp {
     template<typename T>
@@ -23,11 +32,17 @@ namespace yannpp {
 
     public:
         network2_t(std::initializer_list<layer_type> layers):
-            layers_(layers)
+            layers_(layers),
+            planned_shape_(0, 0, 0),
+            planned_batch_(0),
+            bound_version_(0)
         {}
 
         network2_t(std::vector<layer_type> &&layers):
-            layers_(std::move(layers))
+            layers_(std::move(layers)),
+            planned_shape_(0, 0, 0),
+            planned_batch_(0),
+            bound_version_(0)
         {}
 
     public:
@@ -37,11 +52,55 @@ namespace yannpp {
             }
         }
 
+        // also plans buffers of activations and gradients for the inputs
+        // of the given shape and batches up to batch samples
+        void init_layers(shape3d_t const &input_shape, size_t batch = 1) {
+            init_layers();
+            plan_memory(input_shape, batch);
+        }
+
+        // threads which train on parts of each minibatch (see train())
+        size_t workers_number() const { return replicas_.size() + 1; }
+
+        // number of reusable buffers in the memory plan
+        size_t planned_buffers() const { return memory_plan_.buffers_count(); }
+
+        // all parameters (and gradients) of the network in one contiguous buffer
+        // arrays follow the order of layers and their parameters() and are aligned
+        // with zero padding, so the whole model is saved or restored with one copy
+        // values are assumed to be written after the call, a pointer which is kept
+        // and written later needs parameters_changed() before the next feedforward
+        data_type *parameters_data() {
+            bind_parameters();
+            parameters_changed();
+            return (data_type*)parameters_arenas_[0]->data();
+        }
+        data_type *gradients_data() { bind_parameters(); return (data_type*)gradients_arenas_[0]->data(); }
+        size_t parameters_size() { bind_parameters(); return parameters_arenas_[0]->used() / sizeof(data_type); }
+
+        // layers recompute what they cache of their weights (e.g. filter spectra)
+        void parameters_changed() {
+            for (auto &layer: layers_) { layer->parameters_changed(); }
+        }
+
+#define INPUT(i) std::get<0>(data[i])
+#define RESULT(i) std::get<1>(data[i])
+
+        // with threads_number > 1 each minibatch is split between worker threads
+        // that own replicas of the layers (data-parallel training)
+        // workers are limited by the threads of the pool (see set_threads_number())
         void train(network2_t::training_data const &data,
                    optimizer_t<data_type> const &optimizer,
                    size_t epochs,
-                   size_t minibatch_size) {
+                   size_t minibatch_size,
+                   size_t threads_number = 1) {
             log("Training using %d inputs", data.size());
+            create_replicas(std::min(threads_number, yannpp::threads_number()));
+            bind_parameters();
+            // each worker processes at most this part of the minibatch
+            const size_t workers = replicas_.size() + 1;
+            const size_t workers_batch = (minibatch_size + workers - 1) / workers;
+            plan_memory(INPUT(0).shape(), workers_batch);
             // big chunk of data is used for training while
             // small chunk - for validation after some epochs
             const size_t training_size = 5 * data.size() / 6;
@@ -68,62 +127,273 @@ namespace yannpp {
 
         // feeds input a to the network and returns output
         t_d feedforward(t_d const &a) {
-            array3d_t<network2_t::data_type> input(a);
-            for (auto &layer: layers_) {
-                input = layer->feedforward(std::move(input));
-            }
-            return input;
+            plan_memory(a.shape(), 1);
+            return feedforward(0, a).sample(0);
         }
 
-#define INPUT(i) std::get<0>(data[i])
-#define RESULT(i) std::get<1>(data[i])
-
         // evaluates number of correctly classified inputs (validation data)
         size_t evaluate(training_data const &data, std::vector<size_t> const &indices) {
-            size_t count = 0;
-            for (auto i: indices) {
-                network2_t::t_d result = feedforward(INPUT(i));
-                assert(result.size() == RESULT(i).size());
-                if (argmax1d(result) == argmax1d(RESULT(i))) { count++; }
-            }
+            if (indices.empty()) { return 0; }
+            plan_memory(INPUT(indices[0]).shape(), 1);
+            std::atomic<size_t> count(0);
+            for_each_worker(indices.size(), [&](size_t w, size_t begin, size_t end) {
+                size_t worker_count = 0;
+                for (size_t i = begin; i < end; i++) {
+                    auto &result = feedforward(w, INPUT(indices[i]));
+                    assert(result.size() == RESULT(indices[i]).size());
+                    const data_type *output = result.sample_data(0);
+                    const size_t predicted = std::max_element(output, output + result.size()) - output;
+                    if (predicted == argmax1d(RESULT(indices[i]))) { worker_count++; }
+                }
+                count += worker_count;
+            });
             return count;
         }
 
+        // one step of training on the given minibatch with the replicas
+        // created by the last train() (single-threaded before it)
+        void train_mini_batch(training_data const &data,
+                              std::vector<size_t> const &indices,
+                              optimizer_t<data_type> const &optimizer) {
+            assert(!indices.empty());
+            bind_parameters();
+            const size_t workers = replicas_.size() + 1;
+            plan_memory(INPUT(indices[0]).shape(), (indices.size() + workers - 1) / workers);
+            update_mini_batch(data, indices, optimizer);
+        }
+
     private:
+        // plain feedforward runs in inference mode so layers do not keep
+        // activations and patches which are needed only for backpropagation
+        // and returns the planned buffer with the output of the last layer
+        array4d_t<data_type> const &feedforward(size_t w, t_d const &a) {
+            // temporaries of the layers are released when the sample is done
+            arena_scope_t scope;
+            auto &layers = worker_layers(w);
+            auto &buffers = buffers_[w];
+            const size_t layers_size = layers.size();
+            for (auto &layer: layers) { layer->set_inference(true); }
+
+            auto &input = buffers[activation_buffer(0)];
+            input.resize(1, a.shape());
+            input.set_sample(0, a);
+            for (size_t i = 0; i < layers_size; i++) {
+                layers[i]->feedforward_into(buffers[activation_buffer(i)], buffers[activation_buffer(i + 1)]);
+            }
+
+            for (auto &layer: layers) { layer->set_inference(false); }
+            return buffers[activation_buffer(layers_size)];
+        }
+
         // updates network weights and biases using one
         // iteration of gradient descent using mini_batch of inputs and outputs
         void update_mini_batch(training_data const &data,
                                std::vector<size_t> const &indices,
                                optimizer_t<network2_t::data_type> const &strategy) {
-            for (auto i: indices) {
-                backpropagate(INPUT(i), RESULT(i));
-            }
+            // each worker processes its own chunk of the minibatch
+            for_each_worker(indices.size(), [&](size_t w, size_t begin, size_t end) {
+                backpropagate(w, data, indices, begin, end);
+            });
+
+            reduce_gradients();
 
             for (auto &layer: layers_) {
                 layer->optimize(strategy);
             }
+
+            sync_parameters();
         }
 
         // runs a loop of propagation of inputs and backpropagation of errors
         // back to the beginning with weights and biases updates as a result
-        void backpropagate(t_d const &x, t_d const &result) {
-            const size_t layers_size = layers_.size();
-            array3d_t<network2_t::data_type> input(x);
+        // minibatch is stacked into the planned buffers so layers can process it at once
+        void backpropagate(size_t w,
+                           training_data const &data,
+                           std::vector<size_t> const &indices,
+                           size_t begin, size_t end) {
+            // temporaries of the layers are released when the minibatch chunk is done
+            arena_scope_t scope;
+            auto &layers = worker_layers(w);
+            auto &buffers = buffers_[w];
+            const size_t layers_size = layers.size();
+            const size_t batch = end - begin;
+
+            auto &input = buffers[activation_buffer(0)];
+            input.resize(batch, INPUT(indices[begin]).shape());
+            for (size_t b = 0; b < batch; b++) { input.set_sample(b, INPUT(indices[begin + b])); }
 
             // feedforward input
             for (size_t i = 0; i < layers_size; i++) {
-                input = layers_[i]->feedforward(std::move(input));
+                layers[i]->feedforward_into(buffers[activation_buffer(i)], buffers[activation_buffer(i + 1)]);
             }
 
+            // expected results can share the buffer with the input so they are stacked only now
+            auto &result = buffers[gradient_buffer(layers_size)];
+            result.resize(batch, RESULT(indices[begin]).shape());
+            for (size_t b = 0; b < batch; b++) { result.set_sample(b, RESULT(indices[begin + b])); }
+
             // backpropagate error
-            array3d_t<network2_t::data_type> error(result);
             for (size_t i = layers_size; i-- > 0;) {
-                error = layers_[i]->backpropagate(std::move(error));
+                layers[i]->backpropagate_into(buffers[gradient_buffer(i + 1)], buffers[gradient_buffer(i)]);
+            }
+        }
+
+#undef INPUT
+#undef RESULT
+
+    private:
+        // activation i is the input of layer i and gradient i is the error with regards to it
+        // layer i reads activation i and writes activation i + 1 at step i + 1
+        // and later reads gradient i + 1 and writes gradient i at step 2 * layers + 1 - i
+        // layers read their input again in backpropagation instead of keeping a copy
+        // so activations live until then while gradients are ping-ponged in a couple of buffers
+        void plan_memory(shape3d_t const &input_shape, size_t batch) {
+            const size_t workers = replicas_.size() + 1;
+            if (input_shape == planned_shape_ && batch <= planned_batch_ && buffers_.size() == workers) { return; }
+
+            const size_t layers_size = layers_.size();
+            std::vector<shape3d_t> shapes(1, input_shape);
+            for (auto &layer: layers_) { shapes.push_back(layer->get_output_shape(shapes.back())); }
+
+            memory_plan_.clear();
+            activations_.clear();
+            gradients_.clear();
+            for (size_t i = 0; i <= layers_size; i++) {
+                activations_.push_back(memory_plan_.add(shapes[i].capacity(), i, std::max(i + 1, 2 * layers_size + 1 - i)));
+            }
+            for (size_t i = 0; i <= layers_size; i++) {
+                gradients_.push_back(memory_plan_.add(shapes[i].capacity(), 2 * layers_size + 1 - i, 2 * layers_size + 2 - i));
+            }
+            memory_plan_.build();
+
+            // buffers are allocated once for the biggest batch
+            planned_shape_ = input_shape;
+            planned_batch_ = std::max(batch, planned_batch_);
+            buffers_.clear();
+            buffers_.resize(workers);
+            for (auto &buffers: buffers_) {
+                for (size_t b = 0; b < memory_plan_.buffers_count(); b++) {
+                    buffers.emplace_back(planned_batch_, shape_row((int)memory_plan_.buffer_size(b)), data_type(0));
+                }
+            }
+        }
+
+        size_t activation_buffer(size_t i) const { return memory_plan_.buffer(activations_[i]); }
+        size_t gradient_buffer(size_t i) const { return memory_plan_.buffer(gradients_[i]); }
+
+        // worker 0 uses original layers and others use replicas
+        std::vector<layer_type> &worker_layers(size_t w) {
+            return (w == 0) ? layers_ : replicas_[w - 1];
+        }
+
+        void create_replicas(size_t threads_number) {
+            // new replicas are bound to the new arenas by the next bind_parameters()
+            parameters_arenas_.clear();
+            gradients_arenas_.clear();
+            replicas_.clear();
+            for (size_t w = 1; w < threads_number; w++) {
+                std::vector<layer_type> replica;
+                for (auto &layer: layers_) {
+                    replica.emplace_back(layer->clone());
+                }
+                replicas_.emplace_back(std::move(replica));
+            }
+        }
+
+        // splits [0, size) into contiguous chunks and runs f(worker, begin, end)
+        // for each of them as tasks of the thread pool
+        template<typename F>
+        void for_each_worker(size_t size, F f) {
+            const size_t workers = replicas_.size() + 1;
+            parallel_for(0, workers, 1, [&](size_t w_begin, size_t w_end) {
+                for (size_t w = w_begin; w < w_end; w++) {
+                    const size_t begin = w * size / workers, end = (w + 1) * size / workers;
+                    if (begin < end) { f(w, begin, end); }
+                }
+            });
+        }
+
+        // sums gradients of all replicas into the original layers
+        // arenas of all workers have the same layout so it is one pass over them
+        void reduce_gradients() {
+            data_type *gradients = (data_type*)gradients_arenas_[0]->data();
+            const size_t size = gradients_arenas_[0]->used() / sizeof(data_type);
+            for (size_t w = 1; w < gradients_arenas_.size(); w++) {
+                data_type *replica = (data_type*)gradients_arenas_[w]->data();
+                parallel_for(0, size, parallel_grain_work, [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++) {
+                        gradients[i] += replica[i];
+                        replica[i] = data_type(0);
+                    }
+                });
+            }
+        }
+
+        // copies updated weights and biases to the replicas
+        void sync_parameters() {
+            for (size_t w = 1; w < parameters_arenas_.size(); w++) {
+                assert(parameters_arenas_[w]->used() == parameters_arenas_[0]->used());
+                std::memcpy(parameters_arenas_[w]->data(), parameters_arenas_[0]->data(), parameters_arenas_[0]->used());
+                for (auto &layer: worker_layers(w)) { layer->parameters_changed(); }
+            }
+        }
+
+        // moves parameters and gradients of each worker into two flat arenas
+        // layers keep using their arrays which now point into the arenas
+        // it is done once for the replicas and again only after layers
+        // replace their arrays (e.g. with load(), see parameters_version())
+        void bind_parameters() {
+            const size_t workers = replicas_.size() + 1;
+            if (parameters_arenas_.size() == workers && bound_version_ == parameters_version()) { return; }
+
+            parameters_arenas_.clear();
+            gradients_arenas_.clear();
+            for (size_t w = 0; w < workers; w++) {
+                size_t bytes = 0;
+                for (auto &layer: worker_layers(w)) {
+                    for (auto &p: layer->parameters()) { bytes += flat_arena_t::footprint(p.value->size() * sizeof(data_type)); }
+                }
+
+                auto parameters_arena = std::make_shared<flat_arena_t>(bytes);
+                auto gradients_arena = std::make_shared<flat_arena_t>(bytes);
+                for (auto &layer: worker_layers(w)) {
+                    for (auto &p: layer->parameters()) {
+                        assert(p.value->size() == p.nabla->size());
+                        move_to_arena(*p.value, parameters_arena);
+                        move_to_arena(*p.nabla, gradients_arena);
+                    }
+                }
+
+                parameters_arenas_.emplace_back(std::move(parameters_arena));
+                gradients_arenas_.emplace_back(std::move(gradients_arena));
+            }
+
+            bound_version_ = parameters_version();
+        }
+
+        // versions only grow so the sum changes after any of the layers replaces arrays
+        size_t parameters_version() {
+            const size_t workers = replicas_.size() + 1;
+            size_t version = 0;
+            for (size_t w = 0; w < workers; w++) {
+                for (auto &layer: worker_layers(w)) { version += layer->parameters_version(); }
             }
+            return version;
         }
 
     private:
         std::vector<std::shared_ptr<layer_base_t<data_type>>> layers_;
+        // per-thread copies of layers for the data-parallel training
+        std::vector<std::vector<layer_type>> replicas_;
+        // static plan of activations and gradients and per-worker buffers
+        memory_plan_t memory_plan_;
+        std::vector<size_t> activations_, gradients_;
+        shape3d_t planned_shape_;
+        size_t planned_batch_;
+        std::vector<std::vector<array4d_t<data_type>>> buffers_;
+        // per-worker flat storage of parameters and gradients of the layers
+        std::vector<std::shared_ptr<flat_arena_t>> parameters_arenas_, gradients_arenas_;
+        size_t bound_version_;
     };
 }
 
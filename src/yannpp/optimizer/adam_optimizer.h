@@ -0,0 +1,113 @@
+#ifndef ADAM_OPTIMIZER_H
+#define ADAM_OPTIMIZER_H
+
+#include <cmath>
+
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/simd.h>
+#include <yannpp/optimizer/optimizer.h>
+
+namespace yannpp {
+    namespace detail {
+        // see simd::adam_coefficients_t, kept in the precision of the parameters
+        template<typename T>
+        struct adam_coefficients_t {
+            T beta1;
+            T beta2;
+            T step_size;
+            T epsilon;
+            T gradient_scale;
+            T l2;
+            T decay;
+        };
+
+        // see simd::adam_update()
+        template<typename T>
+        void adam_update(T *w, T *g, T *m, T *v, adam_coefficients_t<T> const &c, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                const T gi = g[i] * c.gradient_scale + c.l2 * w[i];
+                m[i] = c.beta1 * m[i] + (T(1) - c.beta1) * gi;
+                v[i] = c.beta2 * v[i] + (T(1) - c.beta2) * gi * gi;
+                w[i] = w[i] * c.decay - c.step_size * m[i] / (std::sqrt(v[i]) + c.epsilon);
+                g[i] = T(0);
+            }
+        }
+
+        inline void adam_update(float *w, float *g, float *m, float *v, adam_coefficients_t<float> const &c, size_t size) {
+            simd::adam_coefficients_t sc;
+            sc.beta1 = c.beta1;
+            sc.beta2 = c.beta2;
+            sc.step_size = c.step_size;
+            sc.epsilon = c.epsilon;
+            sc.gradient_scale = c.gradient_scale;
+            sc.l2 = c.l2;
+            sc.decay = c.decay;
+            simd::adam_update(w, g, m, v, sc, size);
+        }
+    }
+
+    // Adam with first and second moments kept in the layers next to parameters
+    // decoupled weight decay gives AdamW, otherwise decay is added to the gradient
+    // gradients are averaged over the minibatch, biases are not decayed
+    template <typename T>
+    class adam_optimizer_t: public optimizer_t<T> {
+    public:
+        adam_optimizer_t(size_t minibatch_size,
+                         T learning_rate,
+                         T weight_decay = T(0),
+                         bool decoupled_decay = true,
+                         T beta1 = T(0.9),
+                         T beta2 = T(0.999),
+                         T epsilon = T(1e-8)):
+            minibatch_size_(minibatch_size),
+            learning_rate_(learning_rate),
+            weight_decay_(weight_decay),
+            decoupled_decay_(decoupled_decay),
+            beta1_(beta1),
+            beta2_(beta2),
+            epsilon_(epsilon)
+        {}
+
+    public:
+        using optimizer_t<T>::update_bias;
+        using optimizer_t<T>::update_weights;
+
+        // first and second moments
+        virtual size_t state_size() const override { return 2; }
+
+        virtual void update_bias(T *b, T *nabla_b, T *const *state, size_t step, size_t size) const override {
+            detail::adam_update(b, nabla_b, state[0], state[1], coefficients(step, false), size);
+        }
+
+        virtual void update_weights(T *w, T *nabla_w, T *const *state, size_t step, size_t size) const override {
+            detail::adam_update(w, nabla_w, state[0], state[1], coefficients(step, true), size);
+        }
+
+    private:
+        // bias corrections are computed once per step instead of once per element
+        detail::adam_coefficients_t<T> coefficients(size_t step, bool decay) const {
+            const double correction1 = 1.0 - std::pow((double)beta1_, (double)step);
+            const double correction2 = std::sqrt(1.0 - std::pow((double)beta2_, (double)step));
+            detail::adam_coefficients_t<T> c;
+            c.beta1 = beta1_;
+            c.beta2 = beta2_;
+            c.step_size = T(learning_rate_ * correction2 / correction1);
+            c.epsilon = T(epsilon_ * correction2);
+            c.gradient_scale = T(1) / T(minibatch_size_);
+            c.l2 = (decay && !decoupled_decay_) ? weight_decay_ : T(0);
+            c.decay = (decay && decoupled_decay_) ? T(1) - learning_rate_ * weight_decay_ : T(1);
+            return c;
+        }
+
+    private:
+        size_t minibatch_size_;
+        T learning_rate_;
+        T weight_decay_;
+        bool decoupled_decay_;
+        T beta1_;
+        T beta2_;
+        T epsilon_;
+    };
+}
+
+#endif // ADAM_OPTIMIZER_H
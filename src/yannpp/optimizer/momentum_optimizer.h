@@ -0,0 +1,77 @@
+#ifndef MOMENTUM_OPTIMIZER_H
+#define MOMENTUM_OPTIMIZER_H
+
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/simd.h>
+#include <yannpp/optimizer/optimizer.h>
+
+namespace yannpp {
+    namespace detail {
+        // v = momentum * v - nabla_w * scale
+        // w = w * decay + v (nesterov: w = w * decay + momentum * v - nabla_w * scale)
+        // nabla_w = 0
+        template<typename T>
+        void momentum_update(T *w, T *nabla_w, T *v, T decay, T scale, T momentum, bool nesterov, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                const T step = -nabla_w[i] * scale;
+                v[i] = momentum * v[i] + step;
+                w[i] = w[i] * decay + (nesterov ? momentum * v[i] + step : v[i]);
+                nabla_w[i] = T(0);
+            }
+        }
+
+        inline void momentum_update(float *w, float *nabla_w, float *v, float decay, float scale,
+                                    float momentum, bool nesterov, size_t size) {
+            simd::momentum_update(w, nabla_w, v, decay, scale, momentum, nesterov, size);
+        }
+    }
+
+    // gradient descent with momentum, velocity is kept in the layers
+    // next to parameters and updated in the same pass as weights
+    // learning rate and weight decay are scaled the same way as in sdg_optimizer_t
+    template <typename T>
+    class momentum_optimizer_t: public optimizer_t<T> {
+    public:
+        momentum_optimizer_t(size_t minibatch_size,
+                             size_t input_size,
+                             T decay_rate,
+                             T learning_rate,
+                             T momentum,
+                             bool nesterov = false):
+            minibatch_size_(minibatch_size),
+            input_size_(input_size),
+            weight_decay_(decay_rate),
+            learning_rate_(learning_rate),
+            momentum_(momentum),
+            nesterov_(nesterov)
+        {}
+
+    public:
+        using optimizer_t<T>::update_bias;
+        using optimizer_t<T>::update_weights;
+
+        // velocity
+        virtual size_t state_size() const override { return 1; }
+
+        virtual void update_bias(T *b, T *nabla_b, T *const *state, size_t, size_t size) const override {
+            T scale = learning_rate_ / (T)minibatch_size_;
+            detail::momentum_update(b, nabla_b, state[0], T(1), scale, momentum_, nesterov_, size);
+        }
+
+        virtual void update_weights(T *w, T *nabla_w, T *const *state, size_t, size_t size) const override {
+            T scale = learning_rate_;
+            T decay = T(1) - learning_rate_*weight_decay_ / (T)input_size_;
+            detail::momentum_update(w, nabla_w, state[0], decay, scale, momentum_, nesterov_, size);
+        }
+
+    private:
+        size_t minibatch_size_;
+        size_t input_size_;
+        T weight_decay_;
+        T learning_rate_;
+        T momentum_;
+        bool nesterov_;
+    };
+}
+
+#endif // MOMENTUM_OPTIMIZER_H
@@ -1,16 +1,79 @@
 #ifndef OPTIMIZATION_ALGORITHM_H
 #define OPTIMIZATION_ALGORITHM_H
 
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+#include <yannpp/common/array3d.h>
+#include <yannpp/common/thread_pool.h>
+
 namespace yannpp {
+    // per-parameter state of the optimizer for one parameters array
     template <typename T>
-    class array3d_t;
+    struct optimizer_state_t {
+        optimizer_state_t(): step(0) {}
+
+        // state_size() arrays of the same shape as parameters (e.g. velocity)
+        std::vector<array3d_t<T>> arrays;
+        // number of updates of the parameters including the current one
+        size_t step;
+    };
 
     template <typename T>
     class optimizer_t {
+    public:
+        // maximum number of state arrays per parameters array
+        static const size_t max_state_size = 4;
+
     public:
         virtual ~optimizer_t() {}
-        virtual void update_bias(array3d_t<T> &b, array3d_t<T> &nabla_b) const = 0;
-        virtual void update_weights(array3d_t<T> &w, array3d_t<T> &nabla_w) const = 0;
+
+        virtual size_t state_size() const { return 0; }
+
+        // kernels update size parameters and zero their gradients in the same pass
+        // so layers do not need to reset gradients after the update
+        // state has state_size() pointers to the same range of the state arrays
+        // and step is the number of updates starting from 1 (e.g. for bias correction)
+        // disjoint ranges of the same array can be updated from different threads
+        virtual void update_bias(T *b, T *nabla_b, T *const *state, size_t step, size_t size) const = 0;
+        virtual void update_weights(T *w, T *nabla_w, T *const *state, size_t step, size_t size) const = 0;
+
+        // big arrays are split into ranges updated in parallel
+        // state is created with zeros on the first update
+        virtual void update_bias(array3d_t<T> &b, array3d_t<T> &nabla_b, optimizer_state_t<T> &state) const {
+            update(b, nabla_b, state, false);
+        }
+
+        virtual void update_weights(array3d_t<T> &w, array3d_t<T> &nabla_w, optimizer_state_t<T> &state) const {
+            update(w, nabla_w, state, true);
+        }
+
+    private:
+        void update(array3d_t<T> &p, array3d_t<T> &nabla, optimizer_state_t<T> &state, bool weights) const {
+            assert(p.size() == nabla.size());
+            const size_t state_count = state_size();
+            assert(state_count <= max_state_size);
+            auto &arrays = state.arrays;
+            if (arrays.size() != state_count || (state_count > 0 && !(arrays[0].shape() == p.shape()))) {
+                arrays.clear();
+                for (size_t s = 0; s < state_count; s++) { arrays.emplace_back(p.shape(), T(0)); }
+                state.step = 0;
+            }
+            const size_t step = ++state.step;
+
+            T *pp = p.data().data(), *pnabla = nabla.data().data();
+            parallel_for(0, p.size(), parallel_grain_work, [&](size_t begin, size_t end) {
+                std::array<T*, max_state_size> slots;
+                for (size_t s = 0; s < state_count; s++) { slots[s] = arrays[s].data().data() + begin; }
+                if (weights) {
+                    update_weights(pp + begin, pnabla + begin, slots.data(), step, end - begin);
+                } else {
+                    update_bias(pp + begin, pnabla + begin, slots.data(), step, end - begin);
+                }
+            });
+        }
     };
 }
 
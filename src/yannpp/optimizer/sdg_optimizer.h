@@ -2,9 +2,25 @@
 #define SDG_ALGO_H
 
 #include <yannpp/common/array3d.h>
+#include <yannpp/common/simd.h>
 #include <yannpp/optimizer/optimizer.h>
 
 namespace yannpp {
+    namespace detail {
+        // w = w * decay - nabla_w * scale, nabla_w = 0
+        template<typename T>
+        void sgd_update(T *w, T *nabla_w, T decay, T scale, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                w[i] = w[i] * decay - nabla_w[i] * scale;
+                nabla_w[i] = T(0);
+            }
+        }
+
+        inline void sgd_update(float *w, float *nabla_w, float decay, float scale, size_t size) {
+            simd::sgd_update(w, nabla_w, decay, scale, size);
+        }
+    }
+
     template <typename T>
     class sdg_optimizer_t: public optimizer_t<T> {
     public:
@@ -19,17 +35,20 @@ namespace yannpp {
         {}
 
     public:
-        virtual void update_bias(array3d_t<T> &b, array3d_t<T> &nabla_b) const override {
+        using optimizer_t<T>::update_bias;
+        using optimizer_t<T>::update_weights;
+
+        virtual void update_bias(T *b, T *nabla_b, T *const *, size_t, size_t size) const override {
             // b = b - eta/minibatch_size * gradient_b
             T scale = learning_rate_ / (T)minibatch_size_;
-            b.add(nabla_b.mul(-scale));
+            detail::sgd_update(b, nabla_b, T(1), scale, size);
         }
 
-        virtual void update_weights(array3d_t<T> &w, array3d_t<T> &nabla_w) const override {
+        virtual void update_weights(T *w, T *nabla_w, T *const *, size_t, size_t size) const override {
             // w = w - eta/minibatch_size * gradient_w
             T scale = learning_rate_;
             T decay = T(1) - learning_rate_*weight_decay_ / (T)input_size_;
-            w.mul(decay).add(nabla_w.mul(-scale));
+            detail::sgd_update(w, nabla_w, decay, scale, size);
         }
 
     private: